@@ -0,0 +1,232 @@
+// Engine benchmarks, headless so they also run on software implementations
+// such as lavapipe. Results are written as JSON for regression tracking.
+//
+//   vks_bench [--repetitions N] [--draws N] [--upload-mib N]
+//             [--model PATH] [--json PATH]
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_RADIANS
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "embedded_shaders.h"
+#include "percentile.h"
+#include "resources.h"
+#include "vk/context.h"
+#include "vk/device.h"
+
+using namespace std::string_literals;
+using vks::percentile;
+
+namespace {
+
+struct Options {
+    uint32_t repetitions{10};
+    uint32_t draws{1000};
+    uint32_t upload_mib{64};
+    std::filesystem::path model{"assets/obj/viking_room/viking_room.obj"};
+    std::filesystem::path json{};
+};
+
+struct Result {
+    std::string name;
+    std::vector<double> samples_ms;
+    // Named throughput figures derived from the median
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+Result measure(const std::string& name, uint32_t repetitions,
+               const std::function<void()>& run) {
+    Result result{name, {}, {}};
+    for (uint32_t i{0}; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        result.samples_ms.push_back(elapsedMs(start));
+    }
+    std::cerr << name << ": " << percentile(result.samples_ms, 0.5)
+              << " ms median" << std::endl;
+    return result;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results) {
+    out << std::fixed << std::setprecision(4);
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i{0}; i < results.size(); i++) {
+        const auto& result = results[i];
+        const auto& samples = result.samples_ms;
+        double mean{0.0};
+        for (auto sample : samples) {
+            mean += sample / samples.size();
+        }
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+            << "\", \"repetitions\": " << samples.size()
+            << ", \"mean_ms\": " << mean
+            << ", \"min_ms\": " << percentile(samples, 0.0)
+            << ", \"median_ms\": " << percentile(samples, 0.5)
+            << ", \"p95_ms\": " << percentile(samples, 0.95)
+            << ", \"max_ms\": " << percentile(samples, 1.0);
+        for (const auto& [metric, value] : result.metrics) {
+            out << ", \"" << metric << "\": " << value;
+        }
+        out << '}';
+    }
+    out << "\n  ]\n}\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options{};
+    for (int i{1}; i < argc; i++) {
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for "s + argv[i]);
+        }
+        if (argv[i] == "--repetitions"s) {
+            options.repetitions = std::max(1ul, std::stoul(argv[++i]));
+        } else if (argv[i] == "--draws"s) {
+            options.draws = std::stoul(argv[++i]);
+        } else if (argv[i] == "--upload-mib"s) {
+            options.upload_mib = std::max(1ul, std::stoul(argv[++i]));
+        } else if (argv[i] == "--model"s) {
+            options.model = argv[++i];
+        } else if (argv[i] == "--json"s) {
+            options.json = argv[++i];
+        } else {
+            throw std::runtime_error("Unknown option "s + argv[i]);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        auto options = parseOptions(argc, argv);
+        std::vector<Result> results{};
+
+        vks::Resources resources{};
+        results.push_back(
+            measure("model_load", options.repetitions, [&]() {
+                resources = {};
+                vks::Model::load(options.model, resources);
+            }));
+
+        results.push_back(
+            measure("texture_decode", options.repetitions, [&]() {
+                for (const auto& [path, texture] : resources.textures) {
+                    vks::Texture decoded{path};
+                }
+            }));
+
+        vks::Device device{VkExtent2D{1024, 768}};
+        vks::Context context{device};
+
+        std::vector<std::string> model_names{};
+        for (const auto& [name, model] : resources.models) {
+            model_names.push_back(name);
+        }
+        std::unordered_map<std::string, vks::ModelHandle> models{};
+        results.push_back(
+            measure("resource_pack_build", options.repetitions, [&]() {
+                models.clear();
+                models.merge(context.loadResources(model_names, resources));
+            }));
+
+        // Whole chunks through a fresh staging buffer, as writeStorage does
+        constexpr VkDeviceSize CHUNK{4 << 20};
+        VkDeviceSize upload_size{VkDeviceSize{options.upload_mib} << 20};
+        auto storage = context.createStorageBuffer(upload_size);
+        std::vector<uint8_t> data(CHUNK, 0x5a);
+        auto upload = measure("staging_upload", options.repetitions, [&]() {
+            for (VkDeviceSize offset{0}; offset < upload_size;
+                 offset += CHUNK) {
+                context.writeStorage(storage, data.data(),
+                                     std::min(CHUNK, upload_size - offset),
+                                     offset);
+            }
+        });
+        upload.metrics.emplace_back(
+            "mib_per_s", options.upload_mib /
+                             (percentile(upload.samples_ms, 0.5) / 1000.0));
+        results.push_back(std::move(upload));
+
+        auto pipeline = context.loadPipeline(vks::ShaderProgram::diffuse);
+        auto camera =
+            glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f) *
+            glm::lookAt(glm::vec3{30.0f, 30.0f, 30.0f}, glm::vec3{0.0f},
+                        glm::vec3{0.0f, 0.0f, 1.0f});
+        auto model = models.begin()->second;
+        auto side = static_cast<uint32_t>(std::ceil(std::sqrt(options.draws)));
+        // beginFrame waits for the frame slot fence, so the clock starts
+        // once it returns and only recording and submission are timed
+        auto recordFrame = [&]() -> std::optional<double> {
+            if (!context.beginFrame(camera)) {
+                return std::nullopt;
+            }
+            auto start = std::chrono::steady_clock::now();
+            context.bindPipeline(pipeline);
+            for (uint32_t i{0}; i < options.draws; i++) {
+                auto transform = glm::translate(
+                    glm::mat4{1.0f},
+                    glm::vec3{(i % side) * 2.0f, (i / side) * 2.0f, 0.0f});
+                context.draw(model, transform);
+            }
+            context.endFrame();
+            return elapsedMs(start);
+        };
+        auto measureFrames = [&](const std::string& name) {
+            // Warm up the render graph, transient memory and pipeline
+            // variants
+            for (uint32_t i{0}; i < 3; i++) {
+                context.waitForFrame();
+                recordFrame();
+            }
+            Result record{name, {}, {}};
+            for (uint32_t i{0}; i < options.repetitions; i++) {
+                context.waitForFrame();
+                if (auto ms = recordFrame()) {
+                    record.samples_ms.push_back(ms.value());
+                }
+            }
+            record.metrics.emplace_back("draws", options.draws);
+            record.metrics.emplace_back(
+                "us_per_draw", percentile(record.samples_ms, 0.5) * 1000.0 /
+                                   std::max(1u, options.draws));
+            results.push_back(std::move(record));
+        };
+        measureFrames("frame_record");
+
+        // Also checks that both culling pipelines are built and dispatched
+        if (context.occlusionCullingSupported()) {
+            context.setOcclusionCulling(true);
+            measureFrames("frame_record_culled");
+            context.setOcclusionCulling(false);
+        }
+
+        if (options.json.empty()) {
+            writeJson(std::cout, results);
+        } else {
+            std::ofstream file{options.json};
+            writeJson(file, results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
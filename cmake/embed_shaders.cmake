@@ -0,0 +1,72 @@
+# Generates a header holding every SPV_ROOT/<program>/<stage>.spv as a
+# constexpr word array, together with the ShaderProgram enumeration
+# indexing them. Invoked with -DSPV_ROOT=<dir> -DOUTPUT=<header>.
+
+set(STAGE_vert VK_SHADER_STAGE_VERTEX_BIT)
+set(STAGE_frag VK_SHADER_STAGE_FRAGMENT_BIT)
+set(STAGE_tesc VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT)
+set(STAGE_tese VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT)
+set(STAGE_geom VK_SHADER_STAGE_GEOMETRY_BIT)
+set(STAGE_comp VK_SHADER_STAGE_COMPUTE_BIT)
+
+file(GLOB PROGRAM_DIRS LIST_DIRECTORIES true ${SPV_ROOT}/*)
+list(SORT PROGRAM_DIRS)
+
+set(IDS "")
+set(ARRAYS "")
+set(PROGRAMS "")
+foreach(PROGRAM_DIR ${PROGRAM_DIRS})
+    if(NOT IS_DIRECTORY ${PROGRAM_DIR})
+        continue()
+    endif()
+    get_filename_component(PROGRAM ${PROGRAM_DIR} NAME)
+    file(GLOB STAGE_FILES ${PROGRAM_DIR}/*.spv)
+    list(SORT STAGE_FILES)
+
+    set(STAGES "")
+    foreach(STAGE_FILE ${STAGE_FILES})
+        get_filename_component(STAGE ${STAGE_FILE} NAME_WE)
+        if(NOT DEFINED STAGE_${STAGE})
+            message(FATAL_ERROR "Invalid shader stage at: ${STAGE_FILE}")
+        endif()
+        file(READ ${STAGE_FILE} HEX HEX)
+        # SPIR-V is little endian, swap each byte quadruple into a word
+        string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u, "
+               WORDS "${HEX}")
+        set(WORD "0x[0-9a-f]+u, ")
+        string(REGEX REPLACE "(${WORD}${WORD}${WORD}${WORD}${WORD})" "\\1\n    "
+               WORDS "${WORDS}")
+        string(REPLACE " \n" "\n" WORDS "${WORDS}")
+        string(APPEND ARRAYS
+               "inline constexpr uint32_t ${PROGRAM}_${STAGE}[] = {\n"
+               "    ${WORDS}};\n")
+        string(APPEND STAGES
+               "    {${STAGE_${STAGE}}, ${PROGRAM}_${STAGE},\n"
+               "     std::size(${PROGRAM}_${STAGE})},\n")
+    endforeach()
+
+    string(APPEND ARRAYS
+           "inline constexpr EmbeddedStage ${PROGRAM}_stages[] = {\n"
+           "${STAGES}};\n\n")
+    string(APPEND IDS "    ${PROGRAM},\n")
+    string(APPEND PROGRAMS
+           "    {\"${PROGRAM}\", ${PROGRAM}_stages, "
+           "std::size(${PROGRAM}_stages)},\n")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+     "// Generated by cmake/embed_shaders.cmake, do not edit\n"
+     "#pragma once\n\n"
+     "#include <cstdint>\n"
+     "#include <iterator>\n\n"
+     "#include \"vk/shader_registry.h\"\n\n"
+     "namespace vks {\n\n"
+     "enum class ShaderProgram : uint32_t {\n${IDS}};\n\n"
+     "namespace embedded {\n\n"
+     "${ARRAYS}"
+     "inline constexpr EmbeddedProgram PROGRAMS[] = {\n${PROGRAMS}};\n\n"
+     "}  // namespace embedded\n"
+     "}  // namespace vks\n")
+# Only touch the header when its content changed to avoid full rebuilds
+configure_file(${OUTPUT}.tmp ${OUTPUT} COPYONLY)
+file(REMOVE ${OUTPUT}.tmp)
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <filesystem>
 #include <iostream>
+#include <optional>
 #include <unordered_map>
 
+#include "embedded_shaders.h"
+#include "profiler.h"
 #include "resources.h"
+#include "startup.h"
 #include "vk/context.h"
 #include "vk/device.h"
 #include "window.h"
@@ -14,37 +19,167 @@ namespace vks {
 
 class Application {
    public:
+    // Headless applications render offscreen without opening a window
     Application(uint32_t window_width, uint32_t window_height,
                 const std::string& name,
-                const std::string& graphics_pipeline_source)
-        : m_window{window_width, window_height, name},
-          m_device{m_window},
-          m_context{m_device} {
-        m_window.registerCloseCallback([this]() { m_running = false; });
+                const std::string& graphics_pipeline_source,
+                bool headless = false)
+        : m_window{timePhase("window",
+                             [&]() {
+                                 return headless
+                                            ? std::nullopt
+                                            : std::make_optional<Window>(
+                                                  window_width, window_height,
+                                                  name);
+                             })},
+          m_extent{window_width, window_height},
+          m_device{timePhase("device",
+                             [&]() {
+                                 return headless ? Device{m_extent}
+                                                 : Device{*m_window};
+                             })},
+          m_context{timePhase("context", [&]() { return Context{m_device}; })} {
+        Profiler::instance().nameThread("main thread");
+        if (m_window.has_value()) {
+            registerWindowCallbacks();
+        }
 
         Resources resources;
-        Model::load("assets/obj/viking_room/viking_room.obj"s, resources);
+        {
+            StartupPhase phase{"Model::load"};
+            Model::load("assets/obj/viking_room/viking_room.obj"s, resources);
+        }
 
         std::cout << "\nRESOURCES:\n";
         for (auto& [name, model] : resources.models) {
             std::cout << "Model: " << name << std::endl;
         }
 
-        m_models.merge(m_context.loadResources(
-            {"viking_room.mesh_all1_Texture1_0.mat0"s}, resources));
-        m_pipelines.emplace("diffuse"s,
-                            m_context.loadPipeline("shaders/diffuse"s));
+        {
+            StartupPhase phase{"loadResources"};
+            m_models.merge(m_context.loadResources(
+                {"viking_room.mesh_all1_Texture1_0.mat0"s}, resources));
+        }
+        {
+            StartupPhase phase{"loadPipeline"};
+            m_pipelines.emplace("diffuse"s,
+                                m_context.loadPipeline(ShaderProgram::diffuse));
+        }
+        m_context.setFallbackPipeline(m_pipelines.at("diffuse"s));
         std::cout << '\n';
         m_running = true;
+        m_report_zones = false;
+        m_report_calls = false;
     }
     void run();
+    void watchShaders(const std::filesystem::path& source_root) {
+        m_context.watchShaders(source_root);
+    }
+    void setSampleCount(uint32_t samples) {
+        uint32_t bits{1};
+        while (bits * 2 <= samples) {
+            bits *= 2;
+        }
+        m_context.setSampleCount(static_cast<VkSampleCountFlagBits>(bits));
+    }
+    void setLatencyMode(LatencyMode mode, bool tearing) {
+        m_context.setLatencyMode(mode, tearing);
+        std::cout << "Latency mode: " << enum_name(mode)
+                  << (tearing ? " with tearing" : "") << std::endl;
+    }
+    void setFrameRateLimit(float fps) { m_context.setFrameRateLimit(fps); }
+    // Stops after the given number of frames, for benchmarks and batches
+    void setFrameLimit(uint32_t frames) { m_frame_limit = frames; }
+    // Renders instances of every loaded model on a grid with the camera
+    // and animation driven by the frame index rather than the clock, so
+    // every run renders the same frames, then reports frame percentiles
+    void setBenchmark(uint32_t instances) { m_benchmark = instances; }
+    // Writes every frame as a binary PPM image into the directory
+    void captureImages(const std::filesystem::path& dir);
+    // Appends the raw RGBA frames to a file or pipe, for a video encoder
+    void captureRaw(const std::filesystem::path& path);
+    void setDepthPrepass(bool enabled) {
+        m_context.setDepthPrepass(enabled);
+        std::cout << "Depth prepass: " << (enabled ? "on" : "off")
+                  << std::endl;
+    }
+    void setOcclusionCulling(bool enabled) {
+        m_context.setOcclusionCulling(enabled);
+        std::cout << "Occlusion culling: " << (enabled ? "on" : "off")
+                  << std::endl;
+    }
+    // Reports the GPU time of every pass with the frame times
+    void setGpuProfiling(bool enabled) {
+        m_context.setGpuProfiling(enabled);
+        std::cout << "GPU profiling: " << (enabled ? "on" : "off")
+                  << std::endl;
+    }
+    // Reports shader invocations per pass with the frame times
+    void setPipelineStatistics(bool enabled) {
+        m_context.setPipelineStatistics(enabled);
+        std::cout << "Pipeline statistics: "
+                  << (m_context.pipelineStatistics()
+                          ? "on"
+                          : (enabled ? "unsupported" : "off"))
+                  << std::endl;
+    }
+    // Reports the CPU time of the SCOPE zones with the frame times
+    void setZoneReport(bool enabled) { m_report_zones = enabled; }
+    // Reports the Vulkan calls of the last frame with the frame times
+    void setCallReport(bool enabled) { m_report_calls = enabled; }
+    // Startup phases and the time to the first frame as JSON, written once
+    // the first frame has been presented
+    void setStartupReport(const std::filesystem::path& path) {
+        m_startup_report = path;
+    }
+    // Host and device memory accounting, written once the run ends
+    void setMemoryReport(const std::filesystem::path& path) {
+        m_memory_report = path;
+    }
+    // Chrome trace of the GPU scopes and CPU zones, for Perfetto
+    void traceTo(const std::filesystem::path& path) {
+        m_context.startTrace(path);
+        std::cout << "Tracing to " << path << std::endl;
+    }
 
    private:
-    Window m_window;
+    void runBenchmark(uint32_t instances, uint32_t frames);
+    void writeMemoryReport();
+    // Ends the startup timeline after the first frame
+    void finishStartup();
+    // Per frame CPU time of the zones collected since the last report
+    void reportZones(uint32_t frames);
+    void reportStatistics();
+    void reportCalls();
+    void registerWindowCallbacks() {
+        m_window->registerCloseCallback([this]() { m_running = false; });
+        m_window->registerResizeCallback(
+            [this](uint32_t, uint32_t) { m_context.resize(); });
+        m_window->registerKeyCallback([this](int key, int, int action, int) {
+            if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+                setDepthPrepass(!m_context.depthPrepass());
+            } else if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+                setOcclusionCulling(!m_context.occlusionCulling());
+            } else if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+                setPipelineStatistics(!m_context.pipelineStatistics());
+            } else if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+                m_context.reportMemory(std::cout);
+            }
+        });
+    }
+
+    std::optional<Window> m_window;
+    VkExtent2D m_extent;
     Device m_device;
     Context m_context;
 
     bool m_running;
+    bool m_report_zones;
+    bool m_report_calls;
+    std::optional<uint32_t> m_frame_limit;
+    std::optional<uint32_t> m_benchmark;
+    std::optional<std::filesystem::path> m_memory_report;
+    std::optional<std::filesystem::path> m_startup_report;
     std::unordered_map<std::string, ModelHandle> m_models;
     std::unordered_map<std::string, PipelineHandle> m_pipelines;
 };
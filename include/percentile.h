@@ -0,0 +1,21 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace vks {
+
+// Nearest rank percentile for fraction in [0, 1], zero without samples
+template <typename T>
+T percentile(std::vector<T> samples, double fraction) {
+    if (samples.empty()) {
+        return T{};
+    }
+    std::sort(samples.begin(), samples.end());
+    auto rank = static_cast<size_t>(
+        std::ceil(fraction * static_cast<double>(samples.size())));
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+}  // namespace vks
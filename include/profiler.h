@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+#include "trace.h"
+
+// Times the rest of the enclosing block on the calling thread, the name
+// has to outlive the profiler, a string literal
+#ifdef VKS_PROFILE
+#define VKS_SCOPE_JOIN(a, b) a##b
+#define VKS_SCOPE_NAME(line) VKS_SCOPE_JOIN(vks_scope_, line)
+#define SCOPE(name) ::vks::ProfileScope VKS_SCOPE_NAME(__LINE__){name}
+#else
+#define SCOPE(name)
+#endif
+
+namespace vks {
+
+struct ZoneStats {
+    uint32_t count;
+    float total_ms;
+    float max_ms;
+};
+
+// Zones are written by their thread into a ring only it produces to and
+// only the collector consumes from, events take no lock. Zone timestamps
+// are raw TSC ticks where available, calibrated against the steady clock
+// whenever the rings are drained
+class Profiler {
+   public:
+    using Clock = TraceWriter::Clock;
+
+    struct Zone {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+        uint32_t depth;
+    };
+
+    class ThreadRing {
+       public:
+        // Zones beyond it between two collections are dropped
+        static constexpr uint64_t CAPACITY{4096};
+
+        void push(const Zone& zone) {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) >= CAPACITY) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            m_zones[head % CAPACITY] = zone;
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        // Nesting of the zones open on the owning thread
+        uint32_t depth{0};
+
+       private:
+        friend class Profiler;
+        ThreadRing(uint32_t id) : m_id{id} {}
+
+        std::array<Zone, CAPACITY> m_zones;
+        std::atomic<uint64_t> m_head{0};
+        std::atomic<uint64_t> m_tail{0};
+        std::atomic<uint64_t> m_dropped{0};
+        // Set once its thread exited, drained rings are handed to the
+        // next thread registering
+        std::atomic<bool> m_released{false};
+        const uint32_t m_id;
+        // Guarded by the profiler's registry mutex
+        std::string m_name;
+    };
+
+    Profiler(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+
+    Profiler& operator=(const Profiler&) = delete;
+    Profiler& operator=(Profiler&&) = delete;
+
+    static Profiler& instance();
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+        return __rdtsc();
+#else
+        return Clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // The calling thread's ring, registered on first use
+    static ThreadRing& threadRing() {
+        thread_local RingOwner owner{instance().registerThread()};
+        return owner.ring;
+    }
+
+    // Shown as the calling thread's track in traces
+    void nameThread(const std::string& name);
+    // Zones drained from then on are also written to the trace
+    void setTrace(TraceWriter* trace);
+    // Drains every ring into the statistics and the trace, only one
+    // thread may collect
+    void collect();
+
+    // Accumulated since the last reset, keyed by zone name
+    const std::unordered_map<std::string_view, ZoneStats>& stats() const {
+        return m_stats;
+    }
+    void resetStats() { m_stats.clear(); }
+    uint64_t dropped() const { return m_dropped; }
+
+   private:
+    struct RingOwner {
+        ~RingOwner() {
+            ring.m_released.store(true, std::memory_order_release);
+        }
+        ThreadRing& ring;
+    };
+
+    Profiler();
+
+    ThreadRing& registerThread();
+    void calibrate();
+    Clock::time_point toTime(uint64_t ticks) const;
+    void nameTracks();
+
+    std::mutex m_registry_mutex;
+    std::vector<std::unique_ptr<ThreadRing>> m_rings;
+
+    // Ticks are converted through the rate between the first and the
+    // latest calibration
+    uint64_t m_anchor_ticks;
+    Clock::time_point m_anchor_time;
+    double m_ns_per_tick;
+
+    TraceWriter* m_trace;
+    // Rings whose track has been named in the trace
+    size_t m_named_rings;
+    std::unordered_map<std::string_view, ZoneStats> m_stats;
+    uint64_t m_dropped;
+};
+
+class ProfileScope {
+   public:
+    explicit ProfileScope(const char* name)
+        : m_ring{Profiler::threadRing()},
+          m_name{name},
+          m_depth{m_ring.depth++},
+          m_start{Profiler::now()} {}
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope(ProfileScope&&) = delete;
+
+    ProfileScope& operator=(const ProfileScope&) = delete;
+    ProfileScope& operator=(ProfileScope&&) = delete;
+
+    ~ProfileScope() {
+        m_ring.push({m_name, m_start, Profiler::now(), m_depth});
+        m_ring.depth--;
+    }
+
+   private:
+    Profiler::ThreadRing& m_ring;
+    const char* m_name;
+    uint32_t m_depth;
+    uint64_t m_start;
+};
+
+}  // namespace vks
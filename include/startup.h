@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace vks {
+
+// Wall clock phases from process start to the first presented frame,
+// phases begun while another is open on the same thread nest inside it.
+// Nothing is recorded once the first frame has been presented
+class StartupTimeline {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        std::string name;
+        uint32_t depth;
+        // Relative to process start
+        float start_ms;
+        float duration_ms;
+    };
+
+    static StartupTimeline& instance();
+
+    StartupTimeline(const StartupTimeline&) = delete;
+    StartupTimeline(StartupTimeline&&) = delete;
+
+    StartupTimeline& operator=(const StartupTimeline&) = delete;
+    StartupTimeline& operator=(StartupTimeline&&) = delete;
+
+    bool recording() const {
+        return !m_finished.load(std::memory_order_relaxed);
+    }
+    // Returns the phase index to end, none once startup has finished
+    std::optional<size_t> begin(const char* name);
+    void end(size_t phase);
+    // Called once the first frame is presented, later calls do nothing
+    void firstFrame();
+    std::optional<float> firstFrameMs() const { return m_first_frame_ms; }
+    std::vector<Phase> phases() const;
+
+    // Phases in begin order with their depth, then time to first frame
+    void writeJson(std::ostream& out) const;
+
+   private:
+    StartupTimeline();
+
+    Clock::time_point m_start;
+    std::atomic<bool> m_finished;
+    mutable std::mutex m_mutex;
+    std::vector<Phase> m_phases;
+    std::optional<float> m_first_frame_ms;
+};
+
+// Times the rest of the enclosing block as a startup phase
+class StartupPhase {
+   public:
+    StartupPhase(const char* name)
+        : m_phase{StartupTimeline::instance().begin(name)} {}
+    StartupPhase(const StartupPhase&) = delete;
+    StartupPhase& operator=(const StartupPhase&) = delete;
+
+    ~StartupPhase() {
+        if (m_phase.has_value()) {
+            StartupTimeline::instance().end(m_phase.value());
+        }
+    }
+
+   private:
+    std::optional<size_t> m_phase;
+};
+
+// Times the construction of the returned object, which is never moved,
+// for members that have to be built in an initializer list
+template <typename Build>
+auto timePhase(const char* name, Build&& build) {
+    StartupPhase phase{name};
+    return build();
+}
+
+}  // namespace vks
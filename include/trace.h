@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace vks {
+
+// Streams complete events in the Chrome trace event format, loadable by
+// Perfetto and chrome://tracing, the file is valid once closed
+class TraceWriter {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    // Timelines are grouped by process, each thread is a separate track
+    enum class Process : uint32_t { Cpu = 1, Gpu = 2 };
+
+    TraceWriter(const std::filesystem::path& path);
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter(TraceWriter&&) = delete;
+
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    TraceWriter& operator=(TraceWriter&&) = delete;
+
+    ~TraceWriter();
+
+    void nameTrack(Process process, uint32_t thread, const std::string& name);
+    void event(const std::string& name, Process process, uint32_t thread,
+               Clock::time_point start, Clock::time_point end);
+
+   private:
+    void metadata(const char* kind, Process process, uint32_t thread,
+                  const std::string& name);
+    void separator();
+    static std::string escape(const std::string& text);
+
+    std::ofstream m_file;
+    Clock::time_point m_epoch;
+    bool m_first;
+};
+
+}  // namespace vks
@@ -10,6 +10,7 @@
 namespace vks {
 
 class Context;
+class GpuProfiler;
 
 class Buffer {
    public:
@@ -31,6 +32,7 @@ class Buffer {
    private:
     friend class StagingBuffer;
     friend class ResourcePack;
+    friend class StorageBuffer;
 
     VkBuffer operator*() { return m_buffer; }
     void bindMemory(VkDeviceMemory memory, VkDeviceSize offset);
@@ -43,7 +45,9 @@ class Buffer {
 
 class StagingBuffer {
    public:
-    StagingBuffer(Device& device, VkDeviceSize size);
+    // Copies are reported to the profiler as uploads when one is given
+    StagingBuffer(Device& device, VkDeviceSize size,
+                  GpuProfiler* profiler = nullptr);
     StagingBuffer(const StagingBuffer&) = delete;
     StagingBuffer& operator=(const StagingBuffer&) = delete;
     StagingBuffer& operator=(StagingBuffer&&) = delete;
@@ -59,9 +63,10 @@ class StagingBuffer {
     void waitFence();
 
     VkCommandBuffer beginTransferCommand();
-    void endTransferCommand(VkCommandBuffer command);
+    void endTransferCommand(VkCommandBuffer command, const char* name);
 
     Device& device;
+    GpuProfiler* m_profiler;
 
     VkCommandPool m_pool;
     VkDeviceMemory m_memory;
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <magic_enum.hpp>
+
+// Calls made through it are counted when built with VKS_CALL_STATS,
+// otherwise it is the plain Vulkan function
+#ifdef VKS_CALL_STATS
+#define VK_CALL(function)                                               \
+    (::vks::CallCounter::count(::vks::VulkanCall::function), ::function)
+#define VK_COUNT_CALL(function) \
+    ::vks::CallCounter::count(::vks::VulkanCall::function)
+#else
+#define VK_CALL(function) ::function
+#define VK_COUNT_CALL(function)
+#endif
+
+namespace vks {
+
+// Named after the functions so reports read like the API
+enum class VulkanCall {
+    vkCmdBeginRenderPass,
+    vkCmdEndRenderPass,
+    vkCmdBeginRenderingKHR,
+    vkCmdEndRenderingKHR,
+    vkCmdBindPipeline,
+    vkCmdBindDescriptorSets,
+    vkCmdBindVertexBuffers,
+    vkCmdBindIndexBuffer,
+    vkCmdPushConstants,
+    vkCmdSetViewport,
+    vkCmdSetScissor,
+    vkCmdDrawIndexed,
+    vkCmdDrawIndexedIndirect,
+    vkCmdDispatch,
+    vkCmdPipelineBarrier,
+    vkCmdCopyBuffer,
+    vkCmdCopyBufferToImage,
+    vkCmdCopyImageToBuffer,
+    vkCmdClearColorImage,
+    vkCmdWriteTimestamp,
+    vkCmdResetQueryPool,
+    vkCmdBeginQuery,
+    vkCmdEndQuery,
+    vkUpdateDescriptorSets,
+    vkAcquireNextImageKHR,
+    vkQueueSubmit,
+    vkQueuePresentKHR,
+    vkQueueWaitIdle,
+    vkDeviceWaitIdle,
+    vkWaitForFences,
+};
+
+struct CallStats {
+    static constexpr size_t COUNT = magic_enum::enum_count<VulkanCall>();
+
+    std::array<uint32_t, COUNT> counts;
+
+    uint32_t operator[](VulkanCall call) const {
+        return counts[static_cast<size_t>(call)];
+    }
+    // Every vkCmd* call recorded
+    uint32_t commands() const {
+        uint32_t total{0};
+        for (size_t i{0}; i <= static_cast<size_t>(VulkanCall::vkCmdEndQuery);
+             i++) {
+            total += counts[i];
+        }
+        return total;
+    }
+};
+
+// Counts are shared by all threads, relaxed atomics keep them cheap
+class CallCounter {
+   public:
+    static void count(VulkanCall call) {
+        s_counts[static_cast<size_t>(call)].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+    // Counts since the previous collection, all zero when compiled out
+    static CallStats collect() {
+        CallStats stats{};
+#ifdef VKS_CALL_STATS
+        for (size_t i{0}; i < CallStats::COUNT; i++) {
+            stats.counts[i] =
+                s_counts[i].exchange(0, std::memory_order_relaxed);
+        }
+#endif
+        return stats;
+    }
+
+   private:
+    static inline std::array<std::atomic<uint32_t>, CallStats::COUNT>
+        s_counts{};
+};
+
+}  // namespace vks
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "vk/buffer.h"
+#include "vk/device.h"
+#include "vk/image.h"
+
+namespace vks {
+
+class StorageBuffer {
+   public:
+    StorageBuffer(const StorageBuffer&) = delete;
+    StorageBuffer(StorageBuffer&& other)
+        : device{other.device},
+          m_buffer{std::move(other.m_buffer)},
+          m_memory{other.m_memory},
+          m_graphics_serial{other.m_graphics_serial},
+          m_compute_serial{other.m_compute_serial} {
+        other.m_memory = VK_NULL_HANDLE;
+    };
+
+    StorageBuffer& operator=(const StorageBuffer&) = delete;
+    StorageBuffer& operator=(StorageBuffer&&) = delete;
+
+    ~StorageBuffer();
+
+    VkDeviceSize size() const { return m_buffer.size(); }
+
+   private:
+    friend class Context;
+    StorageBuffer(Device& device, VkDeviceSize size, VkBufferUsageFlags usage);
+
+    static VkDeviceMemory bindDeviceMemory(Device& device, Buffer& buffer);
+
+    VkBuffer buffer() { return *m_buffer; }
+
+    Device& device;
+
+    Buffer m_buffer;
+    VkDeviceMemory m_memory;
+    // Last frame and compute submission which may access the buffer
+    uint64_t m_graphics_serial;
+    uint64_t m_compute_serial;
+};
+
+// Kept in VK_IMAGE_LAYOUT_GENERAL for its whole lifetime so it can be
+// written by compute and sampled by graphics without layout transitions
+class StorageImage {
+   public:
+    StorageImage(const StorageImage&) = delete;
+    StorageImage(StorageImage&& other)
+        : device{other.device},
+          m_image{std::move(other.m_image)},
+          m_memory{other.m_memory},
+          m_view{std::move(other.m_view)} {
+        other.m_memory = VK_NULL_HANDLE;
+    };
+
+    StorageImage& operator=(const StorageImage&) = delete;
+    StorageImage& operator=(StorageImage&&) = delete;
+
+    ~StorageImage();
+
+    uint32_t width() const { return m_image.width(); }
+    uint32_t height() const { return m_image.height(); }
+    VkFormat format() const { return m_image.format(); }
+
+   private:
+    friend class Context;
+    StorageImage(Device& device, uint32_t width, uint32_t height,
+                 VkFormat format);
+
+    static VkDeviceMemory bindDeviceMemory(Device& device, Image2D& image);
+
+    VkImage image() { return *m_image; }
+    VkImageView view() { return *m_view; }
+
+    Device& device;
+
+    Image2D m_image;
+    VkDeviceMemory m_memory;
+    ImageView2D m_view;
+};
+
+class ComputeQueue {
+   public:
+    ComputeQueue(const ComputeQueue&) = delete;
+    ComputeQueue(ComputeQueue&&) = delete;
+
+    ComputeQueue& operator=(const ComputeQueue&) = delete;
+    ComputeQueue& operator=(ComputeQueue&&) = delete;
+
+    ~ComputeQueue();
+
+   private:
+    friend class Context;
+    ComputeQueue(Device& device);
+
+    static constexpr size_t SUBMISSION_COUNT{4};
+
+    struct Submission {
+        VkCommandBuffer command;
+        VkFence fence;
+        VkSemaphore signal;
+        uint64_t serial;
+        // Graphics frame which waits on the signal, it has to complete
+        // before the semaphore may be signalled again
+        uint64_t consumer_serial;
+        bool in_flight;
+        bool signal_pending;
+    };
+
+    // The graphics frame of consumerSerial() must have completed
+    VkCommandBuffer begin();
+    uint64_t submit(bool signal_graphics);
+    void wait(uint64_t serial);
+    // Semaphores of submissions the graphics queue has not waited on yet,
+    // graphics_serial is the frame submitted with the waits
+    std::vector<VkSemaphore> takeSignals(uint64_t graphics_serial);
+    // Graphics frame which waited on the next submission's semaphore
+    uint64_t consumerSerial() const { return next().consumer_serial; }
+
+    void retire(Submission& submission);
+    Submission& next() {
+        return m_submissions[(m_serial + 1) % SUBMISSION_COUNT];
+    }
+    const Submission& next() const {
+        return m_submissions[(m_serial + 1) % SUBMISSION_COUNT];
+    }
+
+    Device& device;
+
+    VkCommandPool m_pool;
+    std::array<Submission, SUBMISSION_COUNT> m_submissions;
+    uint64_t m_serial;
+};
+
+}  // namespace vks
@@ -2,18 +2,39 @@
 
 #include <vulkan/vulkan.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <glm/glm.hpp>
 #include <magic_enum.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "vk/compute.h"
 #include "vk/device.h"
+#include "trace.h"
+#include "vk/frame_pacer.h"
+#include "vk/gpu_profiler.h"
+#include "vk/layout_cache.h"
+#include "vk/occlusion.h"
 #include "vk/pipeline.h"
+#include "vk/pipeline_statistics.h"
+#include "vk/readback.h"
+#include "vk/render_graph.h"
 #include "vk/render_pass.h"
 #include "vk/resource_pack.h"
 #include "vk/sampler.h"
+#include "vk/shader_watcher.h"
 #include "vk/swapchain.h"
 #include "vk/vertex.h"
 
@@ -25,6 +46,26 @@ class PipelineHandle {
     const size_t index;
 };
 
+class ComputeHandle {
+    friend class Context;
+    ComputeHandle(size_t index) : index{index} {};
+    const size_t index;
+};
+
+class StorageHandle {
+    friend class Context;
+    enum class Kind { Buffer, Image };
+    StorageHandle(Kind kind, size_t index) : kind{kind}, index{index} {};
+    const Kind kind;
+    const size_t index;
+};
+
+class BindingsHandle {
+    friend class Context;
+    BindingsHandle(size_t index) : index{index} {};
+    const size_t index;
+};
+
 class ModelHandle {
     friend class Context;
     ModelHandle(size_t pack, size_t index) : pack{pack}, index{index} {};
@@ -32,6 +73,20 @@ class ModelHandle {
     const size_t index;
 };
 
+struct CompileStats {
+    // Binds of pipelines still compiling, each one a stall avoided
+    uint32_t stalls_avoided;
+    uint32_t fallback_draws;
+    uint32_t skipped_draws;
+    uint32_t pending;
+};
+
+// Draws recorded in the last frame, occlusion culled ones included
+struct DrawCounts {
+    uint32_t draws;
+    uint64_t triangles;
+};
+
 class Context {
    public:
     Context(Device& device);
@@ -43,17 +98,125 @@ class Context {
 
     ~Context();
 
-    void beginFrame(const glm::mat4& camera);
+    // Draws are collected during the frame and recorded at endFrame
+    bool beginFrame(const glm::mat4& camera);
     void bindPipeline(PipelineHandle pipeline);
     void draw(ModelHandle model, const glm::mat4& transfrom);
     void endFrame();
+    // Lays down depth from the position only vertex stream first, the
+    // colour pass then shades with depth EQUAL variants of each pipeline
+    void setDepthPrepass(bool enabled) { m_depth_prepass = enabled; }
+    bool depthPrepass() const { return m_depth_prepass; }
+    // Clamped to the device limits, rebuilds the render targets and every
+    // pipeline, so it waits for the device to go idle
+    void setSampleCount(VkSampleCountFlagBits samples);
+    VkSampleCountFlagBits sampleCount() const {
+        return m_render_pass.samples();
+    }
+    // Draws are tested against a depth pyramid on the GPU, ignored while
+    // multisampling as the pyramid is reduced from single sampled depth.
+    // The culling pipelines are built when it is first enabled
+    void setOcclusionCulling(bool enabled);
+    bool occlusionCulling() const { return m_occlusion_culling; }
+    bool occlusionCullingSupported() const {
+        return OcclusionCuller::supported(device);
+    }
+    // Recorded on the frame command buffer ahead of the frame's draws
+    void dispatch(ComputeHandle pipeline, BindingsHandle bindings,
+                  uint32_t x, uint32_t y = 1, uint32_t z = 1);
+    // Runs on the compute queue, frames submitted afterwards wait for it
+    uint64_t dispatchAsync(ComputeHandle pipeline, BindingsHandle bindings,
+                           uint32_t x, uint32_t y = 1, uint32_t z = 1);
+    void waitCompute(uint64_t serial) { m_compute_queue.wait(serial); }
+    void resize() { m_swapchain.m_outdated = true; }
+    // Recreates the swapchain, tearing lets the low latency mode present
+    // immediately instead of on the next vertical blank
+    void setLatencyMode(LatencyMode mode, bool tearing = false) {
+        m_swapchain.setLatencyMode(mode, tearing);
+    }
+    LatencyMode latencyMode() const { return m_swapchain.m_latency_mode; }
+    // Zero removes the limit
+    void setFrameRateLimit(float fps) { m_pacer.setFrameRateLimit(fps); }
+    // Call before sampling input, blocks as the latency mode and frame
+    // rate limit require
+    void waitForFrame();
+    const FrameTimings& frameTimings() const { return m_pacer.timings(); }
+    // Timestamps around passes, draws and uploads, the scopes of a frame
+    // are read back a few frames later
+    void setGpuProfiling(bool enabled);
+    bool gpuProfiling() const { return m_gpu_profiling; }
+    const std::vector<GpuScope>& gpuScopes() const {
+        return m_profiler.scopes();
+    }
+    // GPU scopes and the CPU zones of every thread are written as a Chrome
+    // trace, the GPU is profiled until the trace is stopped
+    void startTrace(const std::filesystem::path& path);
+    // Waits for the device to go idle to collect the frames in flight
+    void stopTrace();
+    // Shader invocations and primitives counted per pass and pipeline,
+    // stays off when the device lacks pipeline statistics queries
+    void setPipelineStatistics(bool enabled) {
+        m_statistics.setEnabled(enabled);
+    }
+    bool pipelineStatistics() const { return m_statistics.enabled(); }
+    // Counters of a frame a few frames back
+    const FrameStatistics& frameStatistics() const {
+        return m_statistics.results();
+    }
+    // Zero for pipelines which did not draw in that frame
+    PipelineCounters pipelineCounters(PipelineHandle pipeline) const;
+    // Host memory of the driver per object type, device memory per owner
+    // and heap, and what the memory of every resource pack holds
+    void reportMemory(std::ostream& out) const;
+    // Every following frame is copied out and handed to the consumer a few
+    // frames later on the calling thread, frames are dropped rather than
+    // stalling when the consumer falls behind
+    void captureFrames(ReadbackRing::Consumer&& consumer);
 
-    PipelineHandle loadPipeline(const std::filesystem::path& dir) {
-        m_pipelines.emplace_back(
-            GraphicsPipeline{device, m_render_pass, dir, m_pipeline_layout,
-                             VertexAttribs::defaultAttributes()});
-        return PipelineHandle{m_pipelines.size() - 1};
+    PipelineHandle loadPipeline(const std::filesystem::path& dir,
+                                const PipelineVariant& variant = {});
+    PipelineHandle loadPipeline(ShaderProgram program,
+                                const PipelineVariant& variant = {});
+    std::vector<PipelineHandle> loadPipelines(
+        const std::vector<std::filesystem::path>& dirs);
+    std::vector<PipelineHandle> loadPipelines(
+        const std::vector<std::pair<std::filesystem::path, PipelineVariant>>&
+            programs);
+    // Returns immediately, the pipeline is compiled on a worker thread and
+    // draws with it use the fallback pipeline, or are skipped, until ready.
+    // Binding it after the compile failed throws the compile error
+    PipelineHandle requestPipeline(const std::filesystem::path& dir,
+                                   const PipelineVariant& variant = {});
+    PipelineHandle requestPipeline(ShaderProgram program,
+                                   const PipelineVariant& variant = {});
+    // The fallback must accept the vertex input of the pipelines it replaces
+    void setFallbackPipeline(PipelineHandle pipeline) {
+        m_fallback_pipeline = pipeline.index;
     }
+    const CompileStats& compileStats() const { return m_compile_stats; }
+    const DrawCounts& drawCounts() const { return m_draw_counts; }
+    // Vulkan calls of the last frame, zero without VKS_CALL_STATS
+    const CallStats& callStats() const { return m_call_stats; }
+    void watchShaders(const std::filesystem::path& source_root);
+
+    ComputeHandle loadCompute(
+        const std::filesystem::path& dir,
+        const std::map<uint32_t, uint32_t>& constants = {});
+    ComputeHandle loadCompute(
+        ShaderProgram program,
+        const std::map<uint32_t, uint32_t>& constants = {});
+    StorageHandle createStorageBuffer(VkDeviceSize size,
+                                      VkBufferUsageFlags usage = 0);
+    StorageHandle createStorageImage(uint32_t width, uint32_t height,
+                                     VkFormat format);
+    // Copied before returning, after waiting for the frames and dispatches
+    // submitted earlier which use the buffer. Work submitted later sees
+    // the new contents
+    void writeStorage(StorageHandle buffer, const void* data,
+                      VkDeviceSize size, VkDeviceSize offset = 0);
+    BindingsHandle createBindings(
+        ComputeHandle pipeline, uint32_t set,
+        const std::map<uint32_t, StorageHandle>& resources);
     std::unordered_map<std::string, ModelHandle> loadResources(
         const std::vector<std::string>& model_names,
         const Resources& resources) {
@@ -78,24 +241,141 @@ class Context {
 
     void createSamplers();
     void createDescriptorLayouts();
-    void createPipelineLayout();
+
+    struct PipelineProgram {
+        // Identifies the program source within variant keys
+        std::string key;
+        // Matched against the programs rebuilt by the shader watcher
+        std::string name;
+        std::function<GraphicsPipeline(const PipelineVariant&)> build;
+    };
+
+    struct DrawCall {
+        size_t pipeline;
+        ModelHandle model;
+        glm::mat4 transform;
+    };
+
+    struct PrepassPipelines {
+        // Empty for pipelines which do not write depth
+        std::optional<size_t> depth;
+        size_t color;
+    };
+
+    PipelineProgram pipelineProgram(const std::filesystem::path& dir);
+    PipelineProgram pipelineProgram(ShaderProgram program);
+    std::vector<PipelineHandle> loadPrograms(
+        const std::vector<std::pair<PipelineProgram, PipelineVariant>>&
+            programs);
+    PipelineHandle requestProgram(PipelineProgram&& program,
+                                  const PipelineVariant& variant);
+    void reloadPipeline(const std::string& name,
+                        const std::filesystem::path& dir);
+    void swapReloadedPipelines();
+    void compileWorker();
+
+    // Pipeline statistics of the draws are attributed to the pass
+    void recordScene(VkCommandBuffer command, bool indirect,
+                     const std::string& pass);
+    // Once per frame, the draws may be recorded by more than one pass
+    void resolveDraws();
+    void recordDraws(bool indirect, const std::string& pass);
+    PrepassPipelines prepassPipelines(size_t pipeline);
+    // The depth only and EQUAL compare variants, compiled in the background
+    PrepassPipelines requestPrepass(size_t pipeline);
+    void bindGraphics(size_t pipeline);
+    void pushTransform(const glm::mat4& transform);
+    VkCommandBuffer beginCompute();
+    void recordDispatch(VkCommandBuffer command, ComputeHandle pipeline,
+                        BindingsHandle bindings, uint32_t x, uint32_t y,
+                        uint32_t z);
+    VkDescriptorSet allocateStorageSet(VkDescriptorSetLayout layout);
 
     Sampler& sampler(Sampler::Type type) { return m_samplers.at(type); }
 
     Device& device;
 
+    // Held shared while building pipelines against the render pass
+    std::shared_mutex m_render_pass_mutex;
+    // Render passes of the graph are compatible with this one
     RenderPass m_render_pass;
     Swapchain m_swapchain;
+    RenderGraph m_render_graph;
+    ReadbackRing m_readback;
+    FramePacer m_pacer;
+    std::unique_ptr<TraceWriter> m_trace;
+    GpuProfiler m_profiler;
+    bool m_gpu_profiling;
+    StatisticsQueries m_statistics;
 
     std::vector<ResourcePack> m_resource_packs;
     std::unordered_map<std::string, size_t> m_model_pack_index;
     std::unordered_map<Sampler::Type, Sampler> m_samplers;
 
+    LayoutCache m_layout_cache;
     VkDescriptorSetLayout m_material_layout;
-    VkPipelineLayout m_pipeline_layout;
 
     std::vector<GraphicsPipeline> m_pipelines;
 
+    std::mutex m_reload_mutex;
+    std::vector<PipelineProgram> m_pipeline_programs;
+    std::vector<PipelineVariant> m_pipeline_variants;
+    std::unordered_map<std::string, size_t> m_variant_indices;
+    std::vector<std::pair<size_t, GraphicsPipeline>> m_reloaded_pipelines;
+    // Requested pipelines whose compile failed, until a reload replaces them
+    std::unordered_map<size_t, std::string> m_compile_errors;
+    std::deque<std::pair<uint64_t, GraphicsPipeline>> m_retired_pipelines;
+    std::unique_ptr<ShaderWatcher> m_shader_watcher;
+
+    std::mutex m_compile_mutex;
+    std::condition_variable m_compile_cv;
+    std::deque<std::function<void()>> m_compile_jobs;
+    bool m_compile_running;
+    std::thread m_compile_thread;
+    std::atomic<uint32_t> m_pending_compiles;
+    std::optional<size_t> m_fallback_pipeline;
+    CompileStats m_compile_stats;
+    DrawCounts m_draw_counts;
+    CallStats m_call_stats;
+
+    struct StorageBindings {
+        uint32_t set;
+        VkDescriptorSet descriptors;
+        std::vector<StorageHandle> resources;
+    };
+
+    struct FrameDispatch {
+        ComputeHandle pipeline;
+        BindingsHandle bindings;
+        uint32_t x;
+        uint32_t y;
+        uint32_t z;
+    };
+
+    ComputeQueue m_compute_queue;
+    std::vector<ComputePipeline> m_compute_pipelines;
+    std::vector<StorageBuffer> m_storage_buffers;
+    std::vector<StorageImage> m_storage_images;
+    std::vector<StorageBindings> m_storage_bindings;
+    std::vector<VkDescriptorPool> m_storage_pools;
+
+    OcclusionCuller m_culler;
+    bool m_occlusion_culling;
+
+    bool m_depth_prepass;
+    std::unordered_map<size_t, PrepassPipelines> m_prepass_pipelines;
+
     Swapchain::FrameState m_frame_state;
+    // Swapchain whose views the render graph framebuffers may refer to
+    VkSwapchainKHR m_framebuffer_swapchain;
+    glm::mat4 m_camera;
+    std::optional<size_t> m_bound_pipeline;
+    std::vector<DrawCall> m_draws;
+    std::vector<std::pair<PrepassPipelines, const DrawCall*>> m_resolved_draws;
+    VkPipelineLayout m_bound_layout;
+    // Camera and transform pushes of the bound pipeline, split by stage
+    std::vector<VkPushConstantRange> m_camera_pushes;
+    std::vector<VkPushConstantRange> m_transform_pushes;
+    std::vector<FrameDispatch> m_dispatches;
 };
 }  // namespace vks
\ No newline at end of file
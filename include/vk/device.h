@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 
+#include "vk/call_stats.h"
+#include "vk/memory_tracker.h"
 #include "window.h"
 
 using namespace magic_enum;
@@ -17,6 +19,9 @@ namespace vks {
 class Device {
    public:
     Device(Window& window);
+    // Without a window or surface, frames are rendered to offscreen images
+    // and CPU implementations such as lavapipe are accepted
+    Device(VkExtent2D extent);
     Device(const Device&) = delete;
     Device& operator=(const Device&) = delete;
     Device& operator=(Device&&) = delete;
@@ -36,12 +41,33 @@ class Device {
     friend class Image2D;
     friend class Sampler;
     friend class MaterialUniform;
+    friend class LayoutCache;
+    friend class ComputePipeline;
+    friend class ComputeQueue;
+    friend class StorageBuffer;
+    friend class StorageImage;
+    friend class RenderGraph;
+    friend class ReadbackRing;
+    friend class OcclusionCuller;
+    friend class GpuProfiler;
+    friend class StatisticsQueries;
 
     VkDevice operator*() { return m_device; }
 
+    const VkAllocationCallbacks* allocator(HostObject object) const {
+        return m_memory_tracker.callbacks(object);
+    }
+    // Device memory is accounted to the owner it is allocated for
+    VkResult allocateMemory(const VkMemoryAllocateInfo& info,
+                            const std::string& owner, VkDeviceMemory* memory);
+    void freeMemory(VkDeviceMemory memory);
+
     std::vector<uint32_t> getQueueIndices(VkQueueFlags queues) const;
     uint32_t getMemoryIndex(uint32_t type_bits,
                             VkMemoryPropertyFlags properties) const;
+    // Highest sample count usable for both colour and depth attachments
+    VkSampleCountFlagBits maxSampleCount() const;
+    bool headless() const { return m_surface == VK_NULL_HANDLE; }
 
     VkDebugUtilsMessengerCreateInfoEXT messengerInfo();
 
@@ -51,22 +77,31 @@ class Device {
                       const VkDebugUtilsMessengerCallbackDataEXT* callback_data,
                       const void* user_data);
 
-    static std::vector<const char*> requiredInstanceExtensions(Window& window);
-    static std::vector<const char*> requiredValidationLayers();
-    static std::vector<const char*> requiredDeviceExtensions();
+    // Headless instances only enable debug utils and validation when present
+    static std::vector<const char*> requiredInstanceExtensions(Window* window);
+    static std::vector<const char*> requiredValidationLayers(bool optional);
+    static std::vector<const char*> requiredDeviceExtensions(bool headless);
     static VkPhysicalDeviceFeatures requiredDeviceFeatures();
 
-    void createInstance(Window& window);
+    void createInstance(Window* window);
     void pickPhysicalDevice();
     void createDevice();
+    void createPipelineCache();
+    void savePipelineCache();
+
+    bool pipelineCacheHeaderValid(const std::vector<char>& data) const;
 
     struct PhysicalDeviceInfo {
         VkPhysicalDeviceProperties properties;
         VkPhysicalDeviceMemoryProperties memory_properties;
         VkSurfaceCapabilitiesKHR surface_capabilities;
         VkSurfaceFormatKHR surface_format;
-        VkPresentModeKHR present_mode;
+        std::vector<VkPresentModeKHR> present_modes;
         VkFormat depth_format;
+        // Passes begin without render pass or framebuffer objects
+        bool dynamic_rendering;
+        // Pipeline statistics queries, enabled whenever supported
+        bool pipeline_statistics;
         struct {
             uint32_t graphics;
             uint32_t compute;
@@ -84,7 +119,12 @@ class Device {
     static void getSurfaceProperties(VkPhysicalDevice device,
                                      VkSurfaceKHR surface,
                                      PhysicalDeviceInfo& info);
-    static bool deviceExtensionsSupported(VkPhysicalDevice device);
+    void updateSurfaceCapabilities();
+    static bool deviceExtensionsSupported(VkPhysicalDevice device,
+                                          bool headless);
+    static bool dynamicRenderingSupported(VkPhysicalDevice device,
+                                          const VkPhysicalDeviceProperties&
+                                              properties);
 
     static bool deviceFeaturesSupported(
         const VkPhysicalDeviceFeatures& features);
@@ -100,10 +140,17 @@ class Device {
         VkQueue present;
     } queues;
 
+    MemoryTracker m_memory_tracker;
+
     VkInstance m_instance;
     VkDevice m_device;
     VkSurfaceKHR m_surface;
     VkPhysicalDevice m_physical_device;
     VkDebugUtilsMessengerEXT m_messenger;
+    VkPipelineCache m_pipeline_cache;
+    bool m_pipeline_cache_warm;
+
+    PFN_vkCmdBeginRenderingKHR m_begin_rendering;
+    PFN_vkCmdEndRenderingKHR m_end_rendering;
 };
 }  // namespace vks
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+
+namespace vks {
+
+struct FrameTimings {
+    // Recording on the CPU from beginFrame to submission
+    float cpu_ms;
+    // From the first to the last command of the frame, zero when the
+    // graphics queue does not support timestamps
+    float gpu_ms;
+    // Between consecutive presents as issued by the CPU
+    float present_interval_ms;
+};
+
+// Limits the frame rate and measures where the time of each frame goes,
+// GPU times come from the frame scope of the GpuProfiler
+class FramePacer {
+   public:
+    FramePacer(const FramePacer&) = delete;
+    FramePacer(FramePacer&&) = delete;
+
+    FramePacer& operator=(const FramePacer&) = delete;
+    FramePacer& operator=(FramePacer&&) = delete;
+
+   private:
+    friend class Context;
+    FramePacer();
+
+    using Clock = std::chrono::steady_clock;
+
+    // Zero removes the limit
+    void setFrameRateLimit(float fps);
+    // Sleeps until the next frame is due under the limit
+    void wait();
+    // Takes the GPU time of the latest frame read back
+    void beginFrame(float gpu_ms);
+    void endFrame();
+    void presented();
+
+    const FrameTimings& timings() const { return m_timings; }
+
+    std::optional<Clock::duration> m_frame_period;
+    Clock::time_point m_next_frame;
+    Clock::time_point m_frame_start;
+    std::optional<Clock::time_point> m_last_present;
+    FrameTimings m_timings;
+};
+
+}  // namespace vks
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+#include "vk/device.h"
+
+namespace vks {
+
+struct GpuScope {
+    std::string name;
+    // Zero for the outermost scope of the frame
+    uint32_t depth;
+    // Relative to the start of the frame's outermost scope
+    float start_ms;
+    float duration_ms;
+};
+
+// Timestamps around named scopes of the frame command buffer, every frame
+// slot has its own query pool which is read back once the slot's fence has
+// signalled, results arrive frames later without ever waiting on the GPU.
+// The outermost frame scope is timed even while disabled, for FramePacer
+class GpuProfiler {
+   public:
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler(GpuProfiler&&) = delete;
+
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(GpuProfiler&&) = delete;
+
+    ~GpuProfiler();
+
+   private:
+    friend class Context;
+    friend class RenderGraph;
+    friend class StagingBuffer;
+    GpuProfiler(Device& device);
+
+    using Clock = TraceWriter::Clock;
+
+    // Scopes beyond it are dropped for the rest of the frame
+    static constexpr uint32_t MAX_SCOPES{256};
+    // Trace tracks of the GPU process
+    static constexpr uint32_t GRAPHICS_TRACK{1};
+    static constexpr uint32_t TRANSFER_TRACK{2};
+
+    struct Slot {
+        VkQueryPool pool;
+        // Queries 2 * i and 2 * i + 1 time scope i
+        std::vector<std::string> names;
+        std::vector<uint32_t> depths;
+        Clock::time_point submitted;
+        bool pending;
+    };
+
+    // The graphics queue has to support timestamps
+    bool supported() const { return m_timestamp_mask != 0; }
+    bool enabled() const { return m_enabled; }
+    // Only between frames
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    // Scopes of the latest frame read back
+    const std::vector<GpuScope>& scopes() const { return m_scopes; }
+    // Frame scope of the latest frame read back, zero when unsupported
+    float frameMs() const { return m_frame_ms; }
+    // Scopes read back from then on are also written to the trace
+    void setTrace(TraceWriter* trace);
+
+    // Collects the slot's previous frame, its fence must have signalled,
+    // and opens the frame's outermost scope
+    void beginFrame(VkCommandBuffer command, uint32_t slot);
+    void endFrame(VkCommandBuffer command);
+    // Frames are placed on the CPU timeline no earlier than submitted
+    void submitted();
+    void begin(VkCommandBuffer command, const std::string& name);
+    void end(VkCommandBuffer command);
+    // Staging uploads are waited for on submission, they are timed on the
+    // CPU as the transfer queue need not support timestamps or resets
+    void upload(const std::string& name, Clock::time_point submitted,
+                Clock::time_point completed);
+    // Once the device is idle every recorded frame can be collected
+    void flush();
+
+    void collect(Slot& slot);
+    // Ticks from one timestamp to another modulo the valid bits, negative
+    // when the second is the earlier one
+    int64_t ticksBetween(uint64_t from, uint64_t to) const;
+    Clock::duration duration(int64_t ticks) const;
+
+    Device& device;
+
+    float m_timestamp_period;
+    uint64_t m_timestamp_mask;
+    bool m_enabled;
+    TraceWriter* m_trace;
+
+    std::vector<Slot> m_slots;
+    std::optional<uint32_t> m_slot;
+    // Scope indices of the open scopes, empty for dropped ones
+    std::vector<std::optional<uint32_t>> m_open;
+    std::vector<GpuScope> m_scopes;
+    float m_frame_ms;
+
+    // Start of the last frame collected, on both clocks
+    std::optional<uint64_t> m_last_timestamp;
+    Clock::time_point m_last_start;
+};
+
+}  // namespace vks
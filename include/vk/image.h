@@ -15,14 +15,20 @@ class Image2D {
     static constexpr VkDeviceSize TexelSize(VkFormat format) {
         switch (format) {
             case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
             case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
                 return 4;
             case VK_FORMAT_R8G8B8_UNORM:
+            case VK_FORMAT_R8G8B8_SRGB:
             case VK_FORMAT_B8G8R8_UNORM:
+            case VK_FORMAT_B8G8R8_SRGB:
                 return 3;
             case VK_FORMAT_R8G8_UNORM:
+            case VK_FORMAT_R8G8_SRGB:
                 return 2;
             case VK_FORMAT_R8_UNORM:
+            case VK_FORMAT_R8_SRGB:
                 return 1;
             default:
                 return 0;
@@ -59,6 +65,8 @@ class Image2D {
     friend class StagingBuffer;
     friend class ResourcePack;
     friend class ImageView2D;
+    friend class StorageImage;
+    friend class Swapchain;
 
     VkImage operator*() { return m_image; }
     void bindMemory(VkDeviceMemory memory, VkDeviceSize offset);
@@ -91,6 +99,7 @@ class ImageView2D {
 
    private:
     friend class ResourcePack;
+    friend class StorageImage;
 
     VkImageView operator*() { return m_view; }
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "vk/device.h"
+#include "vk/shader_reflection.h"
+
+namespace vks {
+
+class LayoutCache {
+   public:
+    LayoutCache(const LayoutCache&) = delete;
+    LayoutCache(LayoutCache&&) = delete;
+
+    LayoutCache& operator=(const LayoutCache&) = delete;
+    LayoutCache& operator=(LayoutCache&&) = delete;
+
+    ~LayoutCache();
+
+    VkDescriptorSetLayout requireSetLayout(
+        uint32_t set, const ShaderInterface::SetBindings& bindings);
+    // Sets required by the engine are shared by every graphics pipeline
+    VkPipelineLayout pipelineLayout(const ShaderInterface& interface);
+    // Only the reflected interface, compute shaders are free to use any set
+    VkPipelineLayout computeLayout(const ShaderInterface& interface);
+    VkDescriptorSetLayout pipelineSetLayout(VkPipelineLayout layout,
+                                            uint32_t set);
+
+   private:
+    friend class Context;
+    LayoutCache(Device& device);
+
+    using Key = std::vector<uint64_t>;
+
+    VkDescriptorSetLayout setLayout(
+        const ShaderInterface::SetBindings& bindings);
+    // Called with the mutex held
+    VkPipelineLayout cachedLayout(
+        std::vector<VkDescriptorSetLayout>&& set_layouts,
+        const std::vector<VkPushConstantRange>& push_ranges);
+
+    Device& device;
+
+    std::mutex m_mutex;
+    std::map<Key, VkDescriptorSetLayout> m_set_layouts;
+    std::map<Key, VkPipelineLayout> m_pipeline_layouts;
+    std::map<VkPipelineLayout, std::vector<VkDescriptorSetLayout>>
+        m_pipeline_set_layouts;
+    std::map<uint32_t,
+             std::pair<ShaderInterface::SetBindings, VkDescriptorSetLayout>>
+        m_required_sets;
+};
+
+}  // namespace vks
@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <magic_enum.hpp>
 #include <stdexcept>
+#include <vector>
 
 #include "resources.h"
 #include "vk/device.h"
@@ -34,12 +35,9 @@ struct MaterialUniform {
         return pool_sizes;
     }
 
-    static VkDescriptorSetLayout descriptorLayout(Device& device) {
-        VkDescriptorSetLayoutCreateInfo layout_info{};
-        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        std::array<VkDescriptorSetLayoutBinding,
-                   enum_count<Material::TextureMap>() + 1>
-            bindings{};
+    static std::vector<VkDescriptorSetLayoutBinding> descriptorBindings() {
+        std::vector<VkDescriptorSetLayoutBinding> bindings(
+            enum_count<Material::TextureMap>() + 1);
 
         for (size_t i{0}; i < enum_count<Material::TextureMap>(); i++) {
             bindings[i].binding = i;
@@ -54,16 +52,7 @@ struct MaterialUniform {
         bindings.back().descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         bindings.back().stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-        layout_info.bindingCount = bindings.size();
-        layout_info.pBindings = bindings.data();
-
-        VkDescriptorSetLayout layout;
-        if (vkCreateDescriptorSetLayout(*device, &layout_info, nullptr,
-                                        &layout) != VK_SUCCESS) {
-            throw std::runtime_error(
-                "Failed to create material descriptor set layout");
-        }
-        return layout;
+        return bindings;
     }
 };
 }  // namespace vks
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <atomic>
+#include <magic_enum.hpp>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace vks {
+
+// Object types the host allocations of the driver are accounted to
+enum class HostObject {
+    Instance,
+    Device,
+    Memory,
+    Buffer,
+    Image,
+    ImageView,
+    Sampler,
+    ShaderModule,
+    Pipeline,
+    PipelineLayout,
+    PipelineCache,
+    DescriptorSetLayout,
+    DescriptorPool,
+    RenderPass,
+    Framebuffer,
+    CommandPool,
+    Fence,
+    Semaphore,
+    QueryPool,
+    Swapchain,
+    DebugMessenger,
+};
+
+struct HostMemoryStats {
+    size_t bytes;
+    size_t peak_bytes;
+    size_t allocations;
+    // Bytes per VkSystemAllocationScope, command to instance
+    std::array<size_t, 5> scope_bytes;
+    // Allocations the driver made itself and only notified us of
+    size_t internal_bytes;
+};
+
+struct DeviceMemoryStats {
+    VkDeviceSize bytes;
+    VkDeviceSize peak_bytes;
+    size_t allocations;
+};
+
+// Tracking allocation callbacks for every host object type and the
+// vkAllocateMemory sizes of every owner, both safe to use from any thread
+class MemoryTracker {
+   public:
+    static constexpr size_t OBJECT_COUNT =
+        magic_enum::enum_count<HostObject>();
+
+    MemoryTracker();
+    MemoryTracker(const MemoryTracker&) = delete;
+    MemoryTracker(MemoryTracker&&) = delete;
+
+    MemoryTracker& operator=(const MemoryTracker&) = delete;
+    MemoryTracker& operator=(MemoryTracker&&) = delete;
+
+    const VkAllocationCallbacks* callbacks(HostObject object) const {
+        return &m_callbacks[static_cast<size_t>(object)];
+    }
+    HostMemoryStats host(HostObject object) const;
+
+    void allocated(VkDeviceMemory memory, const std::string& owner,
+                   VkDeviceSize size, uint32_t heap);
+    void freed(VkDeviceMemory memory);
+    std::unordered_map<std::string, DeviceMemoryStats> owners() const;
+    VkDeviceSize heapBytes(uint32_t heap) const;
+
+    // Host memory per object type, then device memory per owner
+    void report(std::ostream& out) const;
+    static std::string formatBytes(uint64_t bytes);
+
+   private:
+    struct Counters {
+        std::atomic<size_t> bytes;
+        std::atomic<size_t> peak_bytes;
+        std::atomic<size_t> allocations;
+        std::array<std::atomic<size_t>, 5> scope_bytes;
+        std::atomic<size_t> internal_bytes;
+    };
+
+    // Stored in front of every allocation, free only receives the pointer
+    struct Header {
+        void* raw;
+        size_t size;
+        VkSystemAllocationScope scope;
+    };
+
+    static void* VKAPI_PTR allocate(void* user_data, size_t size,
+                                    size_t alignment,
+                                    VkSystemAllocationScope scope);
+    static void* VKAPI_PTR reallocate(void* user_data, void* original,
+                                      size_t size, size_t alignment,
+                                      VkSystemAllocationScope scope);
+    static void VKAPI_PTR free(void* user_data, void* memory);
+    static void VKAPI_PTR internalAllocation(
+        void* user_data, size_t size, VkInternalAllocationType type,
+        VkSystemAllocationScope scope);
+    static void VKAPI_PTR internalFree(void* user_data, size_t size,
+                                       VkInternalAllocationType type,
+                                       VkSystemAllocationScope scope);
+
+    std::array<Counters, OBJECT_COUNT> m_counters{};
+    std::array<VkAllocationCallbacks, OBJECT_COUNT> m_callbacks;
+
+    struct Allocation {
+        std::string owner;
+        VkDeviceSize size;
+        uint32_t heap;
+    };
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<VkDeviceMemory, Allocation> m_allocations;
+    std::unordered_map<std::string, DeviceMemoryStats> m_owners;
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> m_heap_bytes{};
+};
+
+}  // namespace vks
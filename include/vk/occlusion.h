@@ -0,0 +1,140 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+#include "vk/device.h"
+#include "vk/layout_cache.h"
+#include "vk/pipeline.h"
+
+namespace vks {
+
+// Two phase occlusion culling against a hierarchical depth pyramid: draws
+// visible in the pyramid of the previous frame are drawn first, the
+// pyramid is rebuilt from their depth and the draws rejected by the first
+// phase are tested again. Results are written to the instanceCount of
+// indexed indirect draw commands, nothing is read back by the CPU
+class OcclusionCuller {
+   public:
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller(OcclusionCuller&&) = delete;
+
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(OcclusionCuller&&) = delete;
+
+    ~OcclusionCuller();
+
+   private:
+    friend class Context;
+    OcclusionCuller(Device& device, LayoutCache& layouts);
+
+    static constexpr VkFormat PYRAMID_FORMAT{VK_FORMAT_R32_SFLOAT};
+    static constexpr uint32_t MAX_LEVELS{16};
+
+    // The depth format has to be sampled, the pyramid format stored to
+    static bool supported(Device& device);
+
+    struct Draw {
+        glm::mat4 transform;
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32_t index_count;
+    };
+
+    // Matches the Bounds struct of the hiz_cull shader
+    struct Bounds {
+        std::array<glm::ivec4, 2> texels;
+        glm::vec2 depth;
+        glm::ivec2 level;
+    };
+
+    struct Pyramid {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        std::vector<VkImageView> level_views;
+        std::vector<VkExtent2D> level_extents;
+        // Extent of the depth buffer it is reduced from
+        VkExtent2D extent;
+        uint64_t serial;
+    };
+
+    struct Slot {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        uint8_t* data;
+        size_t capacity;
+        // Commands follow the bounds of every draw
+        VkDeviceSize command_offset;
+        VkDescriptorPool pool;
+        std::array<VkDescriptorSet, MAX_LEVELS> reduce_sets;
+        VkDescriptorSet cull_set;
+    };
+
+    struct RetiredBuffer {
+        uint64_t serial;
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+    };
+
+    // Fills the frame slot's draw buffer, the slot's previous frame must
+    // have completed
+    void prepare(uint32_t slot, VkExtent2D extent, const glm::mat4& camera,
+                 const std::vector<Draw>& draws, uint64_t serial,
+                 uint64_t completed_serial);
+    // Contents of a new pyramid are undefined, it is cleared to the far
+    // plane so that the first phase keeps every draw
+    bool pyramidFresh() const { return m_fresh; }
+    // The pyramid no longer matches the scene, after culling was disabled
+    void invalidate() { m_fresh = true; }
+    VkImage pyramidImage() const { return m_pyramid.image; }
+    VkImageView pyramidView() const { return m_pyramid.view; }
+    VkBuffer drawBuffer() const { return m_slots[m_slot].buffer; }
+    VkBuffer visibilityBuffer() const { return m_visibility; }
+    VkDeviceSize commandOffset(size_t draw) const {
+        return m_slots[m_slot].command_offset +
+               draw * sizeof(VkDrawIndexedIndirectCommand);
+    }
+
+    void recordClear(VkCommandBuffer command);
+    void recordCull(VkCommandBuffer command, uint32_t phase);
+    void recordPyramid(VkCommandBuffer command, VkImageView depth);
+
+    void createPipelines();
+    void createPyramid(VkExtent2D extent);
+    void destroyPyramid(Pyramid& pyramid);
+    void createSlot(Slot& slot);
+    void allocateDrawBuffer(Slot& slot, size_t capacity);
+    void allocateVisibility(size_t capacity, uint64_t serial);
+    void releaseRetired(uint64_t completed_serial);
+    void project(const glm::mat4& view_projection, const Draw& draw,
+                 uint32_t phase, Bounds& bounds) const;
+
+    Device& device;
+    LayoutCache& m_layouts;
+
+    std::optional<ComputePipeline> m_reduce;
+    std::optional<ComputePipeline> m_cull;
+
+    Pyramid m_pyramid;
+    std::vector<Pyramid> m_retired_pyramids;
+    bool m_fresh;
+    // View projection the pyramid contents were rendered with
+    glm::mat4 m_pyramid_camera;
+
+    std::vector<Slot> m_slots;
+    uint32_t m_slot;
+    uint32_t m_draw_count;
+
+    VkBuffer m_visibility;
+    VkDeviceMemory m_visibility_memory;
+    size_t m_visibility_capacity;
+    std::vector<RetiredBuffer> m_retired_buffers;
+};
+
+}  // namespace vks
@@ -2,21 +2,45 @@
 
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "vk/device.h"
+#include "vk/layout_cache.h"
 #include "vk/render_pass.h"
+#include "vk/shader_registry.h"
 #include "vk/vertex.h"
 
 namespace vks {
 
+struct RenderState {
+    VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+    VkCompareOp depth_compare = VK_COMPARE_OP_LESS;
+    bool depth_write = true;
+    bool blend = true;
+    // Without colour writes the fragment stage may be omitted
+    bool color_write = true;
+};
+
+struct PipelineVariant {
+    VertexAttribs attribs = VertexAttribs::defaultAttributes();
+    RenderState render_state{};
+    // specialization constant id to its 32-bit value
+    std::map<uint32_t, uint32_t> constants{};
+
+    std::string key(const std::string& program) const;
+};
+
 class GraphicsPipeline {
    public:
     GraphicsPipeline(const GraphicsPipeline&) = delete;
     GraphicsPipeline(GraphicsPipeline&& other)
-        : device{other.device}, m_pipeline{other.m_pipeline} {
+        : device{other.device},
+          m_pipeline{other.m_pipeline},
+          m_layout{other.m_layout},
+          m_push_ranges{std::move(other.m_push_ranges)} {
         other.m_pipeline = VK_NULL_HANDLE;
     };
 
@@ -25,17 +49,27 @@ class GraphicsPipeline {
 
     ~GraphicsPipeline() {
         if (m_pipeline != VK_NULL_HANDLE) {
-            vkDestroyPipeline(*device, m_pipeline, nullptr);
+            vkDestroyPipeline(*device, m_pipeline,
+                              device.allocator(HostObject::Pipeline));
         }
     };
 
    private:
     friend class Context;
+    friend class ComputePipeline;
     Device& device;
 
     GraphicsPipeline(Device& device, RenderPass& renderPass,
-                     const std::filesystem::path& dir, VkPipelineLayout layout,
-                     const VertexAttribs& attribs);
+                     const std::filesystem::path& dir, LayoutCache& layouts,
+                     const PipelineVariant& variant);
+    // Placeholder for a pipeline which is still being compiled
+    GraphicsPipeline(Device& device)
+        : device{device},
+          m_pipeline{VK_NULL_HANDLE},
+          m_layout{VK_NULL_HANDLE},
+          m_push_ranges{} {};
+
+    bool ready() const { return m_pipeline != VK_NULL_HANDLE; }
 
     enum class Stage {
         Vertex = VK_SHADER_STAGE_VERTEX_BIT,
@@ -47,13 +81,65 @@ class GraphicsPipeline {
 
     using ProgramSource = std::unordered_map<Stage, std::vector<char>>;
 
-    std::vector<char> loadShaderSource(const std::filesystem::path& filepath);
+    GraphicsPipeline(Device& device, RenderPass& renderPass,
+                     const ProgramSource& source, const std::string& name,
+                     LayoutCache& layouts, const PipelineVariant& variant);
+
+    static ProgramSource loadProgramSource(const std::filesystem::path& dir);
+    static ProgramSource embeddedProgramSource(const EmbeddedProgram& program);
+    static std::vector<char> loadShaderSource(
+        const std::filesystem::path& filepath);
     std::vector<VkPipelineShaderStageCreateInfo> createShaderModules(
-        const ProgramSource& source);
+        const ProgramSource& source,
+        const VkSpecializationInfo* specialization);
     void buildPipeline(const ProgramSource& source, RenderPass& renderPass,
-                       VkPipelineLayout layout, const VertexAttribs& attribs);
+                       VkPipelineLayout layout,
+                       const PipelineVariant& variant);
+
+    VkPipeline m_pipeline;
+    VkPipelineLayout m_layout;
+    // As reflected, stages only share a range with identical bounds
+    std::vector<VkPushConstantRange> m_push_ranges;
+};
+
+class ComputePipeline {
+   public:
+    ComputePipeline(const ComputePipeline&) = delete;
+    ComputePipeline(ComputePipeline&& other)
+        : device{other.device},
+          m_pipeline{other.m_pipeline},
+          m_layout{other.m_layout},
+          m_push_stages{other.m_push_stages},
+          m_sets{std::move(other.m_sets)} {
+        other.m_pipeline = VK_NULL_HANDLE;
+    };
+
+    ComputePipeline& operator=(const ComputePipeline&) = delete;
+    ComputePipeline& operator=(ComputePipeline&&) = delete;
+
+    ~ComputePipeline() {
+        if (m_pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(*device, m_pipeline,
+                              device.allocator(HostObject::Pipeline));
+        }
+    };
+
+   private:
+    friend class Context;
+    friend class OcclusionCuller;
+    Device& device;
+
+    ComputePipeline(Device& device, const std::filesystem::path& dir,
+                    LayoutCache& layouts,
+                    const std::map<uint32_t, uint32_t>& constants);
+    ComputePipeline(Device& device, const std::vector<char>& code,
+                    const std::string& name, LayoutCache& layouts,
+                    const std::map<uint32_t, uint32_t>& constants);
 
     VkPipeline m_pipeline;
+    VkPipelineLayout m_layout;
+    VkShaderStageFlags m_push_stages;
+    std::map<uint32_t, ShaderInterface::SetBindings> m_sets;
 };
 
 }  // namespace vks
\ No newline at end of file
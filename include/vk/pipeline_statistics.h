@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "vk/device.h"
+
+namespace vks {
+
+struct PipelineCounters {
+    uint64_t vertex_invocations;
+    // Primitives entering and leaving the clipping stage
+    uint64_t clipping_invocations;
+    uint64_t clipping_primitives;
+    uint64_t fragment_invocations;
+
+    PipelineCounters& operator+=(const PipelineCounters& other) {
+        vertex_invocations += other.vertex_invocations;
+        clipping_invocations += other.clipping_invocations;
+        clipping_primitives += other.clipping_primitives;
+        fragment_invocations += other.fragment_invocations;
+        return *this;
+    }
+};
+
+struct FrameStatistics {
+    PipelineCounters frame;
+    // In recording order, pre-pass draws are listed as "<pass> depth"
+    std::vector<std::pair<std::string, PipelineCounters>> passes;
+    // Keyed by pipeline index
+    std::unordered_map<size_t, PipelineCounters> pipelines;
+};
+
+// Pipeline statistics queries around every run of draws sharing a
+// pipeline. Queries of one type cannot nest, so pass and frame totals are
+// summed from the pipeline runs. Like the timestamps of the profiler each
+// frame slot owns a query pool read back once its fence has signalled
+class StatisticsQueries {
+   public:
+    StatisticsQueries(const StatisticsQueries&) = delete;
+    StatisticsQueries(StatisticsQueries&&) = delete;
+
+    StatisticsQueries& operator=(const StatisticsQueries&) = delete;
+    StatisticsQueries& operator=(StatisticsQueries&&) = delete;
+
+    ~StatisticsQueries();
+
+   private:
+    friend class Context;
+    StatisticsQueries(Device& device);
+
+    // Runs beyond it are not counted for the rest of the frame
+    static constexpr uint32_t MAX_QUERIES{256};
+    // Results are written in the order of the flag bits, as the fields of
+    // PipelineCounters
+    static constexpr VkQueryPipelineStatisticFlags COUNTERS{
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT};
+    static constexpr uint32_t COUNTER_COUNT{4};
+
+    struct Run {
+        std::string pass;
+        size_t pipeline;
+    };
+
+    struct Slot {
+        VkQueryPool pool;
+        std::vector<Run> runs;
+        bool pending;
+    };
+
+    // The pipelineStatisticsQuery feature is optional
+    bool supported() const { return device.info().pipeline_statistics; }
+    bool enabled() const { return m_enabled; }
+    // Only between frames
+    void setEnabled(bool enabled) { m_enabled = enabled && supported(); }
+    // Counters of the latest frame read back
+    const FrameStatistics& results() const { return m_results; }
+
+    // Collects the slot's previous frame, its fence must have signalled
+    void beginFrame(VkCommandBuffer command, uint32_t slot);
+    void endFrame();
+    // Within a single subpass, a run still open is ended first
+    void begin(VkCommandBuffer command, const std::string& pass,
+               size_t pipeline);
+    void end(VkCommandBuffer command);
+
+    void collect(Slot& slot);
+
+    Device& device;
+
+    bool m_enabled;
+    std::vector<Slot> m_slots;
+    std::optional<uint32_t> m_slot;
+    std::optional<uint32_t> m_active;
+    FrameStatistics m_results;
+};
+
+}  // namespace vks
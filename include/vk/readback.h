@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "vk/device.h"
+
+namespace vks {
+
+struct CapturedFrame {
+    uint64_t serial;
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    // Tightly packed rows, only valid for the duration of the consumer call
+    const uint8_t* data;
+    VkDeviceSize size;
+};
+
+// Frames are copied into host visible buffers and handed to the consumer
+// once the fence of their submission has signalled, several frames later,
+// so capturing never waits on the GPU
+class ReadbackRing {
+   public:
+    using Consumer = std::function<void(const CapturedFrame&)>;
+
+    ReadbackRing(const ReadbackRing&) = delete;
+    ReadbackRing(ReadbackRing&&) = delete;
+
+    ReadbackRing& operator=(const ReadbackRing&) = delete;
+    ReadbackRing& operator=(ReadbackRing&&) = delete;
+
+    ~ReadbackRing();
+
+   private:
+    friend class Context;
+    ReadbackRing(Device& device);
+
+    struct Slot {
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        uint8_t* data;
+        VkDeviceSize size;
+        bool coherent;
+        // Serial of the frame copied in, empty while the slot is free
+        std::optional<uint64_t> serial;
+        VkExtent2D extent;
+        VkFormat format;
+    };
+
+    bool active() const { return static_cast<bool>(m_consumer); }
+    // More slots than frames in flight keep one free for every frame
+    void start(Consumer&& consumer, size_t slot_count);
+    // Null when every slot still waits on the GPU, the frame is dropped
+    Slot* acquire(uint64_t serial, VkExtent2D extent, VkFormat format);
+    void record(VkCommandBuffer command, VkImage image, const Slot& slot);
+    void consume(uint64_t completed_serial);
+
+    void allocate(Slot& slot, VkDeviceSize size);
+    void release(Slot& slot);
+
+    Device& device;
+
+    Consumer m_consumer;
+    std::vector<Slot> m_slots;
+    uint32_t m_dropped;
+};
+
+}  // namespace vks
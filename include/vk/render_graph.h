@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vk/device.h"
+
+namespace vks {
+
+class GpuProfiler;
+
+// Frame graph rebuilt every frame: passes declare how they use resources,
+// passes whose results are never consumed are culled, barriers and layout
+// transitions are derived per pass and transient images share memory
+// whenever their lifetimes do not overlap
+class RenderGraph {
+   public:
+    using Resource = size_t;
+    using Execute = std::function<void(VkCommandBuffer)>;
+
+    enum class Access {
+        ColorAttachment,
+        DepthAttachment,
+        ResolveAttachment,
+        Sampled,
+        // Sampled and storage reads of compute shaders
+        ComputeSampled,
+        ComputeRead,
+        // Storage written by compute, read by any graphics stage
+        StorageRead,
+        StorageReadWrite,
+        TransferSrc,
+        TransferDst,
+        Present,
+    };
+
+    struct ImageDesc {
+        VkFormat format;
+        VkImageAspectFlags aspect;
+        VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    };
+
+    // Last synchronization scope a resource was used in
+    struct State {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+    };
+
+    class PassBuilder {
+       public:
+        PassBuilder& read(Resource resource, Access access);
+        PassBuilder& write(Resource resource, Access access);
+        PassBuilder& color(Resource resource,
+                           std::optional<VkClearColorValue> clear = {});
+        PassBuilder& depth(Resource resource,
+                           std::optional<VkClearDepthStencilValue> clear = {});
+        PassBuilder& resolve(Resource resource);
+        // Kept even when nothing in the graph consumes its writes
+        PassBuilder& sideEffects();
+
+       private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, size_t pass)
+            : graph{graph}, pass{pass} {};
+
+        RenderGraph& graph;
+        size_t pass;
+    };
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph(RenderGraph&&) = delete;
+
+    RenderGraph& operator=(const RenderGraph&) = delete;
+    RenderGraph& operator=(RenderGraph&&) = delete;
+
+    ~RenderGraph();
+
+   private:
+    friend class Context;
+    RenderGraph(Device& device);
+
+    void reset(VkExtent2D extent);
+    Resource createImage(const std::string& name, const ImageDesc& desc);
+    // Without an initial state the state left by the previous frame is
+    // used, or any earlier write assumed when the previous frame did not
+    // import it. Resources with a final access are transitioned to it at
+    // the end
+    Resource importImage(const std::string& name, VkImage image,
+                         VkImageView view, const ImageDesc& desc,
+                         std::optional<State> initial = {},
+                         std::optional<Access> final_access = {});
+    Resource importBuffer(const std::string& name, VkBuffer buffer,
+                          std::optional<State> initial = {});
+    // Cached framebuffers refer to imported views, call once any of them
+    // is replaced. Transients being placed again releases them too
+    void releaseFramebuffers();
+    PassBuilder addPass(const std::string& name, Execute&& execute);
+    // Transient views only exist once the graph executes
+    VkImageView view(Resource resource) const {
+        return m_resources[resource].view;
+    }
+
+    // Transient memory of graphs replaced before completed_serial is freed,
+    // every pass is a scope of the profiler when one is given
+    void execute(VkCommandBuffer command, uint64_t serial,
+                 uint64_t completed_serial, GpuProfiler* profiler = nullptr);
+
+    struct Use {
+        Resource resource;
+        Access access;
+        // Consuming uses keep the passes producing the resource alive
+        bool reads;
+        bool writes;
+    };
+
+    // Kept in render pass order: depth, colours, resolves
+    struct Attachment {
+        Resource resource;
+        Access access;
+        std::optional<VkClearValue> clear;
+    };
+
+    struct Pass {
+        std::string name;
+        Execute execute;
+        std::vector<Use> uses;
+        std::vector<Attachment> attachments;
+        bool side_effects;
+        bool culled;
+    };
+
+    struct ResourceInfo {
+        std::string name;
+        std::optional<ImageDesc> image_desc;
+        VkImage image;
+        VkImageView view;
+        VkBuffer buffer;
+        bool imported;
+        VkImageUsageFlags usage;
+        std::optional<State> initial;
+        std::optional<Access> final_access;
+        // Pass indices of the first and last use after culling
+        size_t first;
+        size_t last;
+    };
+
+    // Tracked per resource while recording, reads after the last write
+    // are accumulated so a following write waits for all of them
+    struct Tracking {
+        VkImageLayout layout;
+        VkPipelineStageFlags write_stages;
+        VkAccessFlags write_access;
+        VkPipelineStageFlags read_stages;
+        VkPipelineStageFlags visible_stages;
+        VkAccessFlags visible_access;
+    };
+
+    struct TransientImage {
+        VkImage image;
+        VkImageView view;
+        VkDeviceMemory memory;
+        // Transients placed over the same memory, including itself
+        std::vector<size_t> aliases;
+    };
+
+    struct Transients {
+        std::string signature;
+        std::vector<TransientImage> images;
+        VkDeviceMemory shared_memory;
+        std::vector<Tracking> final_states;
+        uint64_t serial;
+    };
+
+    struct Framebuffer {
+        uint64_t serial;
+        VkFramebuffer framebuffer;
+    };
+
+    static State accessState(Access access);
+    static bool isWrite(Access access);
+    static VkImageUsageFlags accessUsage(Access access);
+
+    void cullPasses();
+    void computeLifetimes();
+    void realizeTransients(uint64_t serial, uint64_t completed_serial);
+    void placeTransients(const std::vector<size_t>& transients,
+                         const std::vector<VkMemoryRequirements>& reqs,
+                         std::vector<VkDeviceSize>& offsets);
+    void destroyTransients(Transients& transients);
+    void recordBarriers(VkCommandBuffer command, size_t pass,
+                        const std::vector<Use>& uses);
+    void recordPass(VkCommandBuffer command, size_t pass, uint64_t serial);
+    static VkAttachmentLoadOp loadOp(const Attachment& attachment,
+                                     bool load);
+    VkAttachmentStoreOp storeOp(const Attachment& attachment,
+                                size_t pass) const;
+    VkRenderPass renderPass(size_t pass, const std::vector<bool>& load);
+    // Dynamic rendering needs neither render pass nor framebuffer objects
+    void beginRendering(VkCommandBuffer command, size_t pass,
+                        const std::vector<bool>& load);
+    bool usedAfter(Resource resource, size_t pass) const;
+    static uint64_t handleKey(const ResourceInfo& resource);
+
+    Device& device;
+
+    VkExtent2D m_extent;
+    std::vector<Pass> m_passes;
+    std::vector<ResourceInfo> m_resources;
+    std::vector<Tracking> m_tracking;
+    // Transient resource index to its slot in m_transients.images
+    std::unordered_map<Resource, size_t> m_transient_slots;
+
+    Transients m_transients;
+    std::vector<Transients> m_retired;
+    std::unordered_map<std::string, VkRenderPass> m_render_passes;
+    // By render pass, extent and attachment views, the serial of each is
+    // the frame which used it last
+    std::unordered_map<std::string, Framebuffer> m_framebuffer_cache;
+    // Released from the cache, destroyed once their frame has completed
+    std::vector<Framebuffer> m_framebuffers;
+    // State imports without an initial state left behind, by handle
+    std::unordered_map<uint64_t, Tracking> m_import_states;
+};
+
+}  // namespace vks
@@ -6,6 +6,10 @@
 
 namespace vks {
 
+// Pipelines are built against this pass, the render graph only begins
+// passes compatible with it: depth, colour, then the optional resolve.
+// With dynamic rendering no pass object exists and pipelines are built
+// against the attachment formats instead
 class RenderPass {
    public:
     RenderPass(const RenderPass&) = delete;
@@ -17,14 +21,27 @@ class RenderPass {
     ~RenderPass();
 
     VkRenderPass operator*() { return m_render_pass; }
+    VkSampleCountFlagBits samples() const { return m_samples; }
+    // Null unless the device renders dynamically
+    const VkPipelineRenderingCreateInfoKHR* renderingInfo() const {
+        return m_render_pass == VK_NULL_HANDLE ? &m_rendering_info : nullptr;
+    }
 
    private:
     friend class Context;
-    RenderPass(Device& device);
+    RenderPass(Device& device, VkSampleCountFlagBits samples);
+
+    // Multisampled passes resolve their colour into attachment 2
+    void create(VkSampleCountFlagBits samples);
+    // Only valid while no frame using the pass is in flight
+    void recreate(VkSampleCountFlagBits samples);
 
     Device& device;
 
     VkRenderPass m_render_pass;
+    VkSampleCountFlagBits m_samples;
+    VkFormat m_color_format;
+    VkPipelineRenderingCreateInfoKHR m_rendering_info;
 };
 
 }  // namespace vks
\ No newline at end of file
@@ -15,6 +15,21 @@ namespace vks {
 
 class Context;
 
+// Bytes of the single device allocation of a pack by what they hold
+struct PackMemory {
+    // Both the full vertex and the position only stream
+    VkDeviceSize vertex;
+    VkDeviceSize index;
+    VkDeviceSize uniform;
+    VkDeviceSize texture;
+    // Lost aligning each resource after the previous one
+    VkDeviceSize padding;
+
+    VkDeviceSize total() const {
+        return vertex + index + uniform + texture + padding;
+    }
+};
+
 class ResourcePack {
    public:
     ResourcePack(const ResourcePack&) = delete;
@@ -26,7 +41,8 @@ class ResourcePack {
           m_model_offsets{std::move(other.m_model_offsets)},
           m_texture_images{std::move(other.m_texture_images)},
           m_texture_views{std::move(other.m_texture_views)},
-          m_memory{other.m_memory} {
+          m_memory{other.m_memory},
+          m_memory_usage{other.m_memory_usage} {
         other.m_memory = VK_NULL_HANDLE;
     };
 
@@ -38,9 +54,14 @@ class ResourcePack {
     size_t model_index(const std::string& name) const {
         return m_model_indices.at(name);
     }
+    size_t model_count() const { return m_model_offsets.size(); }
+    const PackMemory& memoryUsage() const { return m_memory_usage; }
 
+    // With an indirect buffer the draw parameters are read from an
+    // indexed indirect command written on the GPU
     void draw(VkCommandBuffer cmd, size_t model_index,
-              VkPipelineLayout layout) {
+              VkPipelineLayout layout, VkBuffer indirect = VK_NULL_HANDLE,
+              VkDeviceSize indirect_offset = 0) {
         auto offsets = m_model_offsets[model_index];
         VkDeviceSize vertex_offset =
             offsets.vertex_offset * sizeof(Model::Vertex);
@@ -49,13 +70,33 @@ class ResourcePack {
         VkBuffer index_buffer = *m_buffers.index;
         VkDeviceSize index_offset = offsets.index_offset * sizeof(uint32_t);
 
-        vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer, &vertex_offset);
-        vkCmdBindIndexBuffer(cmd, index_buffer, index_offset,
-                             VK_INDEX_TYPE_UINT32);
-        vkCmdBindDescriptorSets(
+        VK_CALL(vkCmdBindVertexBuffers)(cmd, 0, 1, &vertex_buffer,
+                                        &vertex_offset);
+        VK_CALL(vkCmdBindIndexBuffer)(cmd, index_buffer, index_offset,
+                                      VK_INDEX_TYPE_UINT32);
+        VK_CALL(vkCmdBindDescriptorSets)(
             cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1,
             &m_materials.descriptors[offsets.material_index], 0, nullptr);
-        vkCmdDrawIndexed(cmd, offsets.index_count, 1, 0, 0, 0);
+        drawIndexed(cmd, offsets, indirect, indirect_offset);
+    }
+
+    // Position only stream for depth passes, no material is bound
+    void drawDepth(VkCommandBuffer cmd, size_t model_index,
+                   VkBuffer indirect = VK_NULL_HANDLE,
+                   VkDeviceSize indirect_offset = 0) {
+        auto offsets = m_model_offsets[model_index];
+        VkDeviceSize position_offset =
+            offsets.vertex_offset * sizeof(glm::vec3);
+        VkBuffer position_buffer = *m_buffers.position;
+
+        VkBuffer index_buffer = *m_buffers.index;
+        VkDeviceSize index_offset = offsets.index_offset * sizeof(uint32_t);
+
+        VK_CALL(vkCmdBindVertexBuffers)(cmd, 0, 1, &position_buffer,
+                                        &position_offset);
+        VK_CALL(vkCmdBindIndexBuffer)(cmd, index_buffer, index_offset,
+                                      VK_INDEX_TYPE_UINT32);
+        drawIndexed(cmd, offsets, indirect, indirect_offset);
     }
 
    private:
@@ -71,11 +112,26 @@ class ResourcePack {
         size_t index_offset;
         size_t index_count;
         size_t material_index;
+        // Model space bounding box
+        glm::vec3 bounds_min;
+        glm::vec3 bounds_max;
     };
 
+    static void drawIndexed(VkCommandBuffer cmd, const ModelOffset& offsets,
+                            VkBuffer indirect, VkDeviceSize indirect_offset) {
+        if (indirect != VK_NULL_HANDLE) {
+            VK_CALL(vkCmdDrawIndexedIndirect)(cmd, indirect, indirect_offset, 1,
+                                              0);
+        } else {
+            VK_CALL(vkCmdDrawIndexed)(cmd, offsets.index_count, 1, 0, 0, 0);
+        }
+    }
+
     struct Buffers {
-        Buffers(Buffer&& vertex, Buffer&& index, Buffer&& uniform)
+        Buffers(Buffer&& vertex, Buffer&& position, Buffer&& index,
+                Buffer&& uniform)
             : vertex{std::move(vertex)},
+              position{std::move(position)},
               index{std::move(index)},
               uniform{std::move(uniform)} {};
         Buffers(Buffers&&) = default;
@@ -84,6 +140,7 @@ class ResourcePack {
         Buffers& operator=(Buffers&&) = delete;
 
         Buffer vertex;
+        Buffer position;
         Buffer index;
         Buffer uniform;
     } m_buffers;
@@ -94,11 +151,13 @@ class ResourcePack {
                                  std::vector<std::string>& material_names,
                                  std::vector<std::string>& texture_names,
                                  VkDeviceSize& vertex_buffer_size,
+                                 VkDeviceSize& position_buffer_size,
                                  VkDeviceSize& index_buffer_size,
                                  VkDeviceSize& staging_buffer_size);
 
     static Buffers createBuffers(Device& device,
                                  VkMemoryRequirements& vertex_requirements,
+                                 VkMemoryRequirements& position_requirements,
                                  VkMemoryRequirements& index_requirements,
                                  VkMemoryRequirements& uniform_requirements,
                                  const std::vector<uint32_t>& queue_indices);
@@ -112,10 +171,11 @@ class ResourcePack {
 
     static VkDeviceMemory allocateMemory(
         Device& device, const VkMemoryRequirements& vertex_requirements,
+        const VkMemoryRequirements& position_requirements,
         const VkMemoryRequirements& index_requirements,
         const VkMemoryRequirements& uniform_requirements,
         const std::vector<TextureRequirements>& texture_requirements,
-        Buffers& buffers, std::vector<Image2D>& images);
+        Buffers& buffers, std::vector<Image2D>& images, PackMemory& usage);
 
     static void copyResources(Context& context,
                               VkDeviceSize staging_buffer_size,
@@ -152,7 +212,7 @@ class ResourcePack {
                  std::vector<ModelOffset>&& model_offsets,
                  std::vector<Image2D>&& texture_images,
                  std::vector<ImageView2D>&& texture_views,
-                 VkDeviceMemory memory)
+                 VkDeviceMemory memory, const PackMemory& memory_usage)
         : device{device},
           m_buffers{std::move(buffers)},
           m_materials{std::move(materials)},
@@ -160,7 +220,8 @@ class ResourcePack {
           m_model_offsets{std::move(model_offsets)},
           m_texture_images{std::move(texture_images)},
           m_texture_views{std::move(texture_views)},
-          m_memory{memory} {};
+          m_memory{memory},
+          m_memory_usage{memory_usage} {};
 
     std::unordered_map<std::string, size_t> m_model_indices;
     std::vector<ModelOffset> m_model_offsets;
@@ -168,5 +229,6 @@ class ResourcePack {
     std::vector<ImageView2D> m_texture_views;
 
     VkDeviceMemory m_memory;
+    PackMemory m_memory_usage;
 };
 }  // namespace vks
\ No newline at end of file
@@ -22,7 +22,8 @@ class Sampler {
 
     ~Sampler() {
         if (m_sampler != VK_NULL_HANDLE) {
-            vkDestroySampler(*device, m_sampler, nullptr);
+            vkDestroySampler(*device, m_sampler,
+                             device.allocator(HostObject::Sampler));
         }
     }
 
@@ -62,8 +63,9 @@ class Sampler {
         auto sampler_info = info(type);
         sampler_info.maxAnisotropy =
             device.info().properties.limits.maxSamplerAnisotropy;
-        if (vkCreateSampler(*device, &sampler_info, nullptr, &m_sampler) !=
-            VK_SUCCESS) {
+        if (vkCreateSampler(*device, &sampler_info,
+                            device.allocator(HostObject::Sampler),
+                            &m_sampler) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create sampler");
         }
     }
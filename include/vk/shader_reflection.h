@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace vks {
+
+struct ShaderInterface {
+    using SetBindings = std::vector<VkDescriptorSetLayoutBinding>;
+
+    static ShaderInterface reflect(const std::vector<char>& code,
+                                  VkShaderStageFlagBits stage);
+
+    void merge(const ShaderInterface& other);
+    void validateVertexInput(
+        const std::vector<VkVertexInputAttributeDescription>& attributes)
+        const;
+
+    std::map<uint32_t, SetBindings> sets;
+    std::vector<VkPushConstantRange> push_ranges;
+    std::map<uint32_t, VkFormat> vertex_inputs;
+    std::set<uint32_t> spec_constants;
+};
+
+}  // namespace vks
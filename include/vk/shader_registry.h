@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vks {
+
+// Enumerators are generated at build time from the shaders/source program
+// directories, see embedded_shaders.h in the build tree
+enum class ShaderProgram : uint32_t;
+
+struct EmbeddedStage {
+    VkShaderStageFlagBits stage;
+    const uint32_t* code;
+    size_t size;
+};
+
+struct EmbeddedProgram {
+    const char* name;
+    const EmbeddedStage* stages;
+    size_t stage_count;
+};
+
+const EmbeddedProgram& embeddedProgram(ShaderProgram program);
+
+}  // namespace vks
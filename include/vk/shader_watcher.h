@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vks {
+
+class ShaderWatcher {
+   public:
+    using ReloadCallback = std::function<void(
+        const std::string& name, const std::filesystem::path& dir)>;
+
+    ShaderWatcher(const std::filesystem::path& source_root,
+                  const std::filesystem::path& cache_root,
+                  ReloadCallback&& callback);
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher(ShaderWatcher&&) = delete;
+
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(ShaderWatcher&&) = delete;
+
+    ~ShaderWatcher();
+
+   private:
+    void watch();
+    void watchInotify();
+    void watchPolling();
+    void reload(const std::unordered_set<std::string>& names);
+
+    // Programs with a stage that includes one of the files
+    std::unordered_set<std::string> dependentPrograms(
+        const std::set<std::filesystem::path>& files) const;
+    std::set<std::filesystem::path> includedFiles(
+        const std::filesystem::path& filepath) const;
+    // Set for stage sources directly inside a program directory
+    std::optional<std::string> programName(
+        const std::filesystem::path& filepath) const;
+
+    std::optional<std::filesystem::path> compileProgram(
+        const std::string& name);
+    std::optional<std::filesystem::path> compileStage(
+        const std::filesystem::path& filepath);
+
+    static bool isShaderSource(const std::filesystem::path& filepath);
+    static uint64_t sourceHash(const std::vector<char>& source);
+
+    std::filesystem::path m_source_root;
+    std::filesystem::path m_cache_root;
+    ReloadCallback m_callback;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+}  // namespace vks
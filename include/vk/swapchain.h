@@ -2,14 +2,28 @@
 
 #include <vulkan/vulkan.h>
 
+#include <optional>
+#include <vector>
+
 #include "vk/device.h"
-#include "vk/render_pass.h"
+#include "vk/image.h"
 
 namespace vks {
 
+enum class LatencyMode {
+    // MAILBOX when available with one image beyond the minimum, the default
+    Balanced,
+    // Fewest images, the CPU waits for the last frame before sampling input
+    LowLatency,
+    // FIFO presentation, optionally paced by a CPU frame limiter
+    Smooth,
+    // Most images, frames are queued as fast as they can be produced
+    Throughput,
+};
+
 class Swapchain {
    private:
-    Swapchain(Device& device, RenderPass& renderPass);
+    Swapchain(Device& device);
     ~Swapchain();
 
     Swapchain(const Swapchain&) = delete;
@@ -19,46 +33,75 @@ class Swapchain {
 
     struct FrameState {
         uint32_t _index;
-        VkFramebuffer _framebuffer;
+        VkImage _image;
+        VkImageView _view;
         VkSemaphore _draw_ready;
         VkSemaphore _draw_finished;
         VkFence _submit_fence;
         VkCommandBuffer _command;
     };
 
-    FrameState acquireImage();
+    std::optional<FrameState> acquireImage();
     void presentImage(FrameState& state);
+    bool recreate();
+    // Blocks until the frame submitted last has completed on the GPU
+    void waitSubmitted() { waitSerial(m_submit_serial); }
+    // Blocks until the frame with the serial has completed on the GPU
+    void waitSerial(uint64_t serial);
+    // Applied when the swapchain is next recreated
+    void setLatencyMode(LatencyMode mode, bool tearing);
 
    public:
     friend class Context;
     Device& device;
 
-    void createSwapchain();
-    void createDepthBuffer();
-    void createFramebuffers(RenderPass& renderPass);
+    void createSwapchain(VkSwapchainKHR old_swapchain);
+    VkPresentModeKHR presentMode() const;
+    uint32_t imageCount(const VkSurfaceCapabilitiesKHR& capabilities) const;
+    // Stand in for the swapchain images of headless devices
+    void createOffscreenImages();
+    void createImageViews();
     void createSynchronizationPrimitives();
     void createCommandBuffers();
+    void destroySynchronizationPrimitives();
 
     VkSwapchainKHR m_swapchain;
 
-    struct {
-        VkDeviceMemory memory;
-        VkImage image;
-        VkImageView view;
-    } m_depth_buffer;
+    struct RetiredTargets {
+        uint64_t serial;
+        VkSwapchainKHR swapchain;
+        std::vector<VkImageView> image_views;
+    };
+
+    RetiredTargets retireTargets();
+    void destroyTargets(RetiredTargets& targets);
+    // Destroys targets retired before the frame with presented_serial,
+    // whose image has come back from presentation on a newer swapchain
+    void releaseRetiredTargets(uint64_t presented_serial);
+
+    std::vector<RetiredTargets> m_retired;
 
     VkExtent2D m_extent;
 
     VkCommandPool m_pool;
     std::vector<VkCommandBuffer> m_commands;
-    std::vector<VkFramebuffer> m_framebuffers;
     std::vector<VkImageView> m_image_views;
     std::vector<VkImage> m_images;
+    std::vector<Image2D> m_offscreen_images;
+    std::vector<VkDeviceMemory> m_offscreen_memory;
     std::vector<VkFence> m_image_available;
     std::vector<VkSemaphore> m_image_draw_finished;
     std::vector<VkSemaphore> m_image_draw_ready;
+    std::vector<uint64_t> m_fence_serials;
+
+    LatencyMode m_latency_mode;
+    // Allows IMMEDIATE presentation in the low latency mode
+    bool m_tearing;
 
     uint32_t m_current_frame;
+    uint64_t m_submit_serial;
+    uint64_t m_completed_serial;
+    bool m_outdated;
 };
 
 }  // namespace vks
\ No newline at end of file
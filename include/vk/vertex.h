@@ -32,6 +32,22 @@ struct VertexAttribs {
 
         return {bindings, attributes};
     }
+    // Tightly packed positions, see ResourcePack::drawDepth
+    static VertexAttribs positionAttributes() {
+        std::vector<VkVertexInputBindingDescription> bindings(1);
+
+        bindings[0].binding = 0;
+        bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        bindings[0].stride = sizeof(glm::vec3);
+
+        std::vector<VkVertexInputAttributeDescription> attributes(1);
+        attributes[0].binding = 0;
+        attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributes[0].location = 0;
+        attributes[0].offset = 0;
+
+        return {bindings, attributes};
+    }
     std::vector<VkVertexInputBindingDescription> bindings;
     std::vector<VkVertexInputAttributeDescription> attributes;
 };
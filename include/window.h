@@ -22,7 +22,7 @@ class Window {
             throw std::runtime_error("Failed to initialize GLFW");
         }
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
         m_window =
             glfwCreateWindow(width, height, name.c_str(), nullptr, nullptr);
         if (!m_window) {
@@ -34,6 +34,8 @@ class Window {
                                  (GLFWcursorposfun)glfwMousePosCallback);
         glfwSetWindowCloseCallback(m_window,
                                    (GLFWwindowclosefun)glfwWindowCloseCallback);
+        glfwSetFramebufferSizeCallback(
+            m_window, (GLFWframebuffersizefun)glfwFramebufferSizeCallback);
         windows_opened++;
     }
     Window(const Window&) = delete;
@@ -52,6 +54,7 @@ class Window {
             key_callbacks.erase(m_window);
             mouse_callbacks.erase(m_window);
             close_callbacks.erase(m_window);
+            resize_callbacks.erase(m_window);
             glfwDestroyWindow(m_window);
             windows_opened--;
             if (!windows_opened) glfwTerminate();
@@ -73,11 +76,23 @@ class Window {
         close_callbacks[m_window].emplace_back(std::move(callback));
     }
 
+    void registerResizeCallback(
+        std::function<void(uint32_t, uint32_t)>&& callback) {
+        resize_callbacks[m_window].emplace_back(std::move(callback));
+    }
+
     const std::string m_name;
     const uint32_t m_width;
     const uint32_t m_height;
 
-    float aspect() const { return static_cast<float>(m_width) / m_height; }
+    float aspect() const {
+        int width{}, height{};
+        glfwGetFramebufferSize(m_window, &width, &height);
+        if (width == 0 || height == 0) {
+            return static_cast<float>(m_width) / m_height;
+        }
+        return static_cast<float>(width) / height;
+    }
 
     static void glfwErrorCallback(int err, const char* desc) {
         std::cout << "GLFW Error: " << err << ": " << desc << std::endl;
@@ -102,6 +117,14 @@ class Window {
         };
     }
 
+    static void glfwFramebufferSizeCallback(GLFWwindow* window, int width,
+                                            int height) {
+        for (auto& callback : resize_callbacks[window]) {
+            callback(static_cast<uint32_t>(width),
+                     static_cast<uint32_t>(height));
+        };
+    }
+
    private:
     friend class Device;
 
@@ -129,6 +152,10 @@ class Window {
                                      std::vector<std::function<void(void)>>>
         close_callbacks;
 
+    inline static std::unordered_map<
+        GLFWwindow*, std::vector<std::function<void(uint32_t, uint32_t)>>>
+        resize_callbacks;
+
     GLFWwindow* m_window;
 };
 }  // namespace vks
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 460 core
+#define VULKAN 100
+
+layout(location=0) in vec3 pos;
+
+layout(push_constant) uniform Model {
+    mat4 camera;
+    mat4 model;
+} model_transform;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = model_transform.camera * model_transform.model * vec4(pos, 1.0);
+}
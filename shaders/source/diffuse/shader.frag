@@ -4,11 +4,11 @@
 layout(location=0) out vec4 frag_color;
 
 layout(set=0, binding=0) uniform sampler2D diffuse_tex;
-layout(set=0, binding=0) uniform sampler2D normal_tex;
-layout(set=0, binding=0) uniform sampler2D metallic_tex;
-layout(set=0, binding=0) uniform sampler2D roughness_tex;
-layout(set=0, binding=0) uniform sampler2D ambient_tex;
-layout(set=0, binding=0) uniform sampler2D emission_tex;
+layout(set=0, binding=1) uniform sampler2D normal_tex;
+layout(set=0, binding=2) uniform sampler2D metallic_tex;
+layout(set=0, binding=3) uniform sampler2D roughness_tex;
+layout(set=0, binding=4) uniform sampler2D ambient_tex;
+layout(set=0, binding=5) uniform sampler2D emission_tex;
 
 layout(set=0, binding=6) uniform Material {
     vec3 diffuse;
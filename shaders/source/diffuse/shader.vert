@@ -15,6 +15,8 @@ layout(location=0) out VS_OUT {
     vec2 tex;
 } vs_out;
 
+invariant gl_Position;
+
 void main() {
     vs_out.norm = norm;
     vs_out.tex = tex;
@@ -3,18 +3,253 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLM_FORCE_RADIANS
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <memory>
+#include <vector>
+
+#include "percentile.h"
 
 namespace vks {
+
+namespace {
+constexpr uint32_t BENCHMARK_FRAMES{1000};
+// Not reported, they cover the frames in flight before GPU times arrive
+constexpr uint32_t BENCHMARK_WARMUP_FRAMES{16};
+
+// Swapchains mostly use BGRA, encoders and image files expect RGB order.
+// Channels missing from the format read as zero, alpha as opaque
+void toRGB(const CapturedFrame& frame, std::vector<uint8_t>& pixels,
+           bool alpha) {
+    auto texel_size = Image2D::TexelSize(frame.format);
+    bool bgr = frame.format == VK_FORMAT_B8G8R8A8_UNORM ||
+               frame.format == VK_FORMAT_B8G8R8A8_SRGB ||
+               frame.format == VK_FORMAT_B8G8R8_UNORM ||
+               frame.format == VK_FORMAT_B8G8R8_SRGB;
+    size_t channels = alpha ? 4 : 3;
+    size_t count = static_cast<size_t>(frame.width) * frame.height;
+    pixels.resize(count * channels);
+    for (size_t i{0}; i < count; i++) {
+        std::array<uint8_t, 4> rgba{0, 0, 0, 255};
+        std::copy_n(frame.data + i * texel_size, texel_size, rgba.begin());
+        if (bgr) {
+            std::swap(rgba[0], rgba[2]);
+        }
+        std::copy_n(rgba.begin(), channels, pixels.data() + i * channels);
+    }
+}
+}  // namespace
+
+void Application::captureImages(const std::filesystem::path& dir) {
+    std::filesystem::create_directories(dir);
+    m_context.captureFrames(
+        [dir, index = uint32_t{0},
+         pixels = std::vector<uint8_t>{}](const CapturedFrame& frame) mutable {
+            toRGB(frame, pixels, false);
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%06u.ppm", index++);
+            std::ofstream file{dir / name, std::ios::binary};
+            file << "P6\n" << frame.width << ' ' << frame.height << "\n255\n";
+            file.write(reinterpret_cast<const char*>(pixels.data()),
+                       pixels.size());
+        });
+    std::cout << "Capturing frames to " << dir << std::endl;
+}
+
+void Application::captureRaw(const std::filesystem::path& path) {
+    // Shared so the consumer, owned by the context, keeps the stream open
+    auto file = std::make_shared<std::ofstream>(path, std::ios::binary);
+    if (!*file) {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+    m_context.captureFrames(
+        [file, pixels = std::vector<uint8_t>{}](
+            const CapturedFrame& frame) mutable {
+            toRGB(frame, pixels, true);
+            file->write(reinterpret_cast<const char*>(pixels.data()),
+                        pixels.size());
+        });
+    std::cout << "Capturing " << m_extent.width << 'x' << m_extent.height
+              << " RGBA frames to " << path << std::endl;
+}
+
+void Application::reportZones(uint32_t frames) {
+    auto& profiler = Profiler::instance();
+    std::vector<std::pair<std::string_view, ZoneStats>> zones{
+        profiler.stats().begin(), profiler.stats().end()};
+    std::sort(zones.begin(), zones.end(), [](const auto& a, const auto& b) {
+        return a.second.total_ms > b.second.total_ms;
+    });
+    for (const auto& [name, stats] : zones) {
+        std::cout << "  " << name << ": " << stats.total_ms / frames
+                  << " ms per frame, " << stats.count << " calls, max "
+                  << stats.max_ms << " ms" << std::endl;
+    }
+    profiler.resetStats();
+}
+
+void Application::reportStatistics() {
+    auto print = [](const std::string& name, const PipelineCounters& counters) {
+        std::cout << "  " << name << ": " << counters.vertex_invocations
+                  << " vertices, " << counters.clipping_invocations
+                  << " primitives clipped to " << counters.clipping_primitives
+                  << ", "
+                  << counters.fragment_invocations << " fragments"
+                  << std::endl;
+    };
+    const auto& statistics = m_context.frameStatistics();
+    print("frame", statistics.frame);
+    for (const auto& [pass, counters] : statistics.passes) {
+        print(pass, counters);
+    }
+    for (const auto& [name, pipeline] : m_pipelines) {
+        print("pipeline " + name, m_context.pipelineCounters(pipeline));
+    }
+}
+
+void Application::reportCalls() {
+    const auto& stats = m_context.callStats();
+    std::cout << "  " << stats.commands() << " commands, "
+              << stats[VulkanCall::vkQueueSubmit] << " submits, "
+              << stats[VulkanCall::vkWaitForFences] << " fence waits"
+              << std::endl;
+    for (auto call : magic_enum::enum_values<VulkanCall>()) {
+        if (stats[call] > 0) {
+            std::cout << "    " << magic_enum::enum_name(call) << ": "
+                      << stats[call] << std::endl;
+        }
+    }
+}
+
+void Application::finishStartup() {
+    auto& timeline = StartupTimeline::instance();
+    if (!timeline.recording()) {
+        return;
+    }
+    timeline.firstFrame();
+    std::cout << "Time to first frame: " << timeline.firstFrameMs().value()
+              << " ms" << std::endl;
+    if (m_startup_report.has_value()) {
+        std::ofstream file{m_startup_report.value()};
+        timeline.writeJson(file);
+    }
+}
+
+void Application::writeMemoryReport() {
+    if (!m_memory_report.has_value()) {
+        return;
+    }
+    std::ofstream file{m_memory_report.value()};
+    m_context.reportMemory(file);
+    std::cout << "Memory report written to " << m_memory_report.value()
+              << std::endl;
+}
+
+void Application::runBenchmark(uint32_t instances, uint32_t frames) {
+    // Sorted so the grid does not depend on the hash map order
+    std::vector<std::pair<std::string, ModelHandle>> models{m_models.begin(),
+                                                            m_models.end()};
+    std::sort(models.begin(), models.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    auto pipeline = m_pipelines.begin()->second;
+
+    constexpr float SPACING{4.0f};
+    auto side = static_cast<uint32_t>(std::ceil(std::sqrt(instances)));
+    float extent = (side - 1) * SPACING;
+    glm::vec3 center{extent / 2.0f, extent / 2.0f, 0.0f};
+    float radius = extent * 0.75f + 30.0f;
+
+    std::vector<float> cpu_ms{};
+    std::vector<float> gpu_ms{};
+    std::vector<float> frame_ms{};
+    cpu_ms.reserve(frames);
+    gpu_ms.reserve(frames);
+    frame_ms.reserve(frames);
+
+    std::cout << "Benchmark: " << instances << " instances of "
+              << models.size() << " models, " << frames << " frames"
+              << std::endl;
+    for (uint32_t frame{0}; frame < BENCHMARK_WARMUP_FRAMES + frames;
+         frame++) {
+        if (!m_running) {
+            break;
+        }
+        SCOPE("frame");
+        m_context.waitForFrame();
+
+        // One orbit of the grid over the measured frames
+        float orbit = glm::radians(360.0f * frame / std::max(frames, 1u));
+        glm::vec3 eye = center + glm::vec3{radius * std::cos(orbit),
+                                           radius * std::sin(orbit),
+                                           radius * 0.6f};
+        glm::mat4 view =
+            glm::lookAt(eye, center, glm::vec3{0.0f, 0.0f, 1.0f});
+        float aspect = static_cast<float>(m_extent.width) / m_extent.height;
+        glm::mat4 proj = glm::perspective(glm::radians(60.0f), aspect, 0.1f,
+                                          radius * 4.0f);
+
+        if (m_window.has_value()) {
+            m_window->poolEvents();
+        }
+        if (!m_context.beginFrame(proj * view)) {
+            continue;
+        }
+        m_context.bindPipeline(pipeline);
+        for (uint32_t i{0}; i < instances; i++) {
+            float angle = glm::radians(frame * 1.0f + i * 7.0f);
+            glm::mat4 transform = glm::rotate(
+                glm::translate(glm::mat4{1.0f},
+                               glm::vec3{(i % side) * SPACING,
+                                         (i / side) * SPACING, 0.0f}),
+                angle, glm::vec3{0.0f, 0.0f, 1.0f});
+            m_context.draw(models[i % models.size()].second, transform);
+        }
+        m_context.endFrame();
+        finishStartup();
+        // Read after endFrame so the samples belong to this frame
+        if (frame >= BENCHMARK_WARMUP_FRAMES) {
+            const auto& timings = m_context.frameTimings();
+            cpu_ms.push_back(timings.cpu_ms);
+            gpu_ms.push_back(timings.gpu_ms);
+            frame_ms.push_back(timings.present_interval_ms);
+        }
+    }
+
+    const auto& counts = m_context.drawCounts();
+    auto report = [](const char* name, const std::vector<float>& samples) {
+        std::cout << "  " << name << " ms: p50 " << percentile(samples, 0.5f)
+                  << ", p95 " << percentile(samples, 0.95f) << ", p99 "
+                  << percentile(samples, 0.99f) << ", max "
+                  << percentile(samples, 1.0f) << std::endl;
+    };
+    std::cout << "Benchmark results over " << cpu_ms.size() << " frames, "
+              << counts.draws << " draws and " << counts.triangles
+              << " triangles per frame:" << std::endl;
+    report("CPU", cpu_ms);
+    report("GPU", gpu_ms);
+    report("frame", frame_ms);
+    if (m_report_calls) {
+        reportCalls();
+    }
+}
+
 void Application::run() {
+    if (m_benchmark.has_value()) {
+        runBenchmark(m_benchmark.value(),
+                     m_frame_limit.value_or(BENCHMARK_FRAMES));
+        writeMemoryReport();
+        return;
+    }
+
     glm::mat4 view =
         glm::lookAt(glm::vec3{30.0f, 30.0f, 30.0f}, glm::vec3{0.0f, 0.0f, 0.0f},
                     glm::vec3{0.0f, 0.0f, 1.0f});
-    glm::mat4 proj =
-        glm::perspective(glm::radians(60.0f), m_window.aspect(), 0.1f, 100.0f);
-    glm::mat4 proj_view = proj * view;
 
     float angle{0.0f};
     float rotation_speed{15.0f};
@@ -22,24 +257,82 @@ void Application::run() {
 
     std::chrono::steady_clock clock{};
     auto last_time = clock.now();
+    float report_time{0.0f};
+    uint32_t report_frames{0};
+    FrameTimings report_timings{};
 
     auto model = m_models.begin()->second;
     auto pipeline = m_pipelines.begin()->second;
+    uint32_t frames{0};
     while (m_running) {
+        if (m_frame_limit.has_value() && frames++ >= m_frame_limit.value()) {
+            break;
+        }
+        SCOPE("frame");
+        m_context.waitForFrame();
         auto current_time = clock.now();
         float d_time =
             std::chrono::duration<float>(current_time - last_time).count();
         last_time = current_time;
 
+        const auto& timings = m_context.frameTimings();
+        report_time += d_time;
+        report_frames++;
+        report_timings.cpu_ms += timings.cpu_ms;
+        report_timings.gpu_ms += timings.gpu_ms;
+        report_timings.present_interval_ms += timings.present_interval_ms;
+        if (report_time >= 1.0f) {
+            std::cout << "Frame time: " << report_time * 1000.0f / report_frames
+                      << " ms, CPU " << report_timings.cpu_ms / report_frames
+                      << " ms, GPU " << report_timings.gpu_ms / report_frames
+                      << " ms, present interval "
+                      << report_timings.present_interval_ms / report_frames
+                      << " ms (depth prepass "
+                      << (m_context.depthPrepass() ? "on" : "off") << ")"
+                      << std::endl;
+            if (m_context.gpuProfiling()) {
+                for (const auto& scope : m_context.gpuScopes()) {
+                    std::cout << std::string(2 + scope.depth * 2, ' ')
+                              << scope.name << ": " << scope.duration_ms
+                              << " ms" << std::endl;
+                }
+            }
+            if (m_context.pipelineStatistics()) {
+                reportStatistics();
+            }
+            if (m_report_zones) {
+                reportZones(report_frames);
+            }
+            if (m_report_calls) {
+                reportCalls();
+            }
+            report_time = 0.0f;
+            report_frames = 0;
+            report_timings = {};
+        }
+
         angle += rotation_speed * d_time;
         glm::mat4 model_transform =
             glm::rotate(glm::mat4{1.0f}, glm::radians(angle), rotation_axis);
 
-        m_window.poolEvents();
-        m_context.beginFrame(proj_view);
-        m_context.bindPipeline(pipeline);
-        m_context.draw(model, model_transform);
-        m_context.endFrame();
+        float aspect = m_window.has_value()
+                           ? m_window->aspect()
+                           : static_cast<float>(m_extent.width) /
+                                 m_extent.height;
+        glm::mat4 proj =
+            glm::perspective(glm::radians(60.0f), aspect, 0.1f, 100.0f);
+        glm::mat4 proj_view = proj * view;
+
+        if (m_window.has_value()) {
+            m_window->poolEvents();
+        }
+        if (m_context.beginFrame(proj_view)) {
+            m_context.bindPipeline(pipeline);
+            m_context.draw(model, model_transform);
+            m_context.endFrame();
+            finishStartup();
+        }
     }
+    writeMemoryReport();
 }
 }  // namespace vks
\ No newline at end of file
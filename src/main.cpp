@@ -1,12 +1,65 @@
+#include <algorithm>
 #include <iostream>
 
 #include "app.h"
 
 using namespace std::string_literals;
 
-int main() {
+int main(int argc, char** argv) {
     try {
-        vks::Application app{1024, 786, "vulkan_sandbox"s, "shaders/diffuse"s};
+        bool headless = std::any_of(argv + 1, argv + argc, [](const char* arg) {
+            return arg == "--headless"s;
+        });
+        bool tearing = std::any_of(argv + 1, argv + argc, [](const char* arg) {
+            return arg == "--tearing"s;
+        });
+        vks::Application app{1024, 786, "vulkan_sandbox"s, "shaders/diffuse"s,
+                             headless};
+        for (int i{1}; i < argc; i++) {
+            if (argv[i] == "--watch-shaders"s) {
+                // The source root is optional, a following flag is not one
+                bool has_root = i + 1 < argc && argv[i + 1][0] != '-';
+                app.watchShaders(has_root ? argv[++i] : "shaders/source");
+            } else if (argv[i] == "--depth-prepass"s) {
+                app.setDepthPrepass(true);
+            } else if (argv[i] == "--occlusion-culling"s) {
+                app.setOcclusionCulling(true);
+            } else if (argv[i] == "--gpu-profile"s) {
+                app.setGpuProfiling(true);
+            } else if (argv[i] == "--pipeline-stats"s) {
+                app.setPipelineStatistics(true);
+            } else if (argv[i] == "--cpu-profile"s) {
+                app.setZoneReport(true);
+            } else if (argv[i] == "--call-stats"s) {
+                app.setCallReport(true);
+            } else if (argv[i] == "--startup-report"s && i + 1 < argc) {
+                app.setStartupReport(argv[++i]);
+            } else if (argv[i] == "--memory-report"s && i + 1 < argc) {
+                app.setMemoryReport(argv[++i]);
+            } else if (argv[i] == "--trace"s && i + 1 < argc) {
+                app.traceTo(argv[++i]);
+            } else if (argv[i] == "--msaa"s && i + 1 < argc) {
+                app.setSampleCount(std::stoul(argv[++i]));
+            } else if (argv[i] == "--benchmark"s && i + 1 < argc) {
+                app.setBenchmark(std::stoul(argv[++i]));
+            } else if (argv[i] == "--frames"s && i + 1 < argc) {
+                app.setFrameLimit(std::stoul(argv[++i]));
+            } else if (argv[i] == "--latency"s && i + 1 < argc) {
+                auto mode = magic_enum::enum_cast<vks::LatencyMode>(argv[++i]);
+                if (!mode.has_value()) {
+                    throw std::runtime_error(
+                        "Latency mode must be Balanced, LowLatency, Smooth "
+                        "or Throughput");
+                }
+                app.setLatencyMode(mode.value(), tearing);
+            } else if (argv[i] == "--fps-limit"s && i + 1 < argc) {
+                app.setFrameRateLimit(std::stof(argv[++i]));
+            } else if (argv[i] == "--capture"s && i + 1 < argc) {
+                app.captureImages(argv[++i]);
+            } else if (argv[i] == "--capture-raw"s && i + 1 < argc) {
+                app.captureRaw(argv[++i]);
+            }
+        }
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,114 @@
+#include "profiler.h"
+
+#include <algorithm>
+
+namespace vks {
+
+// Shorter spans calibrate the tick rate too coarsely
+constexpr std::chrono::milliseconds MIN_CALIBRATION{1};
+
+Profiler& Profiler::instance() {
+    static Profiler profiler{};
+    return profiler;
+}
+
+Profiler::Profiler()
+    : m_anchor_ticks{now()},
+      m_anchor_time{Clock::now()},
+      m_ns_per_tick{std::chrono::duration<double, std::nano>(
+                        Clock::duration{1})
+                        .count()},
+      m_trace{nullptr},
+      m_named_rings{0},
+      m_dropped{0} {}
+
+Profiler::ThreadRing& Profiler::registerThread() {
+    std::lock_guard<std::mutex> lock{m_registry_mutex};
+    // Rings outlive their threads, the collector may still be draining,
+    // so short lived workers reuse them rather than adding one each
+    for (auto& ring : m_rings) {
+        if (ring->m_released.load(std::memory_order_acquire) &&
+            ring->m_head.load(std::memory_order_relaxed) ==
+                ring->m_tail.load(std::memory_order_relaxed)) {
+            ring->m_released.store(false, std::memory_order_relaxed);
+            ring->depth = 0;
+            ring->m_name.clear();
+            return *ring;
+        }
+    }
+    m_rings.emplace_back(
+        new ThreadRing{static_cast<uint32_t>(m_rings.size() + 1)});
+    return *m_rings.back();
+}
+
+void Profiler::nameThread(const std::string& name) {
+    auto& ring = threadRing();
+    std::lock_guard<std::mutex> lock{m_registry_mutex};
+    ring.m_name = name;
+}
+
+void Profiler::setTrace(TraceWriter* trace) {
+    m_trace = trace;
+    m_named_rings = 0;
+}
+
+void Profiler::collect() {
+    calibrate();
+    std::lock_guard<std::mutex> lock{m_registry_mutex};
+    if (m_trace != nullptr) {
+        nameTracks();
+    }
+    for (auto& ring : m_rings) {
+        auto tail = ring->m_tail.load(std::memory_order_relaxed);
+        auto head = ring->m_head.load(std::memory_order_acquire);
+        for (; tail < head; tail++) {
+            const auto& zone = ring->m_zones[tail % ThreadRing::CAPACITY];
+            auto start = toTime(zone.start);
+            auto end = toTime(zone.end);
+            float ms = std::chrono::duration<float, std::milli>(end - start)
+                           .count();
+            auto& stats = m_stats[zone.name];
+            stats.count++;
+            stats.total_ms += ms;
+            stats.max_ms = std::max(stats.max_ms, ms);
+            if (m_trace != nullptr) {
+                m_trace->event(zone.name, TraceWriter::Process::Cpu,
+                               ring->m_id, start, end);
+            }
+        }
+        ring->m_tail.store(head, std::memory_order_release);
+        m_dropped += ring->m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+}
+
+void Profiler::calibrate() {
+    auto ticks = now();
+    auto time = Clock::now();
+    auto elapsed = time - m_anchor_time;
+    if (elapsed >= MIN_CALIBRATION && ticks > m_anchor_ticks) {
+        m_ns_per_tick =
+            std::chrono::duration<double, std::nano>(elapsed).count() /
+            static_cast<double>(ticks - m_anchor_ticks);
+    }
+}
+
+Profiler::Clock::time_point Profiler::toTime(uint64_t ticks) const {
+    auto offset = static_cast<double>(static_cast<int64_t>(ticks -
+                                                           m_anchor_ticks)) *
+                  m_ns_per_tick;
+    return m_anchor_time + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double, std::nano>(
+                                   offset));
+}
+
+void Profiler::nameTracks() {
+    for (; m_named_rings < m_rings.size(); m_named_rings++) {
+        const auto& ring = m_rings[m_named_rings];
+        m_trace->nameTrack(TraceWriter::Process::Cpu, ring->m_id,
+                           ring->m_name.empty()
+                               ? "thread " + std::to_string(ring->m_id)
+                               : ring->m_name);
+    }
+}
+
+}  // namespace vks
@@ -9,16 +9,23 @@
 #include <stdexcept>
 #include <unordered_set>
 
+#include "profiler.h"
+#include "startup.h"
+
 using namespace std::string_literals;
 
 namespace vks {
 void Model::load(const std::filesystem::path& filepath, Resources& resources) {
+    SCOPE("Model::load");
     auto root_path = filepath.parent_path();
     tinyobj::ObjReaderConfig config{};
     config.triangulate = true;
     tinyobj::ObjReader reader{};
 
-    if (!reader.ParseFromFile(filepath.string(), config)) {
+    bool parsed = timePhase("parse", [&]() {
+        return reader.ParseFromFile(filepath.string(), config);
+    });
+    if (!parsed) {
         std::string error_message{"failed to load model at path: " +
                                   filepath.string()};
         if (!reader.Error().empty()) {
@@ -136,6 +143,7 @@ Material::Material(const std::filesystem::path& texture_root,
 };
 
 Texture::Texture(const std::filesystem::path& filepath) {
+    StartupPhase phase{"decode"};
     int width{}, height{}, comp{};
     stbi_set_flip_vertically_on_load(true);
     auto* image_data =
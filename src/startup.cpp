@@ -0,0 +1,78 @@
+#include "startup.h"
+
+#include <iomanip>
+
+namespace vks {
+
+namespace {
+// Taken during static initialization, as close to process start as the
+// application gets without platform specific calls
+const StartupTimeline::Clock::time_point PROCESS_START{
+    StartupTimeline::Clock::now()};
+
+thread_local uint32_t t_depth{0};
+
+float msSince(StartupTimeline::Clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(
+               StartupTimeline::Clock::now() - start)
+        .count();
+}
+}  // namespace
+
+StartupTimeline& StartupTimeline::instance() {
+    static StartupTimeline timeline{};
+    return timeline;
+}
+
+StartupTimeline::StartupTimeline()
+    : m_start{PROCESS_START}, m_finished{false} {}
+
+std::optional<size_t> StartupTimeline::begin(const char* name) {
+    if (!recording()) {
+        return std::nullopt;
+    }
+    std::lock_guard lock{m_mutex};
+    m_phases.push_back({name, t_depth++, msSince(m_start), 0.0f});
+    return m_phases.size() - 1;
+}
+
+void StartupTimeline::end(size_t phase) {
+    std::lock_guard lock{m_mutex};
+    auto& item = m_phases[phase];
+    item.duration_ms = msSince(m_start) - item.start_ms;
+    t_depth--;
+}
+
+void StartupTimeline::firstFrame() {
+    if (m_finished.exchange(true)) {
+        return;
+    }
+    std::lock_guard lock{m_mutex};
+    m_first_frame_ms = msSince(m_start);
+}
+
+std::vector<StartupTimeline::Phase> StartupTimeline::phases() const {
+    std::lock_guard lock{m_mutex};
+    return m_phases;
+}
+
+void StartupTimeline::writeJson(std::ostream& out) const {
+    std::lock_guard lock{m_mutex};
+    out << std::fixed << std::setprecision(3) << "{\n  \"phases\": [";
+    for (size_t i{0}; i < m_phases.size(); i++) {
+        const auto& phase = m_phases[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << phase.name
+            << "\", \"depth\": " << phase.depth
+            << ", \"start_ms\": " << phase.start_ms
+            << ", \"duration_ms\": " << phase.duration_ms << '}';
+    }
+    out << "\n  ],\n  \"first_frame_ms\": ";
+    if (m_first_frame_ms.has_value()) {
+        out << m_first_frame_ms.value();
+    } else {
+        out << "null";
+    }
+    out << "\n}\n";
+}
+
+}  // namespace vks
@@ -0,0 +1,63 @@
+#include "trace.h"
+
+#include <iomanip>
+#include <stdexcept>
+
+namespace vks {
+
+TraceWriter::TraceWriter(const std::filesystem::path& path)
+    : m_file{path}, m_epoch{Clock::now()}, m_first{true} {
+    if (!m_file) {
+        throw std::runtime_error("Failed to open trace file " +
+                                 path.string());
+    }
+    m_file << std::fixed << std::setprecision(3)
+           << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    metadata("process_name", Process::Cpu, 0, "CPU");
+    metadata("process_name", Process::Gpu, 0, "GPU");
+}
+
+TraceWriter::~TraceWriter() { m_file << "\n]}\n"; }
+
+void TraceWriter::nameTrack(Process process, uint32_t thread,
+                            const std::string& name) {
+    metadata("thread_name", process, thread, name);
+}
+
+void TraceWriter::event(const std::string& name, Process process,
+                        uint32_t thread, Clock::time_point start,
+                        Clock::time_point end) {
+    using Micros = std::chrono::duration<double, std::micro>;
+    separator();
+    m_file << "{\"ph\":\"X\",\"pid\":" << static_cast<uint32_t>(process)
+           << ",\"tid\":" << thread << ",\"name\":\"" << escape(name)
+           << "\",\"ts\":" << Micros(start - m_epoch).count()
+           << ",\"dur\":" << Micros(end - start).count() << "}";
+}
+
+void TraceWriter::metadata(const char* kind, Process process,
+                           uint32_t thread, const std::string& name) {
+    separator();
+    m_file << "{\"ph\":\"M\",\"pid\":" << static_cast<uint32_t>(process)
+           << ",\"tid\":" << thread << ",\"name\":\"" << kind
+           << "\",\"args\":{\"name\":\"" << escape(name) << "\"}}";
+}
+
+void TraceWriter::separator() {
+    m_file << (m_first ? "\n" : ",\n");
+    m_first = false;
+}
+
+std::string TraceWriter::escape(const std::string& text) {
+    std::string escaped{};
+    escaped.reserve(text.size());
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c < 0x20 ? ' ' : c);
+    }
+    return escaped;
+}
+
+}  // namespace vks
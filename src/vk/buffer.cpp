@@ -1,12 +1,15 @@
 #include "vk/buffer.h"
 
+#include <chrono>
 #include <cstring>
 
 #include "vk/context.h"
+#include "vk/gpu_profiler.h"
 
 namespace vks {
-StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size)
-    : device{device}, m_size{size} {
+StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size,
+                             GpuProfiler* profiler)
+    : device{device}, m_profiler{profiler}, m_size{size} {
     VkBufferCreateInfo buffer_info{};
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_info.queueFamilyIndexCount = 1;
@@ -14,8 +17,9 @@ StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size)
     buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     buffer_info.size = m_size;
     buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    if (vkCreateBuffer(*device, &buffer_info, nullptr, &m_buffer) !=
-        VK_SUCCESS) {
+    if (vkCreateBuffer(*device, &buffer_info,
+                       device.allocator(HostObject::Buffer),
+                       &m_buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create staging buffer");
     }
     VkMemoryRequirements requirements{};
@@ -26,7 +30,7 @@ StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size)
     alloc_info.memoryTypeIndex = device.getMemoryIndex(
         requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    if (vkAllocateMemory(*device, &alloc_info, nullptr, &m_memory) !=
+    if (device.allocateMemory(alloc_info, "staging buffer", &m_memory) !=
         VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate staging buffer memory");
     }
@@ -37,8 +41,9 @@ StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size)
     pool_info.queueFamilyIndex = device.info().queue_families.transfer;
     pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-    if (vkCreateCommandPool(*device, &pool_info, nullptr, &m_pool) !=
-        VK_SUCCESS) {
+    if (vkCreateCommandPool(*device, &pool_info,
+                            device.allocator(HostObject::CommandPool),
+                            &m_pool) != VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to create staging buffer transfer command pool");
     }
@@ -46,17 +51,18 @@ StagingBuffer::StagingBuffer(Device& device, VkDeviceSize size)
     VkFenceCreateInfo fence_info{};
     fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-    if (vkCreateFence(*device, &fence_info, nullptr, &m_copy_fence) !=
-        VK_SUCCESS) {
+    if (vkCreateFence(*device, &fence_info, device.allocator(HostObject::Fence),
+                      &m_copy_fence) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create staging buffer fence");
     };
 };
 
 StagingBuffer::~StagingBuffer() {
-    vkDestroyBuffer(*device, m_buffer, nullptr);
-    vkFreeMemory(*device, m_memory, nullptr);
-    vkDestroyFence(*device, m_copy_fence, nullptr);
-    vkDestroyCommandPool(*device, m_pool, nullptr);
+    vkDestroyBuffer(*device, m_buffer, device.allocator(HostObject::Buffer));
+    device.freeMemory(m_memory);
+    vkDestroyFence(*device, m_copy_fence, device.allocator(HostObject::Fence));
+    vkDestroyCommandPool(*device, m_pool,
+                         device.allocator(HostObject::CommandPool));
 }
 
 VkCommandBuffer StagingBuffer::beginTransferCommand() {
@@ -83,7 +89,8 @@ VkCommandBuffer StagingBuffer::beginTransferCommand() {
     return command;
 }
 
-void StagingBuffer::endTransferCommand(VkCommandBuffer command) {
+void StagingBuffer::endTransferCommand(VkCommandBuffer command,
+                                       const char* name) {
     if (vkEndCommandBuffer(command) != VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to record staging buffer transfer command");
@@ -92,12 +99,16 @@ void StagingBuffer::endTransferCommand(VkCommandBuffer command) {
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command;
-    if (vkQueueSubmit(device.queues.transfer, 1, &submit_info, m_copy_fence) !=
-        VK_SUCCESS) {
+    auto submitted = std::chrono::steady_clock::now();
+    if (VK_CALL(vkQueueSubmit)(device.queues.transfer, 1, &submit_info,
+                               m_copy_fence) != VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to submit staging buffer transfer command");
     }
     waitFence();
+    if (m_profiler != nullptr) {
+        m_profiler->upload(name, submitted, std::chrono::steady_clock::now());
+    }
     vkFreeCommandBuffers(*device, m_pool, 1, &command);
 }
 
@@ -123,9 +134,9 @@ void StagingBuffer::copyBuffer(Buffer& dst, VkDeviceSize offset,
     region.dstOffset = offset;
     region.srcOffset = 0;
     region.size = size;
-    vkCmdCopyBuffer(command, m_buffer, *dst, 1, &region);
+    VK_CALL(vkCmdCopyBuffer)(command, m_buffer, *dst, 1, &region);
 
-    endTransferCommand(command);
+    endTransferCommand(command, "buffer upload");
 }
 void StagingBuffer::copyImage(Image2D& dst, const std::vector<uint8_t>& src) {
     if (src.size() > m_size) {
@@ -156,9 +167,9 @@ void StagingBuffer::copyImage(Image2D& dst, const std::vector<uint8_t>& src) {
     barier.srcAccessMask = 0;
     barier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &barier);
+    VK_CALL(vkCmdPipelineBarrier)(command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                  0, nullptr, 1, &barier);
 
     VkBufferImageCopy region{};
     region.bufferImageHeight = dst.width();
@@ -171,24 +182,25 @@ void StagingBuffer::copyImage(Image2D& dst, const std::vector<uint8_t>& src) {
     region.imageSubresource.baseArrayLayer = 0;
     region.imageSubresource.layerCount = 1;
 
-    vkCmdCopyBufferToImage(command, m_buffer, *dst,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    VK_CALL(vkCmdCopyBufferToImage)(command, m_buffer, *dst,
+                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                                    &region);
 
     barier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     barier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     barier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     barier.dstAccessMask = 0;
 
-    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
-                         nullptr, 1, &barier);
+    VK_CALL(vkCmdPipelineBarrier)(command, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+                                  nullptr, 0, nullptr, 1, &barier);
 
-    endTransferCommand(command);
+    endTransferCommand(command, "image upload");
 }
 
 void StagingBuffer::waitFence() {
-    if (vkWaitForFences(*device, 1, &m_copy_fence, VK_TRUE, UINT64_MAX) !=
-        VK_SUCCESS) {
+    if (VK_CALL(vkWaitForFences)(*device, 1, &m_copy_fence, VK_TRUE,
+                                 UINT64_MAX) != VK_SUCCESS) {
         throw std::runtime_error("Staging buffer fence timeout");
     };
     vkResetFences(*device, 1, &m_copy_fence);
@@ -206,15 +218,17 @@ Buffer::Buffer(Device& device, VkDeviceSize size, VkBufferUsageFlags usage,
     buffer_info.sharingMode = queue_families.size() != 1
                                   ? VK_SHARING_MODE_CONCURRENT
                                   : VK_SHARING_MODE_EXCLUSIVE;
-    if (vkCreateBuffer(*device, &buffer_info, nullptr, &m_buffer) !=
-        VK_SUCCESS) {
+    if (vkCreateBuffer(*device, &buffer_info,
+                       device.allocator(HostObject::Buffer),
+                       &m_buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create buffer");
     }
 }
 
 Buffer::~Buffer() {
     if (m_buffer != VK_NULL_HANDLE) {
-        vkDestroyBuffer(*device, m_buffer, nullptr);
+        vkDestroyBuffer(*device, m_buffer,
+                        device.allocator(HostObject::Buffer));
     }
 }
 
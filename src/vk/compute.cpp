@@ -0,0 +1,224 @@
+#include "vk/compute.h"
+
+#include <stdexcept>
+
+namespace vks {
+
+StorageBuffer::StorageBuffer(Device& device, VkDeviceSize size,
+                             VkBufferUsageFlags usage)
+    : device{device},
+      m_buffer{device, size,
+               usage | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               device.getQueueIndices(VK_QUEUE_GRAPHICS_BIT |
+                                      VK_QUEUE_COMPUTE_BIT |
+                                      VK_QUEUE_TRANSFER_BIT)},
+      m_memory{bindDeviceMemory(device, m_buffer)},
+      m_graphics_serial{0},
+      m_compute_serial{0} {}
+
+StorageBuffer::~StorageBuffer() {
+    if (m_memory != VK_NULL_HANDLE) {
+        device.freeMemory(m_memory);
+    }
+}
+
+VkDeviceMemory StorageBuffer::bindDeviceMemory(Device& device,
+                                               Buffer& buffer) {
+    auto requirements = buffer.memoryRequirements();
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = device.getMemoryIndex(
+        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkDeviceMemory memory;
+    if (device.allocateMemory(alloc_info, "storage buffer", &memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate storage buffer memory");
+    }
+    buffer.bindMemory(memory, 0);
+    return memory;
+}
+
+StorageImage::StorageImage(Device& device, uint32_t width, uint32_t height,
+                           VkFormat format)
+    : device{device},
+      m_image{device,
+              width,
+              height,
+              format,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+              device.getQueueIndices(VK_QUEUE_GRAPHICS_BIT |
+                                     VK_QUEUE_COMPUTE_BIT |
+                                     VK_QUEUE_TRANSFER_BIT)},
+      m_memory{bindDeviceMemory(device, m_image)},
+      m_view{device, m_image, VK_IMAGE_ASPECT_COLOR_BIT} {}
+
+StorageImage::~StorageImage() {
+    if (m_memory != VK_NULL_HANDLE) {
+        device.freeMemory(m_memory);
+    }
+}
+
+VkDeviceMemory StorageImage::bindDeviceMemory(Device& device,
+                                              Image2D& image) {
+    auto requirements = image.memoryRequirements();
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = device.getMemoryIndex(
+        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkDeviceMemory memory;
+    if (device.allocateMemory(alloc_info, "storage image", &memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate storage image memory");
+    }
+    image.bindMemory(memory, 0);
+    return memory;
+}
+
+ComputeQueue::ComputeQueue(Device& device) : device{device}, m_serial{0} {
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = device.info().queue_families.compute;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    if (vkCreateCommandPool(*device, &pool_info,
+                            device.allocator(HostObject::CommandPool),
+                            &m_pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute command pool");
+    }
+
+    std::array<VkCommandBuffer, SUBMISSION_COUNT> commands{};
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = m_pool;
+    alloc_info.commandBufferCount = commands.size();
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    if (vkAllocateCommandBuffers(*device, &alloc_info, commands.data()) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate compute command buffers");
+    }
+
+    VkFenceCreateInfo fence_info{};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (size_t i{0}; i < SUBMISSION_COUNT; i++) {
+        auto& submission = m_submissions[i];
+        submission = {commands[i], VK_NULL_HANDLE, VK_NULL_HANDLE, 0, 0,
+                      false, false};
+        if (vkCreateFence(*device, &fence_info,
+                          device.allocator(HostObject::Fence),
+                          &submission.fence) != VK_SUCCESS ||
+            vkCreateSemaphore(*device, &semaphore_info,
+                              device.allocator(HostObject::Semaphore),
+                              &submission.signal) != VK_SUCCESS) {
+            throw std::runtime_error(
+                "Failed to create compute synchronization primitives");
+        }
+    }
+}
+
+ComputeQueue::~ComputeQueue() {
+    for (auto& submission : m_submissions) {
+        retire(submission);
+        vkDestroyFence(*device, submission.fence,
+                       device.allocator(HostObject::Fence));
+        vkDestroySemaphore(*device, submission.signal,
+                           device.allocator(HostObject::Semaphore));
+    }
+    vkDestroyCommandPool(*device, m_pool,
+                         device.allocator(HostObject::CommandPool));
+}
+
+void ComputeQueue::retire(Submission& submission) {
+    if (!submission.in_flight) {
+        return;
+    }
+    if (VK_CALL(vkWaitForFences)(*device, 1, &submission.fence, VK_TRUE,
+                                 UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Compute fence timeout");
+    }
+    vkResetFences(*device, 1, &submission.fence);
+    submission.in_flight = false;
+}
+
+VkCommandBuffer ComputeQueue::begin() {
+    auto& submission = next();
+    retire(submission);
+    // A signal nobody waited on can not be signaled again, the finished
+    // submission allows replacing the semaphore instead
+    if (submission.signal_pending) {
+        vkDestroySemaphore(*device, submission.signal,
+                           device.allocator(HostObject::Semaphore));
+        VkSemaphoreCreateInfo semaphore_info{};
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        if (vkCreateSemaphore(*device, &semaphore_info,
+                              device.allocator(HostObject::Semaphore),
+                              &submission.signal) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create compute semaphore");
+        }
+        submission.signal_pending = false;
+    }
+
+    vkResetCommandBuffer(submission.command, 0);
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(submission.command, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording compute commands");
+    }
+    return submission.command;
+}
+
+uint64_t ComputeQueue::submit(bool signal_graphics) {
+    auto& submission = next();
+    if (vkEndCommandBuffer(submission.command) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record compute commands");
+    }
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &submission.command;
+    if (signal_graphics) {
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &submission.signal;
+    }
+    if (VK_CALL(vkQueueSubmit)(device.queues.compute, 1, &submit_info,
+                               submission.fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit compute commands");
+    }
+    submission.serial = ++m_serial;
+    submission.in_flight = true;
+    submission.signal_pending = signal_graphics;
+    return submission.serial;
+}
+
+void ComputeQueue::wait(uint64_t serial) {
+    for (auto& submission : m_submissions) {
+        if (submission.serial == serial) {
+            retire(submission);
+        }
+    }
+}
+
+std::vector<VkSemaphore> ComputeQueue::takeSignals(uint64_t graphics_serial) {
+    std::vector<VkSemaphore> signals{};
+    for (auto& submission : m_submissions) {
+        if (submission.signal_pending) {
+            signals.push_back(submission.signal);
+            submission.consumer_serial = graphics_serial;
+            submission.signal_pending = false;
+        }
+    }
+    return signals;
+}
+
+}  // namespace vks
@@ -1,26 +1,101 @@
 #include "vk/context.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <unordered_set>
 
+#include "embedded_shaders.h"
+#include "profiler.h"
+#include "startup.h"
 #include "vk/buffer.h"
 
 using namespace magic_enum;
+using namespace std::string_literals;
 
 namespace vks {
 
+// Cuts [offset, offset + size) at the reflected range bounds, so that each
+// push flags exactly the stages whose range covers all of its bytes
+static void splitPushRange(const std::vector<VkPushConstantRange>& ranges,
+                           uint32_t offset, uint32_t size,
+                           std::vector<VkPushConstantRange>& pushes) {
+    pushes.clear();
+    for (uint32_t end{offset + size}; offset < end;) {
+        uint32_t next{end};
+        VkShaderStageFlags stages{0};
+        for (const auto& range : ranges) {
+            if (range.offset > offset) {
+                next = std::min(next, range.offset);
+            } else if (range.offset + range.size > offset) {
+                next = std::min(next, range.offset + range.size);
+                stages |= range.stageFlags;
+            }
+        }
+        if (stages) {
+            pushes.push_back({stages, offset, next - offset});
+        }
+        offset = next;
+    }
+}
+
+constexpr uint32_t STORAGE_POOL_SETS{64};
+constexpr uint32_t STORAGE_POOL_DESCRIPTORS{STORAGE_POOL_SETS * 4};
+
+// Stages which may consume compute results within a frame
+constexpr VkPipelineStageFlags COMPUTE_CONSUMER_STAGES{
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT};
+
 Context::Context(Device& device)
     : device{device},
-      m_render_pass{device},
-      m_swapchain{device, m_render_pass} {
+      m_render_pass{device, VK_SAMPLE_COUNT_1_BIT},
+      m_swapchain{device},
+      m_render_graph{device},
+      m_readback{device},
+      m_pacer{},
+      m_profiler{device},
+      m_gpu_profiling{false},
+      m_statistics{device},
+      m_layout_cache{device},
+      m_compile_running{false},
+      m_pending_compiles{0},
+      m_compile_stats{},
+      m_draw_counts{},
+      m_call_stats{},
+      m_compute_queue{device},
+      m_culler{device, m_layout_cache},
+      m_occlusion_culling{false},
+      m_depth_prepass{false},
+      m_framebuffer_swapchain{VK_NULL_HANDLE} {
     createSamplers();
     createDescriptorLayouts();
-    createPipelineLayout();
 }
 
 Context::~Context() {
-    vkDeviceWaitIdle(*device);
-    vkDestroyPipelineLayout(*device, m_pipeline_layout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, m_material_layout, nullptr);
+    {
+        std::lock_guard<std::mutex> lock{m_compile_mutex};
+        m_compile_running = false;
+    }
+    m_compile_cv.notify_all();
+    if (m_compile_thread.joinable()) {
+        m_compile_thread.join();
+    }
+    m_shader_watcher.reset();
+    VK_CALL(vkDeviceWaitIdle)(*device);
+    m_readback.consume(m_swapchain.m_submit_serial);
+    // The profiler outlives the context and would keep writing the trace
+    stopTrace();
+    for (auto pool : m_storage_pools) {
+        vkDestroyDescriptorPool(*device, pool,
+                                device.allocator(HostObject::DescriptorPool));
+    }
 }
 
 void Context::createSamplers() {
@@ -30,85 +105,801 @@ void Context::createSamplers() {
 }
 
 void Context::createDescriptorLayouts() {
-    m_material_layout = MaterialUniform::descriptorLayout(device);
+    m_material_layout = m_layout_cache.requireSetLayout(
+        0, MaterialUniform::descriptorBindings());
 }
 
-void Context::createPipelineLayout() {
-    VkPipelineLayoutCreateInfo layout_info{};
-    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+PipelineHandle Context::loadPipeline(const std::filesystem::path& dir,
+                                     const PipelineVariant& variant) {
+    return loadPrograms({{pipelineProgram(dir), variant}}).front();
+}
 
-    std::array<VkDescriptorSetLayout, 1> set_layouts{m_material_layout};
+PipelineHandle Context::loadPipeline(ShaderProgram program,
+                                     const PipelineVariant& variant) {
+    return loadPrograms({{pipelineProgram(program), variant}}).front();
+}
 
-    layout_info.setLayoutCount = set_layouts.size();
-    layout_info.pSetLayouts = set_layouts.data();
+std::vector<PipelineHandle> Context::loadPipelines(
+    const std::vector<std::filesystem::path>& dirs) {
+    std::vector<std::pair<PipelineProgram, PipelineVariant>> programs{};
+    programs.reserve(dirs.size());
+    for (const auto& dir : dirs) {
+        programs.emplace_back(pipelineProgram(dir), PipelineVariant{});
+    }
+    return loadPrograms(programs);
+}
 
-    std::array<VkPushConstantRange, 1> push_ranges{};
+std::vector<PipelineHandle> Context::loadPipelines(
+    const std::vector<std::pair<std::filesystem::path, PipelineVariant>>&
+        programs) {
+    std::vector<std::pair<PipelineProgram, PipelineVariant>> sources{};
+    sources.reserve(programs.size());
+    for (const auto& [dir, variant] : programs) {
+        sources.emplace_back(pipelineProgram(dir), variant);
+    }
+    return loadPrograms(sources);
+}
+
+PipelineHandle Context::requestPipeline(const std::filesystem::path& dir,
+                                        const PipelineVariant& variant) {
+    return requestProgram(pipelineProgram(dir), variant);
+}
+
+PipelineHandle Context::requestPipeline(ShaderProgram program,
+                                        const PipelineVariant& variant) {
+    return requestProgram(pipelineProgram(program), variant);
+}
+
+Context::PipelineProgram Context::pipelineProgram(
+    const std::filesystem::path& dir) {
+    return {std::filesystem::absolute(dir).lexically_normal().string(),
+            (dir / "").parent_path().filename().string(),
+            [this, dir](const PipelineVariant& variant) {
+                return GraphicsPipeline{device, m_render_pass, dir,
+                                        m_layout_cache, variant};
+            }};
+}
+
+Context::PipelineProgram Context::pipelineProgram(ShaderProgram program) {
+    const auto& embedded = embeddedProgram(program);
+    return {"embedded:"s + embedded.name, embedded.name,
+            [this, &embedded](const PipelineVariant& variant) {
+                return GraphicsPipeline{
+                    device,
+                    m_render_pass,
+                    GraphicsPipeline::embeddedProgramSource(embedded),
+                    embedded.name,
+                    m_layout_cache,
+                    variant};
+            }};
+}
 
-    push_ranges[0].offset = 0;
-    push_ranges[0].size = 2 * sizeof(glm::mat4);
-    push_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+std::vector<PipelineHandle> Context::loadPrograms(
+    const std::vector<std::pair<PipelineProgram, PipelineVariant>>&
+        programs) {
+    StartupPhase phase{"pipeline compiles"};
+    auto start = std::chrono::steady_clock::now();
 
-    layout_info.pushConstantRangeCount = push_ranges.size();
-    layout_info.pPushConstantRanges = push_ranges.data();
+    // Variants already loaded, or repeated within the batch, share one
+    // pipeline so that only distinct permutations get compiled
+    std::vector<std::string> keys{};
+    std::vector<size_t> pending{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        std::unordered_set<std::string> batch_keys{};
+        for (size_t i{0}; i < programs.size(); i++) {
+            const auto& [program, variant] = programs[i];
+            keys.push_back(variant.key(program.key));
+            if (!m_variant_indices.count(keys[i]) &&
+                batch_keys.insert(keys[i]).second) {
+                pending.push_back(i);
+            }
+        }
+    }
+
+    std::vector<std::optional<GraphicsPipeline>> pipelines(pending.size());
+    std::vector<std::exception_ptr> errors(pending.size());
+    std::atomic<size_t> next{0};
 
-    if (vkCreatePipelineLayout(*device, &layout_info, nullptr,
-                               &m_pipeline_layout) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create graphics pipeline layout");
+    auto worker = [&]() {
+        for (size_t i = next++; i < pending.size(); i = next++) {
+            SCOPE("compile pipeline");
+            const auto& [program, variant] = programs[pending[i]];
+            try {
+                std::shared_lock<std::shared_mutex> lock{m_render_pass_mutex};
+                pipelines[i].emplace(program.build(variant));
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
     };
+
+    size_t thread_count = std::min<size_t>(
+        std::max(std::thread::hardware_concurrency(), 1U), pending.size());
+    if (thread_count > 1) {
+        std::vector<std::thread> threads{};
+        threads.reserve(thread_count);
+        for (size_t i{0}; i < thread_count; i++) {
+            threads.emplace_back(worker);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    } else {
+        worker();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<PipelineHandle> handles{};
+    handles.reserve(programs.size());
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        for (size_t i{0}; i < pending.size(); i++) {
+            const auto& [program, variant] = programs[pending[i]];
+            m_pipelines.emplace_back(std::move(pipelines[i].value()));
+            m_pipeline_programs.push_back(program);
+            m_pipeline_variants.push_back(variant);
+            m_variant_indices.emplace(keys[pending[i]], m_pipelines.size() - 1);
+        }
+        for (const auto& key : keys) {
+            handles.push_back(PipelineHandle{m_variant_indices.at(key)});
+        }
+    }
+
+    auto elapsed = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    for (auto index : pending) {
+        std::cout << "Pipeline: " << programs[index].first.key << '\n';
+    }
+    std::cout << pending.size() << " pipelines created ("
+              << programs.size() - pending.size() << " variants reused) in "
+              << elapsed << " ms on " << std::max<size_t>(thread_count, 1)
+              << " threads ("
+              << (device.m_pipeline_cache_warm ? "warm" : "cold") << " cache)"
+              << std::endl;
+    return handles;
 }
 
-void Context::beginFrame(const glm::mat4& camera) {
-    m_frame_state = m_swapchain.acquireImage();
+PipelineHandle Context::requestProgram(PipelineProgram&& program,
+                                       const PipelineVariant& variant) {
+    auto key = variant.key(program.key);
+    size_t index{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        auto item = m_variant_indices.find(key);
+        if (item != m_variant_indices.end()) {
+            return PipelineHandle{item->second};
+        }
+        m_pipelines.emplace_back(GraphicsPipeline{device});
+        m_pipeline_programs.push_back(program);
+        m_pipeline_variants.push_back(variant);
+        index = m_pipelines.size() - 1;
+        m_variant_indices.emplace(key, index);
+    }
+
+    m_pending_compiles++;
+    {
+        std::lock_guard<std::mutex> lock{m_compile_mutex};
+        // Compiled pipelines are installed through the same path as hot
+        // reloaded ones, at the start of the next frame
+        m_compile_jobs.emplace_back([this, index, variant,
+                                     program = std::move(program)]() {
+            try {
+                std::shared_lock<std::shared_mutex> pass_lock{
+                    m_render_pass_mutex};
+                auto pipeline = program.build(variant);
+                std::lock_guard<std::mutex> lock{m_reload_mutex};
+                m_reloaded_pipelines.emplace_back(index, std::move(pipeline));
+            } catch (const std::exception& e) {
+                auto error = "Failed to compile pipeline "s + program.name +
+                             ": "s + e.what();
+                std::cerr << error << std::endl;
+                std::lock_guard<std::mutex> lock{m_reload_mutex};
+                m_compile_errors.emplace(index, std::move(error));
+            }
+            m_pending_compiles--;
+        });
+        if (!m_compile_running) {
+            m_compile_running = true;
+            m_compile_thread = std::thread{&Context::compileWorker, this};
+        }
+    }
+    m_compile_cv.notify_one();
+    return PipelineHandle{index};
+}
+
+void Context::compileWorker() {
+    Profiler::instance().nameThread("pipeline compiler");
+    while (true) {
+        std::function<void()> job{};
+        {
+            std::unique_lock<std::mutex> lock{m_compile_mutex};
+            m_compile_cv.wait(lock, [this]() {
+                return !m_compile_running || !m_compile_jobs.empty();
+            });
+            if (!m_compile_running) {
+                return;
+            }
+            job = std::move(m_compile_jobs.front());
+            m_compile_jobs.pop_front();
+        }
+        SCOPE("compile pipeline");
+        job();
+    }
+}
+
+void Context::watchShaders(const std::filesystem::path& source_root) {
+    m_shader_watcher = std::make_unique<ShaderWatcher>(
+        source_root, "shader_cache",
+        [this](const std::string& name, const std::filesystem::path& dir) {
+            reloadPipeline(name, dir);
+        });
+}
+
+void Context::reloadPipeline(const std::string& name,
+                             const std::filesystem::path& dir) {
+    std::vector<std::pair<size_t, PipelineVariant>> variants{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        for (size_t i{0}; i < m_pipeline_programs.size(); i++) {
+            if (m_pipeline_programs[i].name == name) {
+                variants.emplace_back(i, m_pipeline_variants[i]);
+            }
+        }
+    }
+
+    std::vector<std::pair<size_t, GraphicsPipeline>> reloaded{};
+    reloaded.reserve(variants.size());
+    std::shared_lock<std::shared_mutex> pass_lock{m_render_pass_mutex};
+    for (const auto& [index, variant] : variants) {
+        reloaded.emplace_back(
+            index, GraphicsPipeline{device, m_render_pass, dir,
+                                    m_layout_cache, variant});
+    }
+
+    std::lock_guard<std::mutex> lock{m_reload_mutex};
+    for (auto& item : reloaded) {
+        m_reloaded_pipelines.emplace_back(std::move(item));
+    }
+}
+
+void Context::setSampleCount(VkSampleCountFlagBits samples) {
+    samples = std::min(samples, device.maxSampleCount());
+    if (samples == m_render_pass.samples()) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> pass_lock{m_render_pass_mutex};
+    VK_CALL(vkDeviceWaitIdle)(*device);
+    m_render_pass.recreate(samples);
+
+    // Pipelines built against the previous pass, including reloads not yet
+    // installed, are rebuilt, placeholders still compiling pick it up later
+    std::vector<std::pair<size_t, PipelineProgram>> programs{};
+    std::vector<PipelineVariant> variants{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        std::unordered_set<size_t> reloaded{};
+        for (const auto& [index, pipeline] : m_reloaded_pipelines) {
+            reloaded.insert(index);
+        }
+        m_reloaded_pipelines.clear();
+        for (size_t i{0}; i < m_pipelines.size(); i++) {
+            if (m_pipelines[i].ready() || reloaded.count(i)) {
+                programs.emplace_back(i, m_pipeline_programs[i]);
+                variants.push_back(m_pipeline_variants[i]);
+            }
+        }
+    }
+    for (size_t i{0}; i < programs.size(); i++) {
+        auto& [index, program] = programs[i];
+        auto pipeline = program.build(variants[i]);
+        std::swap(m_pipelines[index].m_pipeline, pipeline.m_pipeline);
+        std::swap(m_pipelines[index].m_layout, pipeline.m_layout);
+        std::swap(m_pipelines[index].m_push_ranges, pipeline.m_push_ranges);
+    }
+    std::cout << "Sample count: " << samples << ", " << programs.size()
+              << " pipelines rebuilt" << std::endl;
+}
+
+void Context::swapReloadedPipelines() {
+    std::vector<std::pair<size_t, GraphicsPipeline>> reloaded{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        reloaded.swap(m_reloaded_pipelines);
+        for (const auto& [index, pipeline] : reloaded) {
+            m_compile_errors.erase(index);
+        }
+    }
+    // The replaced pipeline may still be referenced by frames in flight,
+    // it is kept until the frame submitted last has retired
+    for (auto& [index, pipeline] : reloaded) {
+        std::swap(m_pipelines[index].m_pipeline, pipeline.m_pipeline);
+        std::swap(m_pipelines[index].m_layout, pipeline.m_layout);
+        std::swap(m_pipelines[index].m_push_ranges, pipeline.m_push_ranges);
+        m_retired_pipelines.emplace_back(m_swapchain.m_submit_serial,
+                                         std::move(pipeline));
+    }
+    while (!m_retired_pipelines.empty() &&
+           m_retired_pipelines.front().first <=
+               m_swapchain.m_completed_serial) {
+        m_retired_pipelines.pop_front();
+    }
+}
+
+bool Context::beginFrame(const glm::mat4& camera) {
+    SCOPE("Context::beginFrame");
+    auto frame_state = m_swapchain.acquireImage();
+    if (!frame_state.has_value()) {
+        return false;
+    }
+    m_frame_state = frame_state.value();
+    if (m_swapchain.m_swapchain != m_framebuffer_swapchain) {
+        m_render_graph.releaseFramebuffers();
+        m_framebuffer_swapchain = m_swapchain.m_swapchain;
+    }
+    swapReloadedPipelines();
+    m_readback.consume(m_swapchain.m_completed_serial);
 
     VkCommandBufferBeginInfo begin_info{};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     vkBeginCommandBuffer(m_frame_state._command, &begin_info);
+    m_profiler.beginFrame(m_frame_state._command, m_frame_state._index);
+    m_pacer.beginFrame(m_profiler.frameMs());
+    m_statistics.beginFrame(m_frame_state._command, m_frame_state._index);
 
-    std::array<VkClearValue, 2> clear{};
-    clear[0].depthStencil = {1.0f, 0};
-    clear[1].color = {0.2f, 0.2f, 0.2f, 1.0f};
-
-    VkRenderPassBeginInfo pass_info{};
-    pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    pass_info.renderPass = *m_render_pass;
-    pass_info.framebuffer = m_frame_state._framebuffer;
-    pass_info.clearValueCount = clear.size();
-    pass_info.pClearValues = clear.data();
-    pass_info.renderArea.extent =
-        device.info().surface_capabilities.currentExtent;
-    pass_info.renderArea.offset = {0U, 0U};
-
-    vkCmdBeginRenderPass(m_frame_state._command, &pass_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdPushConstants(m_frame_state._command, m_pipeline_layout,
-                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4),
-                       glm::value_ptr(camera));
+    m_bound_pipeline.reset();
+    m_draws.clear();
+    m_dispatches.clear();
+    m_compile_stats = {};
+    m_compile_stats.pending = m_pending_compiles;
+    m_camera = camera;
+    return true;
 };
 
+void Context::recordScene(VkCommandBuffer command, bool indirect,
+                          const std::string& pass) {
+    auto extent = m_swapchain.m_extent;
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = static_cast<float>(extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    viewport.height = -static_cast<float>(extent.height);
+    viewport.width = static_cast<float>(extent.width);
+    VK_CALL(vkCmdSetViewport)(command, 0, 1, &viewport);
+
+    VkRect2D scissors{};
+    scissors.extent = extent;
+    scissors.offset = {0, 0};
+    VK_CALL(vkCmdSetScissor)(command, 0, 1, &scissors);
+
+    recordDraws(indirect, pass);
+}
+
 void Context::bindPipeline(PipelineHandle pipeline) {
-    vkCmdBindPipeline(m_frame_state._command, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_pipelines[pipeline.index].m_pipeline);
+    if (!m_pipelines[pipeline.index].ready()) {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        auto error = m_compile_errors.find(pipeline.index);
+        if (error != m_compile_errors.end()) {
+            throw std::runtime_error(error->second);
+        }
+        m_compile_stats.stalls_avoided++;
+    }
+    m_bound_pipeline = pipeline.index;
 }
 
 void Context::draw(ModelHandle model, const glm::mat4& transfrom) {
-    vkCmdPushConstants(m_frame_state._command, m_pipeline_layout,
-                       VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4),
-                       sizeof(glm::mat4), glm::value_ptr(transfrom));
-    m_resource_packs[model.pack].draw(m_frame_state._command, model.index,
-                                      m_pipeline_layout);
+    SCOPE("Context::draw");
+    if (!m_bound_pipeline.has_value()) {
+        throw std::runtime_error("Draw recorded without a bound pipeline");
+    }
+    m_draws.push_back({m_bound_pipeline.value(), model, transfrom});
+}
+
+void Context::resolveDraws() {
+    // Pipelines still compiling are resolved before either pass so that
+    // depth is only laid down for geometry the colour pass shades
+    m_resolved_draws.clear();
+    m_resolved_draws.reserve(m_draws.size());
+    m_draw_counts = {};
+    for (const auto& draw : m_draws) {
+        auto pipeline = draw.pipeline;
+        if (!m_pipelines[pipeline].ready()) {
+            if (!m_fallback_pipeline.has_value() ||
+                !m_pipelines[m_fallback_pipeline.value()].ready()) {
+                m_compile_stats.skipped_draws++;
+                continue;
+            }
+            pipeline = m_fallback_pipeline.value();
+            m_compile_stats.fallback_draws++;
+        }
+        m_resolved_draws.emplace_back(
+            m_depth_prepass ? prepassPipelines(pipeline)
+                            : PrepassPipelines{std::nullopt, pipeline},
+            &draw);
+        const auto& pack = m_resource_packs[draw.model.pack];
+        m_draw_counts.draws++;
+        m_draw_counts.triangles +=
+            pack.m_model_offsets[draw.model.index].index_count / 3;
+    }
+}
+
+void Context::recordDraws(bool indirect, const std::string& pass) {
+    // Culled draws are recorded all the same, their instance count is zero
+    VkBuffer commands = indirect ? m_culler.drawBuffer() : VK_NULL_HANDLE;
+    auto commandOffset = [&](const DrawCall* draw) -> VkDeviceSize {
+        return indirect ? m_culler.commandOffset(draw - m_draws.data()) : 0;
+    };
+
+    // Statistics are counted against the pipeline the draw asked for,
+    // whichever variant or fallback it was recorded with
+    auto command = m_frame_state._command;
+    std::optional<size_t> counted{};
+    auto count = [&](const std::string& label, const DrawCall* draw) {
+        if (counted != draw->pipeline) {
+            m_statistics.begin(command, label, draw->pipeline);
+            counted = draw->pipeline;
+        }
+    };
+
+    std::optional<size_t> bound{};
+    auto depth_pass = pass + " depth";
+    if (m_depth_prepass) {
+        m_profiler.begin(command, "depth draws");
+    }
+    for (const auto& [pipelines, draw] : m_resolved_draws) {
+        if (!pipelines.depth.has_value()) {
+            continue;
+        }
+        if (bound != pipelines.depth) {
+            bindGraphics(pipelines.depth.value());
+            bound = pipelines.depth;
+        }
+        count(depth_pass, draw);
+        pushTransform(draw->transform);
+        m_resource_packs[draw->model.pack].drawDepth(
+            command, draw->model.index, commands, commandOffset(draw));
+    }
+    if (m_depth_prepass) {
+        m_profiler.end(command);
+    }
+    m_profiler.begin(command, "pack draws");
+    counted.reset();
+    for (const auto& [pipelines, draw] : m_resolved_draws) {
+        if (bound != pipelines.color) {
+            bindGraphics(pipelines.color);
+            bound = pipelines.color;
+        }
+        count(pass, draw);
+        pushTransform(draw->transform);
+        m_resource_packs[draw->model.pack].draw(command, draw->model.index,
+                                                m_bound_layout, commands,
+                                                commandOffset(draw));
+    }
+    m_statistics.end(command);
+    m_profiler.end(command);
+}
+
+PipelineCounters Context::pipelineCounters(PipelineHandle pipeline) const {
+    const auto& pipelines = m_statistics.results().pipelines;
+    auto counters = pipelines.find(pipeline.index);
+    return counters != pipelines.end() ? counters->second
+                                       : PipelineCounters{};
+}
+
+void Context::reportMemory(std::ostream& out) const {
+    const auto& tracker = device.m_memory_tracker;
+    tracker.report(out);
+
+    const auto& properties = device.info().memory_properties;
+    out << "Device memory per heap:\n";
+    for (uint32_t i{0}; i < properties.memoryHeapCount; i++) {
+        const auto& heap = properties.memoryHeaps[i];
+        out << "  heap " << i
+            << (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (local)" : "")
+            << ": " << MemoryTracker::formatBytes(tracker.heapBytes(i))
+            << " of " << MemoryTracker::formatBytes(heap.size) << '\n';
+    }
+
+    for (size_t i{0}; i < m_resource_packs.size(); i++) {
+        const auto& usage = m_resource_packs[i].memoryUsage();
+        out << "Resource pack " << i << " ("
+            << m_resource_packs[i].model_count()
+            << " models): " << MemoryTracker::formatBytes(usage.total())
+            << "\n  vertex " << MemoryTracker::formatBytes(usage.vertex)
+            << ", index " << MemoryTracker::formatBytes(usage.index)
+            << ", uniform " << MemoryTracker::formatBytes(usage.uniform)
+            << ", texture " << MemoryTracker::formatBytes(usage.texture)
+            << ", padding " << MemoryTracker::formatBytes(usage.padding)
+            << '\n';
+    }
+}
+
+Context::PrepassPipelines Context::prepassPipelines(size_t pipeline) {
+    auto item = m_prepass_pipelines.find(pipeline);
+    if (item == m_prepass_pipelines.end()) {
+        item = m_prepass_pipelines.emplace(pipeline, requestPrepass(pipeline))
+                   .first;
+    }
+    // Drawn without the pre-pass until both variants are ready
+    const auto& prepass = item->second;
+    if (prepass.depth.has_value() &&
+        (!m_pipelines[prepass.depth.value()].ready() ||
+         !m_pipelines[prepass.color].ready())) {
+        return PrepassPipelines{std::nullopt, pipeline};
+    }
+    return prepass;
+}
+
+Context::PrepassPipelines Context::requestPrepass(size_t pipeline) {
+    PipelineProgram program{};
+    PipelineVariant variant{};
+    {
+        std::lock_guard<std::mutex> lock{m_reload_mutex};
+        program = m_pipeline_programs[pipeline];
+        variant = m_pipeline_variants[pipeline];
+    }
+    // Geometry which does not write depth keeps its own depth test
+    if (!variant.render_state.depth_write) {
+        return PrepassPipelines{std::nullopt, pipeline};
+    }
+
+    PipelineVariant depth{};
+    depth.attribs = VertexAttribs::positionAttributes();
+    depth.render_state.cull_mode = variant.render_state.cull_mode;
+    depth.render_state.depth_compare = variant.render_state.depth_compare;
+    depth.render_state.blend = false;
+    depth.render_state.color_write = false;
+
+    variant.render_state.depth_compare = VK_COMPARE_OP_EQUAL;
+    variant.render_state.depth_write = false;
+
+    auto depth_handle =
+        requestProgram(pipelineProgram(ShaderProgram::depth), depth);
+    auto color_handle = requestProgram(std::move(program), variant);
+    return PrepassPipelines{depth_handle.index, color_handle.index};
+}
+
+void Context::bindGraphics(size_t pipeline) {
+    const auto& bound = m_pipelines[pipeline];
+    VK_CALL(vkCmdBindPipeline)(m_frame_state._command,
+                               VK_PIPELINE_BIND_POINT_GRAPHICS,
+                               bound.m_pipeline);
+    m_bound_layout = bound.m_layout;
+    splitPushRange(bound.m_push_ranges, 0, sizeof(glm::mat4),
+                   m_camera_pushes);
+    splitPushRange(bound.m_push_ranges, sizeof(glm::mat4), sizeof(glm::mat4),
+                   m_transform_pushes);
+    for (const auto& push : m_camera_pushes) {
+        VK_CALL(vkCmdPushConstants)(
+            m_frame_state._command, m_bound_layout, push.stageFlags,
+            push.offset, push.size,
+            reinterpret_cast<const char*>(glm::value_ptr(m_camera)) +
+                push.offset);
+    }
+}
+
+void Context::pushTransform(const glm::mat4& transform) {
+    for (const auto& push : m_transform_pushes) {
+        VK_CALL(vkCmdPushConstants)(
+            m_frame_state._command, m_bound_layout, push.stageFlags,
+            push.offset, push.size,
+            reinterpret_cast<const char*>(glm::value_ptr(transform)) +
+                push.offset - sizeof(glm::mat4));
+    }
 }
 
 void Context::endFrame() {
-    vkCmdEndRenderPass(m_frame_state._command);
+    SCOPE("Context::endFrame");
+    auto& graph = m_render_graph;
+    graph.reset(m_swapchain.m_extent);
+
+    auto surface_format = device.info().surface_format.format;
+    auto samples = m_render_pass.samples();
+    auto backbuffer = graph.importImage(
+        "backbuffer", m_frame_state._image, m_frame_state._view,
+        {surface_format, VK_IMAGE_ASPECT_COLOR_BIT},
+        RenderGraph::State{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                           VK_IMAGE_LAYOUT_UNDEFINED},
+        device.headless() ? RenderGraph::Access::TransferSrc
+                          : RenderGraph::Access::Present);
+    auto depth = graph.createImage(
+        "depth",
+        {device.info().depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, samples});
+
+    // Storage is imported once per frame, whatever state the previous
+    // frame left it in is carried over by the graph
+    std::map<std::pair<StorageHandle::Kind, size_t>, RenderGraph::Resource>
+        storage{};
+    auto importStorage = [&](const StorageHandle& handle) {
+        auto key = std::pair{handle.kind, handle.index};
+        auto imported = storage.find(key);
+        if (imported != storage.end()) {
+            return imported->second;
+        }
+        RenderGraph::Resource resource{};
+        if (handle.kind == StorageHandle::Kind::Buffer) {
+            resource = graph.importBuffer(
+                "storage buffer", m_storage_buffers[handle.index].buffer());
+        } else {
+            auto& image = m_storage_images[handle.index];
+            resource =
+                graph.importImage("storage image", image.image(), image.view(),
+                                  {image.format(), VK_IMAGE_ASPECT_COLOR_BIT});
+        }
+        return storage.emplace(key, resource).first->second;
+    };
+
+    for (const auto& queued : m_dispatches) {
+        auto pass = graph.addPass(
+            "dispatch", [this, queued](VkCommandBuffer command) {
+                recordDispatch(command, queued.pipeline, queued.bindings,
+                               queued.x, queued.y, queued.z);
+            });
+        const auto& bindings = m_storage_bindings[queued.bindings.index];
+        for (const auto& handle : bindings.resources) {
+            pass.write(importStorage(handle),
+                       RenderGraph::Access::StorageReadWrite);
+            if (handle.kind == StorageHandle::Kind::Buffer) {
+                m_storage_buffers[handle.index].m_graphics_serial =
+                    m_swapchain.m_submit_serial;
+            }
+        }
+    }
+
+    resolveDraws();
+
+    // Draws visible in the previous frame's depth pyramid are drawn first,
+    // the rest are tested again against the pyramid of their depth
+    bool culling = m_occlusion_culling && samples == VK_SAMPLE_COUNT_1_BIT;
+    RenderGraph::Resource pyramid{};
+    RenderGraph::Resource commands{};
+    RenderGraph::Resource visibility{};
+    if (culling) {
+        std::vector<OcclusionCuller::Draw> draws{};
+        draws.reserve(m_draws.size());
+        for (const auto& draw : m_draws) {
+            const auto& offsets = m_resource_packs[draw.model.pack]
+                                      .m_model_offsets[draw.model.index];
+            draws.push_back({draw.transform, offsets.bounds_min,
+                             offsets.bounds_max,
+                             static_cast<uint32_t>(offsets.index_count)});
+        }
+        m_culler.prepare(m_frame_state._index, m_swapchain.m_extent,
+                         m_camera, draws, m_swapchain.m_submit_serial,
+                         m_swapchain.m_completed_serial);
+
+        std::optional<RenderGraph::State> pyramid_state{};
+        if (m_culler.pyramidFresh()) {
+            pyramid_state = RenderGraph::State{
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                VK_IMAGE_LAYOUT_UNDEFINED};
+        }
+        pyramid = graph.importImage(
+            "depth pyramid", m_culler.pyramidImage(), m_culler.pyramidView(),
+            {OcclusionCuller::PYRAMID_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT},
+            pyramid_state);
+        commands = graph.importBuffer("draw commands", m_culler.drawBuffer());
+        visibility =
+            graph.importBuffer("visibility", m_culler.visibilityBuffer());
+
+        if (m_culler.pyramidFresh()) {
+            graph
+                .addPass("depth pyramid clear",
+                         [this](VkCommandBuffer command) {
+                             m_culler.recordClear(command);
+                         })
+                .write(pyramid, RenderGraph::Access::TransferDst);
+        }
+        graph
+            .addPass("occlusion cull early",
+                     [this](VkCommandBuffer command) {
+                         m_culler.recordCull(command, 0);
+                     })
+            .read(pyramid, RenderGraph::Access::ComputeRead)
+            .write(commands, RenderGraph::Access::StorageReadWrite)
+            .write(visibility, RenderGraph::Access::StorageReadWrite);
+    } else {
+        // The graph forgets the layout of a pyramid a frame did not import
+        m_culler.invalidate();
+    }
+
+    std::optional<RenderGraph::Resource> color{};
+    if (samples != VK_SAMPLE_COUNT_1_BIT) {
+        color = graph.createImage(
+            "color", {surface_format, VK_IMAGE_ASPECT_COLOR_BIT, samples});
+    }
+    auto addScene = [&](const std::string& name, bool clear) {
+        auto scene = graph.addPass(
+            name, [this, culling, name](VkCommandBuffer command) {
+                recordScene(command, culling, name);
+            });
+        for (const auto& [key, resource] : storage) {
+            scene.read(resource, RenderGraph::Access::StorageRead);
+        }
+        if (culling) {
+            scene.read(commands, RenderGraph::Access::StorageRead);
+        }
+        std::optional<VkClearDepthStencilValue> depth_clear{};
+        std::optional<VkClearColorValue> color_clear{};
+        if (clear) {
+            depth_clear = VkClearDepthStencilValue{1.0f, 0};
+            color_clear = VkClearColorValue{{0.2f, 0.2f, 0.2f, 1.0f}};
+        }
+        scene.depth(depth, depth_clear);
+        if (color.has_value()) {
+            scene.color(color.value(), color_clear);
+            scene.resolve(backbuffer);
+        } else {
+            scene.color(backbuffer, color_clear);
+        }
+    };
+    addScene("scene", true);
+
+    if (culling) {
+        graph
+            .addPass("depth pyramid",
+                     [this, depth](VkCommandBuffer command) {
+                         m_culler.recordPyramid(command,
+                                                m_render_graph.view(depth));
+                     })
+            .read(depth, RenderGraph::Access::ComputeSampled)
+            .write(pyramid, RenderGraph::Access::StorageReadWrite);
+        graph
+            .addPass("occlusion cull late",
+                     [this](VkCommandBuffer command) {
+                         m_culler.recordCull(command, 1);
+                     })
+            .read(pyramid, RenderGraph::Access::ComputeRead)
+            .read(visibility, RenderGraph::Access::ComputeRead)
+            .write(commands, RenderGraph::Access::StorageReadWrite);
+        addScene("scene late", false);
+    }
+
+    if (m_readback.active()) {
+        auto slot = m_readback.acquire(m_swapchain.m_submit_serial,
+                                       m_swapchain.m_extent, surface_format);
+        if (slot != nullptr) {
+            auto image = m_frame_state._image;
+            graph
+                .addPass("readback",
+                         [this, image, slot](VkCommandBuffer command) {
+                             m_readback.record(command, image, *slot);
+                         })
+                .read(backbuffer, RenderGraph::Access::TransferSrc)
+                .sideEffects();
+        }
+    }
+
+    graph.execute(m_frame_state._command, m_swapchain.m_submit_serial,
+                  m_swapchain.m_completed_serial, &m_profiler);
+    m_profiler.endFrame(m_frame_state._command);
+    m_statistics.endFrame();
+    m_pacer.endFrame();
     if (vkEndCommandBuffer(m_frame_state._command) != VK_SUCCESS) {
         throw std::runtime_error("Failed to record frame graphics commands");
     }
 
-    VkPipelineStageFlags wait_stage =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    std::vector<VkSemaphore> wait_semaphores{};
+    std::vector<VkPipelineStageFlags> wait_stages{};
+    if (m_frame_state._draw_ready != VK_NULL_HANDLE) {
+        wait_semaphores.push_back(m_frame_state._draw_ready);
+        wait_stages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    }
+    for (auto semaphore :
+         m_compute_queue.takeSignals(m_swapchain.m_submit_serial)) {
+        wait_semaphores.push_back(semaphore);
+        wait_stages.push_back(COMPUTE_CONSUMER_STAGES |
+                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
 
     VkSubmitInfo submit_info{};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -116,19 +907,342 @@ void Context::endFrame() {
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &m_frame_state._command;
 
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = &m_frame_state._draw_ready;
-    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.waitSemaphoreCount = wait_semaphores.size();
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
 
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = &m_frame_state._draw_finished;
+    if (m_frame_state._draw_finished != VK_NULL_HANDLE) {
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &m_frame_state._draw_finished;
+    }
 
-    if (vkQueueSubmit(device.queues.graphics, 1, &submit_info,
-                      m_frame_state._submit_fence) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit draw command buffer");
-    };
+    m_profiler.submitted();
+    {
+        SCOPE("submit");
+        if (VK_CALL(vkQueueSubmit)(device.queues.graphics, 1, &submit_info,
+                                   m_frame_state._submit_fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit draw command buffer");
+        };
+    }
+
+    {
+        SCOPE("present");
+        m_swapchain.presentImage(m_frame_state);
+    }
+    m_pacer.presented();
+    // Zones of this frame still open are drained with the next one
+    Profiler::instance().collect();
+    // From the previous present, so the frame wait and acquire count too
+    m_call_stats = CallCounter::collect();
+}
+
+void Context::setGpuProfiling(bool enabled) {
+    if (enabled && !m_profiler.supported()) {
+        throw std::runtime_error(
+            "GPU profiling needs timestamps on the graphics queue");
+    }
+    m_gpu_profiling = enabled;
+    m_profiler.setEnabled(enabled || m_trace != nullptr);
+}
+
+void Context::startTrace(const std::filesystem::path& path) {
+    stopTrace();
+    m_trace = std::make_unique<TraceWriter>(path);
+    m_profiler.setTrace(m_trace.get());
+    Profiler::instance().setTrace(m_trace.get());
+    m_profiler.setEnabled(m_profiler.supported());
+}
+
+void Context::stopTrace() {
+    if (m_trace == nullptr) {
+        return;
+    }
+    VK_CALL(vkDeviceWaitIdle)(*device);
+    m_profiler.flush();
+    m_profiler.setTrace(nullptr);
+    m_profiler.setEnabled(m_gpu_profiling);
+    Profiler::instance().collect();
+    Profiler::instance().setTrace(nullptr);
+    m_trace.reset();
+}
+
+void Context::setOcclusionCulling(bool enabled) {
+    if (enabled && !OcclusionCuller::supported(device)) {
+        throw std::runtime_error("Occlusion culling is not supported");
+    }
+    if (enabled) {
+        m_culler.createPipelines();
+    }
+    // The pyramid left from earlier frames no longer matches the scene
+    if (enabled && !m_occlusion_culling) {
+        m_culler.invalidate();
+    }
+    m_occlusion_culling = enabled;
+}
+
+void Context::waitForFrame() {
+    // Input sampled after the GPU drained is shown by the very next frame
+    if (m_swapchain.m_latency_mode == LatencyMode::LowLatency) {
+        m_swapchain.waitSubmitted();
+    }
+    m_pacer.wait();
+}
+
+void Context::captureFrames(ReadbackRing::Consumer&& consumer) {
+    auto usage = device.info().surface_capabilities.supportedUsageFlags;
+    if (!device.headless() && !(usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+        throw std::runtime_error("Swapchain images can not be copied from");
+    }
+    if (Image2D::TexelSize(device.info().surface_format.format) == 0) {
+        throw std::runtime_error("Swapchain format can not be captured");
+    }
+    m_readback.start(std::move(consumer), m_swapchain.m_images.size() + 1);
+}
+
+ComputeHandle Context::loadCompute(
+    const std::filesystem::path& dir,
+    const std::map<uint32_t, uint32_t>& constants) {
+    m_compute_pipelines.emplace_back(
+        ComputePipeline{device, dir, m_layout_cache, constants});
+    std::cout << "Compute pipeline: " << dir.string() << std::endl;
+    return ComputeHandle{m_compute_pipelines.size() - 1};
+}
+
+ComputeHandle Context::loadCompute(
+    ShaderProgram program, const std::map<uint32_t, uint32_t>& constants) {
+    const auto& embedded = embeddedProgram(program);
+    for (size_t i{0}; i < embedded.stage_count; i++) {
+        const auto& stage = embedded.stages[i];
+        if (stage.stage != VK_SHADER_STAGE_COMPUTE_BIT) {
+            continue;
+        }
+        auto bytes = reinterpret_cast<const char*>(stage.code);
+        m_compute_pipelines.emplace_back(ComputePipeline{
+            device,
+            std::vector<char>(bytes, bytes + stage.size * sizeof(uint32_t)),
+            embedded.name, m_layout_cache, constants});
+        std::cout << "Compute pipeline: embedded " << embedded.name
+                  << std::endl;
+        return ComputeHandle{m_compute_pipelines.size() - 1};
+    }
+    throw std::runtime_error("Embedded program has no compute shader: "s +
+                             embedded.name);
+}
+
+StorageHandle Context::createStorageBuffer(VkDeviceSize size,
+                                           VkBufferUsageFlags usage) {
+    m_storage_buffers.emplace_back(StorageBuffer{device, size, usage});
+    return StorageHandle{StorageHandle::Kind::Buffer,
+                         m_storage_buffers.size() - 1};
+}
+
+StorageHandle Context::createStorageImage(uint32_t width, uint32_t height,
+                                          VkFormat format) {
+    auto& image = m_storage_images.emplace_back(
+        StorageImage{device, width, height, format});
+
+    auto command = beginCompute();
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.image();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
+
+    VK_CALL(vkCmdPipelineBarrier)(command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+                                  nullptr, 0, nullptr, 1, &barrier);
+
+    m_compute_queue.wait(m_compute_queue.submit(false));
+    return StorageHandle{StorageHandle::Kind::Image,
+                         m_storage_images.size() - 1};
+}
+
+void Context::writeStorage(StorageHandle buffer, const void* data,
+                           VkDeviceSize size, VkDeviceSize offset) {
+    if (buffer.kind != StorageHandle::Kind::Buffer) {
+        throw std::runtime_error("Only storage buffers can be written");
+    }
+    auto& storage = m_storage_buffers[buffer.index];
+    m_swapchain.waitSerial(storage.m_graphics_serial);
+    m_compute_queue.wait(storage.m_compute_serial);
+    StagingBuffer staging{device, size, &m_profiler};
+    staging.copyBuffer(storage.m_buffer, offset, data, size);
+}
+
+BindingsHandle Context::createBindings(
+    ComputeHandle pipeline, uint32_t set,
+    const std::map<uint32_t, StorageHandle>& resources) {
+    auto& compute = m_compute_pipelines[pipeline.index];
+    auto reflected = compute.m_sets.find(set);
+    if (reflected == compute.m_sets.end()) {
+        throw std::runtime_error("Compute shader does not use descriptor set " +
+                                 std::to_string(set));
+    }
+    for (const auto& binding : reflected->second) {
+        auto resource = resources.find(binding.binding);
+        auto expected = resource != resources.end() &&
+                                resource->second.kind ==
+                                    StorageHandle::Kind::Buffer
+                            ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                            : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        if (resource == resources.end() ||
+            binding.descriptorType != expected ||
+            binding.descriptorCount != 1) {
+            throw std::runtime_error(
+                "Storage resource for set " + std::to_string(set) +
+                " binding " + std::to_string(binding.binding) +
+                " is missing or does not match the shader");
+        }
+    }
+    if (resources.size() != reflected->second.size()) {
+        throw std::runtime_error("Storage resources bound to set " +
+                                 std::to_string(set) +
+                                 " are not used by the shader");
+    }
+
+    auto descriptors = allocateStorageSet(
+        m_layout_cache.pipelineSetLayout(compute.m_layout, set));
+
+    std::vector<VkDescriptorBufferInfo> buffer_infos{};
+    std::vector<VkDescriptorImageInfo> image_infos{};
+    buffer_infos.reserve(resources.size());
+    image_infos.reserve(resources.size());
+
+    std::vector<VkWriteDescriptorSet> write_info{};
+    write_info.reserve(resources.size());
+    for (const auto& [binding, resource] : resources) {
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = descriptors;
+        write.dstBinding = binding;
+        write.descriptorCount = 1;
+        if (resource.kind == StorageHandle::Kind::Buffer) {
+            auto& buffer = m_storage_buffers[resource.index];
+            auto& info = buffer_infos.emplace_back();
+            info.buffer = buffer.buffer();
+            info.offset = 0;
+            info.range = VK_WHOLE_SIZE;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.pBufferInfo = &info;
+        } else {
+            auto& image = m_storage_images[resource.index];
+            auto& info = image_infos.emplace_back();
+            info.imageView = image.view();
+            info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            write.pImageInfo = &info;
+        }
+        write_info.push_back(write);
+    }
+    VK_CALL(vkUpdateDescriptorSets)(*device, write_info.size(),
+                                    write_info.data(), 0, nullptr);
+
+    std::vector<StorageHandle> bound{};
+    for (const auto& [binding, resource] : resources) {
+        bound.push_back(resource);
+    }
+    m_storage_bindings.push_back({set, descriptors, std::move(bound)});
+    return BindingsHandle{m_storage_bindings.size() - 1};
+}
+
+VkDescriptorSet Context::allocateStorageSet(VkDescriptorSetLayout layout) {
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &layout;
+
+    VkDescriptorSet descriptors{};
+    if (!m_storage_pools.empty()) {
+        alloc_info.descriptorPool = m_storage_pools.back();
+        if (vkAllocateDescriptorSets(*device, &alloc_info, &descriptors) ==
+            VK_SUCCESS) {
+            return descriptors;
+        }
+    }
+
+    std::array<VkDescriptorPoolSize, 2> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[0].descriptorCount = STORAGE_POOL_DESCRIPTORS;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    pool_sizes[1].descriptorCount = STORAGE_POOL_DESCRIPTORS;
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = STORAGE_POOL_SETS;
+    pool_info.poolSizeCount = pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+
+    VkDescriptorPool pool{};
+    if (vkCreateDescriptorPool(*device, &pool_info,
+                               device.allocator(HostObject::DescriptorPool),
+                               &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create storage descriptor pool");
+    }
+    m_storage_pools.push_back(pool);
+
+    alloc_info.descriptorPool = pool;
+    if (vkAllocateDescriptorSets(*device, &alloc_info, &descriptors) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate storage descriptor set");
+    }
+    return descriptors;
+}
+
+void Context::dispatch(ComputeHandle pipeline, BindingsHandle bindings,
+                       uint32_t x, uint32_t y, uint32_t z) {
+    m_dispatches.push_back({pipeline, bindings, x, y, z});
+}
+
+uint64_t Context::dispatchAsync(ComputeHandle pipeline,
+                                BindingsHandle bindings, uint32_t x,
+                                uint32_t y, uint32_t z) {
+    auto command = beginCompute();
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    VK_CALL(vkCmdPipelineBarrier)(command, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                  &barrier, 0, nullptr, 0, nullptr);
+
+    recordDispatch(command, pipeline, bindings, x, y, z);
+    auto serial = m_compute_queue.submit(true);
+    for (const auto& handle : m_storage_bindings[bindings.index].resources) {
+        if (handle.kind == StorageHandle::Kind::Buffer) {
+            m_storage_buffers[handle.index].m_compute_serial = serial;
+        }
+    }
+    return serial;
+}
+
+VkCommandBuffer Context::beginCompute() {
+    // Binary semaphores can only be signalled again once the frame which
+    // waited on them has completed
+    m_swapchain.waitSerial(m_compute_queue.consumerSerial());
+    return m_compute_queue.begin();
+}
 
-    m_swapchain.presentImage(m_frame_state);
+void Context::recordDispatch(VkCommandBuffer command, ComputeHandle pipeline,
+                             BindingsHandle bindings, uint32_t x, uint32_t y,
+                             uint32_t z) {
+    const auto& compute = m_compute_pipelines[pipeline.index];
+    const auto& storage = m_storage_bindings[bindings.index];
+    VK_CALL(vkCmdBindPipeline)(command, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               compute.m_pipeline);
+    VK_CALL(vkCmdBindDescriptorSets)(command, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                     compute.m_layout, storage.set, 1,
+                                     &storage.descriptors, 0, nullptr);
+    VK_CALL(vkCmdDispatch)(command, x, y, z);
 }
 
 }  // namespace  vks
@@ -1,10 +1,15 @@
 #include "vk/device.h"
 
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <optional>
 #include <stdexcept>
 #include <unordered_set>
 
+#include "startup.h"
+
 using namespace std::string_literals;
 
 namespace vks {
@@ -15,6 +20,7 @@ std::vector<std::string> REQUIRED_DEVICE_EXTENSIONS{
     VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 std::vector<std::string> REQUIRED_VALIDATION_LAYERS{
     "VK_LAYER_KHRONOS_validation"s};
+std::filesystem::path PIPELINE_CACHE_PATH{"pipeline_cache.bin"s};
 std::vector<VkFormat> PREFERRED_SURFACE_FORMATS{
     VK_FORMAT_R8G8B8A8_UNORM,
     VK_FORMAT_B8G8R8A8_UNORM,
@@ -77,26 +83,72 @@ VkBool32 VKAPI_PTR Device::messengerCallback(
 }
 
 Device::Device(Window& window) {
-    createInstance(window);
+    createInstance(&window);
     pickPhysicalDevice();
     createDevice();
+    createPipelineCache();
+}
+
+Device::Device(VkExtent2D extent) {
+    createInstance(nullptr);
+    pickPhysicalDevice();
+
+    // Stands in for the surface so the swapchain sizes its offscreen targets
+    auto& capabilities = device_info.surface_capabilities;
+    capabilities = {};
+    capabilities.currentExtent = extent;
+    capabilities.minImageExtent = extent;
+    capabilities.maxImageExtent = extent;
+    device_info.surface_format = {VK_FORMAT_R8G8B8A8_UNORM,
+                                  VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    device_info.present_modes = {VK_PRESENT_MODE_FIFO_KHR};
+
+    createDevice();
+    createPipelineCache();
 }
 
 Device::~Device() {
-    vkDeviceWaitIdle(m_device);
-    vkDestroyDevice(m_device, nullptr);
+    VK_CALL(vkDeviceWaitIdle)(m_device);
+    savePipelineCache();
+    vkDestroyPipelineCache(m_device, m_pipeline_cache,
+                           allocator(HostObject::PipelineCache));
+    vkDestroyDevice(m_device, allocator(HostObject::Device));
     vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
     if (m_messenger != VK_NULL_HANDLE) {
         auto destoryMessenger =
             reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(
                 vkGetInstanceProcAddr(m_instance,
                                       "vkDestroyDebugUtilsMessengerEXT"));
-        destoryMessenger(m_instance, m_messenger, nullptr);
+        destoryMessenger(m_instance, m_messenger,
+                         allocator(HostObject::DebugMessenger));
+    }
+    vkDestroyInstance(m_instance, allocator(HostObject::Instance));
+}
+
+VkResult Device::allocateMemory(const VkMemoryAllocateInfo& info,
+                                const std::string& owner,
+                                VkDeviceMemory* memory) {
+    auto result = vkAllocateMemory(m_device, &info,
+                                   allocator(HostObject::Memory), memory);
+    if (result == VK_SUCCESS) {
+        auto heap = device_info.memory_properties
+                        .memoryTypes[info.memoryTypeIndex]
+                        .heapIndex;
+        m_memory_tracker.allocated(*memory, owner, info.allocationSize, heap);
     }
-    vkDestroyInstance(m_instance, nullptr);
+    return result;
 }
 
-void Device::createInstance(Window& window) {
+void Device::freeMemory(VkDeviceMemory memory) {
+    if (memory == VK_NULL_HANDLE) {
+        return;
+    }
+    m_memory_tracker.freed(memory);
+    vkFreeMemory(m_device, memory, allocator(HostObject::Memory));
+}
+
+void Device::createInstance(Window* window) {
+    StartupPhase phase{"instance"};
     VkInstanceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 
@@ -104,7 +156,7 @@ void Device::createInstance(Window& window) {
     create_info.enabledExtensionCount = enabled_extensions.size();
     create_info.ppEnabledExtensionNames = enabled_extensions.data();
 
-    auto enabled_layers = requiredValidationLayers();
+    auto enabled_layers = requiredValidationLayers(window == nullptr);
     create_info.enabledLayerCount = enabled_layers.size();
     create_info.ppEnabledLayerNames = enabled_layers.data();
 
@@ -113,36 +165,54 @@ void Device::createInstance(Window& window) {
     VkApplicationInfo app_info{};
     app_info.apiVersion = VK_API_VERSION_1_2;
 
+    bool debug_utils = std::any_of(
+        enabled_extensions.begin(), enabled_extensions.end(),
+        [](const char* name) {
+            return std::strcmp(name, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0;
+        });
+
     create_info.pApplicationInfo = &app_info;
-    create_info.pNext = &messenger_info;
+    create_info.pNext = debug_utils ? &messenger_info : nullptr;
 
-    if (vkCreateInstance(&create_info, nullptr, &m_instance) != VK_SUCCESS) {
+    if (vkCreateInstance(&create_info, allocator(HostObject::Instance),
+                         &m_instance) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create vulkan instance");
     }
 
-    auto createMessenger = reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(
-        vkGetInstanceProcAddr(m_instance, "vkCreateDebugUtilsMessengerEXT"));
-    if (createMessenger(m_instance, &messenger_info, nullptr, &m_messenger) !=
-        VK_SUCCESS) {
-        throw std::runtime_error("Failed to create debug messenger");
+    m_messenger = VK_NULL_HANDLE;
+    if (debug_utils) {
+        auto createMessenger =
+            reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(
+                vkGetInstanceProcAddr(m_instance,
+                                      "vkCreateDebugUtilsMessengerEXT"));
+        if (createMessenger(m_instance, &messenger_info,
+                            allocator(HostObject::DebugMessenger),
+                            &m_messenger) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create debug messenger");
+        }
     }
 
-    window.createVkSurface(m_instance, m_surface);
+    m_surface = VK_NULL_HANDLE;
+    if (window) {
+        window->createVkSurface(m_instance, m_surface);
+    }
 }
 
-std::vector<const char*> Device::requiredInstanceExtensions(Window& window) {
+std::vector<const char*> Device::requiredInstanceExtensions(Window* window) {
     std::vector<const char*> supported;
 
-    uint32_t window_extension_count{};
-    auto window_extensions =
-        window.requiredSurfaceExtensions(window_extension_count);
-    if (!window_extensions) {
-        throw std::runtime_error("Surface extensions not supported");
-    }
+    if (window) {
+        uint32_t window_extension_count{};
+        auto window_extensions =
+            window->requiredSurfaceExtensions(window_extension_count);
+        if (!window_extensions) {
+            throw std::runtime_error("Surface extensions not supported");
+        }
 
-    supported.resize(window_extension_count);
-    for (size_t i{0}; i < window_extension_count; i++) {
-        supported[i] = window_extensions[i];
+        supported.resize(window_extension_count);
+        for (size_t i{0}; i < window_extension_count; i++) {
+            supported[i] = window_extensions[i];
+        }
     }
 
     uint32_t count{};
@@ -157,7 +227,7 @@ std::vector<const char*> Device::requiredInstanceExtensions(Window& window) {
                                                 name.c_str()) == 0;
                          }) != properties.end()) {
             supported.push_back(name.c_str());
-        } else {
+        } else if (window) {
             throw std::runtime_error("Instance extension " + name +
                                      " not supported");
         }
@@ -165,7 +235,7 @@ std::vector<const char*> Device::requiredInstanceExtensions(Window& window) {
     return supported;
 }
 
-std::vector<const char*> Device::requiredValidationLayers() {
+std::vector<const char*> Device::requiredValidationLayers(bool optional) {
     std::vector<const char*> supported{};
 
     uint32_t count{};
@@ -178,15 +248,18 @@ std::vector<const char*> Device::requiredValidationLayers() {
                     return std::strcmp(properties.layerName, name.c_str()) == 0;
                 }) != properties.end()) {
             supported.push_back(name.c_str());
-        } else {
+        } else if (!optional) {
             throw std::runtime_error("Layer " + name + " not supported");
         }
     }
     return supported;
 }
 
-std::vector<const char*> Device::requiredDeviceExtensions() {
+std::vector<const char*> Device::requiredDeviceExtensions(bool headless) {
     std::vector<const char*> extensions;
+    if (headless) {
+        return extensions;
+    }
     for (auto& name : REQUIRED_DEVICE_EXTENSIONS) {
         extensions.push_back(name.c_str());
     }
@@ -194,6 +267,7 @@ std::vector<const char*> Device::requiredDeviceExtensions() {
 }
 
 void Device::pickPhysicalDevice() {
+    StartupPhase phase{"physical device"};
     uint32_t count{};
     vkEnumeratePhysicalDevices(m_instance, &count, NULL);
     std::vector<VkPhysicalDevice> physical_devices(count);
@@ -211,14 +285,16 @@ void Device::pickPhysicalDevice() {
 
 bool Device::isSuitable(VkPhysicalDevice device, VkSurfaceKHR surface,
                         PhysicalDeviceInfo& info) {
+    bool headless = surface == VK_NULL_HANDLE;
     vkGetPhysicalDeviceProperties(device, &info.properties);
     if (!(info.properties.deviceType &
           (VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU |
-           VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU))) {
+           VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU |
+           (headless ? VK_PHYSICAL_DEVICE_TYPE_CPU : 0)))) {
         return false;
     }
 
-    if (!deviceExtensionsSupported(device)) {
+    if (!deviceExtensionsSupported(device, headless)) {
         return false;
     }
     VkPhysicalDeviceFeatures device_features{};
@@ -229,9 +305,13 @@ bool Device::isSuitable(VkPhysicalDevice device, VkSurfaceKHR surface,
     if (!getQueueFamilies(device, surface, info)) {
         return false;
     }
-    getSurfaceProperties(device, surface, info);
+    if (!headless) {
+        getSurfaceProperties(device, surface, info);
+    }
 
     vkGetPhysicalDeviceMemoryProperties(device, &info.memory_properties);
+    info.dynamic_rendering = dynamicRenderingSupported(device, info.properties);
+    info.pipeline_statistics = device_features.pipelineStatisticsQuery;
 
     info.depth_format = getSupportedImageFormat(
         device,
@@ -242,7 +322,11 @@ bool Device::isSuitable(VkPhysicalDevice device, VkSurfaceKHR surface,
     return true;
 }
 
-bool Device::deviceExtensionsSupported(VkPhysicalDevice device) {
+bool Device::deviceExtensionsSupported(VkPhysicalDevice device,
+                                       bool headless) {
+    if (headless) {
+        return true;
+    }
     uint32_t count{};
     vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
     std::vector<VkExtensionProperties> properties(count);
@@ -260,6 +344,36 @@ bool Device::deviceExtensionsSupported(VkPhysicalDevice device) {
     return true;
 }
 
+bool Device::dynamicRenderingSupported(
+    VkPhysicalDevice device, const VkPhysicalDeviceProperties& properties) {
+    // The extension builds on depth stencil resolve, core since 1.2
+    if (properties.apiVersion < VK_API_VERSION_1_2) {
+        return false;
+    }
+    uint32_t count{};
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+    std::vector<VkExtensionProperties> extensions(count);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &count,
+                                         extensions.data());
+    auto extension = std::find_if(
+        extensions.begin(), extensions.end(), [](auto& extension) {
+            return std::strcmp(extension.extensionName,
+                               VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0;
+        });
+    if (extension == extensions.end()) {
+        return false;
+    }
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering{};
+    dynamic_rendering.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &dynamic_rendering;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    return dynamic_rendering.dynamicRendering == VK_TRUE;
+}
+
 bool Device::deviceFeaturesSupported(
     const VkPhysicalDeviceFeatures& supported) {
     auto required = requiredDeviceFeatures();
@@ -307,6 +421,9 @@ bool Device::getQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface,
                 transfer_queue = i;
             }
         }
+        if (surface == VK_NULL_HANDLE) {
+            continue;
+        }
         VkBool32 is_present_queue{VK_FALSE};
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
                                              &is_present_queue);
@@ -314,6 +431,9 @@ bool Device::getQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface,
             present_queue = i;
         }
     }
+    if (surface == VK_NULL_HANDLE) {
+        present_queue = graphics_queue;
+    }
     if (!transfer_queue.has_value()) {
         transfer_queue = compute_queue;
     }
@@ -348,21 +468,23 @@ void Device::getSurfaceProperties(VkPhysicalDevice device, VkSurfaceKHR surface,
     }
     info.surface_format = surface_format.value_or(formats[0]);
 
+    // The swapchain picks among these by latency mode
     vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &count, NULL);
-    std::vector<VkPresentModeKHR> modes(count);
+    info.present_modes.resize(count);
     vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &count,
-                                              modes.data());
-
-    if (std::find(modes.begin(), modes.end(), VK_PRESENT_MODE_MAILBOX_KHR) !=
-        modes.end()) {
-        info.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-    } else {
-        info.present_mode = VK_PRESENT_MODE_FIFO_KHR;
-    }
+                                              info.present_modes.data());
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
                                               &info.surface_capabilities);
 }
 
+void Device::updateSurfaceCapabilities() {
+    if (headless()) {
+        return;
+    }
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+        m_physical_device, m_surface, &device_info.surface_capabilities);
+}
+
 VkFormat Device::getSupportedImageFormat(VkPhysicalDevice device,
                                          const std::vector<VkFormat>& formats,
                                          VkImageTiling tiling,
@@ -407,15 +529,40 @@ uint32_t Device::getMemoryIndex(uint32_t type_bits,
     throw std::runtime_error("Failed to find suitable memory index");
 }
 
+VkSampleCountFlagBits Device::maxSampleCount() const {
+    const auto& limits = device_info.properties.limits;
+    auto counts = limits.framebufferColorSampleCounts &
+                  limits.framebufferDepthSampleCounts;
+    for (auto samples :
+         {VK_SAMPLE_COUNT_64_BIT, VK_SAMPLE_COUNT_32_BIT,
+          VK_SAMPLE_COUNT_16_BIT, VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT,
+          VK_SAMPLE_COUNT_2_BIT}) {
+        if (counts & samples) {
+            return samples;
+        }
+    }
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
 void Device::createDevice() {
+    StartupPhase phase{"logical device"};
     VkDeviceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
-    auto extensions = requiredDeviceExtensions();
+    auto extensions = requiredDeviceExtensions(headless());
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering{};
+    dynamic_rendering.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    dynamic_rendering.dynamicRendering = VK_TRUE;
+    if (device_info.dynamic_rendering) {
+        extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        create_info.pNext = &dynamic_rendering;
+    }
     create_info.enabledExtensionCount = extensions.size();
     create_info.ppEnabledExtensionNames = extensions.data();
 
     auto features = requiredDeviceFeatures();
+    features.pipelineStatisticsQuery = device_info.pipeline_statistics;
     create_info.pEnabledFeatures = &features;
 
     std::unordered_set<uint32_t> queue_families{
@@ -440,8 +587,9 @@ void Device::createDevice() {
 
     create_info.queueCreateInfoCount = queue_create_infos.size();
     create_info.pQueueCreateInfos = queue_create_infos.data();
-    if (vkCreateDevice(m_physical_device, &create_info, nullptr, &m_device) !=
-        VK_SUCCESS) {
+    if (vkCreateDevice(m_physical_device, &create_info,
+                       allocator(HostObject::Device),
+                       &m_device) != VK_SUCCESS) {
         throw std::runtime_error("failed to create vulkan logical device");
     };
 
@@ -453,6 +601,100 @@ void Device::createDevice() {
                      &queues.transfer);
     vkGetDeviceQueue(m_device, device_info.queue_families.present, 0,
                      &queues.present);
+
+    m_begin_rendering = VK_NULL_HANDLE;
+    m_end_rendering = VK_NULL_HANDLE;
+    if (device_info.dynamic_rendering) {
+        m_begin_rendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCmdBeginRenderingKHR"));
+        m_end_rendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCmdEndRenderingKHR"));
+    }
+}
+
+bool Device::pipelineCacheHeaderValid(const std::vector<char>& data) const {
+    if (data.size() < sizeof(VkPipelineCacheHeaderVersionOne)) {
+        return false;
+    }
+    VkPipelineCacheHeaderVersionOne header{};
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == device_info.properties.vendorID &&
+           header.deviceID == device_info.properties.deviceID &&
+           std::memcmp(header.pipelineCacheUUID,
+                       device_info.properties.pipelineCacheUUID,
+                       VK_UUID_SIZE) == 0;
+}
+
+void Device::createPipelineCache() {
+    StartupPhase phase{"pipeline cache"};
+    std::vector<char> data{};
+    std::error_code error{};
+    if (std::filesystem::is_regular_file(PIPELINE_CACHE_PATH, error)) {
+        std::ifstream fs(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+        if (fs.is_open()) {
+            data.resize(fs.tellg());
+            fs.seekg(0, std::ios::beg);
+            if (!fs.read(data.data(), data.size())) {
+                data.clear();
+            }
+        }
+    }
+    m_pipeline_cache_warm = pipelineCacheHeaderValid(data);
+    if (!m_pipeline_cache_warm && !data.empty()) {
+        std::cout << "Discarding pipeline cache created for different device "
+                     "or driver at: "
+                  << PIPELINE_CACHE_PATH.string() << std::endl;
+    }
+
+    VkPipelineCacheCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (m_pipeline_cache_warm) {
+        create_info.initialDataSize = data.size();
+        create_info.pInitialData = data.data();
+    }
+    if (vkCreatePipelineCache(m_device, &create_info,
+                              allocator(HostObject::PipelineCache),
+                              &m_pipeline_cache) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline cache");
+    }
+}
+
+void Device::savePipelineCache() {
+    size_t size{};
+    if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &size, nullptr) !=
+            VK_SUCCESS ||
+        size == 0) {
+        return;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(m_device, m_pipeline_cache, &size,
+                               data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    // Written next to the target and renamed over it, so an interrupted
+    // shutdown never leaves a truncated cache behind
+    auto temp_path = PIPELINE_CACHE_PATH;
+    temp_path += ".tmp"s;
+    {
+        std::ofstream fs(temp_path, std::ios::binary | std::ios::trunc);
+        if (!fs.is_open() ||
+            !fs.write(data.data(), static_cast<std::streamsize>(size))) {
+            std::cerr << "Failed to write pipeline cache at: "
+                      << temp_path.string() << std::endl;
+            return;
+        }
+    }
+    std::error_code error{};
+    std::filesystem::rename(temp_path, PIPELINE_CACHE_PATH, error);
+    if (error) {
+        std::cerr << "Failed to replace pipeline cache at: "
+                  << PIPELINE_CACHE_PATH.string() << ": " << error.message()
+                  << std::endl;
+        std::filesystem::remove(temp_path, error);
+    }
 }
 
-}  // namespace vks
\ No newline at end of file
+}  // namespace vks
@@ -0,0 +1,60 @@
+#include "vk/frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace vks {
+
+// The limiter sleeps until this close to the deadline, then yields
+constexpr std::chrono::microseconds SPIN_MARGIN{1000};
+
+FramePacer::FramePacer() : m_timings{} {}
+
+void FramePacer::setFrameRateLimit(float fps) {
+    if (fps <= 0.0f) {
+        m_frame_period.reset();
+        return;
+    }
+    m_frame_period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(1.0f / fps));
+    m_next_frame = Clock::now();
+}
+
+void FramePacer::wait() {
+    if (!m_frame_period.has_value()) {
+        return;
+    }
+    auto now = Clock::now();
+    if (m_next_frame > now) {
+        std::this_thread::sleep_until(m_next_frame - SPIN_MARGIN);
+        while (Clock::now() < m_next_frame) {
+            std::this_thread::yield();
+        }
+    }
+    // A late frame restarts the schedule rather than bursting to catch up
+    m_next_frame = std::max(m_next_frame, now) + m_frame_period.value();
+}
+
+void FramePacer::beginFrame(float gpu_ms) {
+    m_frame_start = Clock::now();
+    m_timings.gpu_ms = gpu_ms;
+}
+
+void FramePacer::endFrame() {
+    m_timings.cpu_ms =
+        std::chrono::duration<float, std::milli>(Clock::now() - m_frame_start)
+            .count();
+}
+
+void FramePacer::presented() {
+    auto now = Clock::now();
+    if (m_last_present.has_value()) {
+        m_timings.present_interval_ms =
+            std::chrono::duration<float, std::milli>(now -
+                                                     m_last_present.value())
+                .count();
+    }
+    m_last_present = now;
+}
+
+}  // namespace vks
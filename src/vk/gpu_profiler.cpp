@@ -0,0 +1,205 @@
+#include "vk/gpu_profiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace vks {
+
+GpuProfiler::GpuProfiler(Device& device)
+    : device{device},
+      m_timestamp_period{device.info().properties.limits.timestampPeriod},
+      m_timestamp_mask{0},
+      m_enabled{false},
+      m_trace{nullptr},
+      m_frame_ms{0.0f} {
+    uint32_t count{};
+    vkGetPhysicalDeviceQueueFamilyProperties(device.m_physical_device, &count,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> families(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.m_physical_device, &count,
+                                             families.data());
+    auto bits =
+        families[device.info().queue_families.graphics].timestampValidBits;
+    if (bits != 0) {
+        m_timestamp_mask = bits >= 64 ? UINT64_MAX : (1ull << bits) - 1;
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (auto& slot : m_slots) {
+        vkDestroyQueryPool(*device, slot.pool,
+                           device.allocator(HostObject::QueryPool));
+    }
+}
+
+void GpuProfiler::setTrace(TraceWriter* trace) {
+    m_trace = trace;
+    if (m_trace != nullptr) {
+        m_trace->nameTrack(TraceWriter::Process::Gpu, GRAPHICS_TRACK,
+                           "graphics queue");
+        m_trace->nameTrack(TraceWriter::Process::Gpu, TRANSFER_TRACK,
+                           "transfer queue");
+    }
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer command, uint32_t slot) {
+    if (slot < m_slots.size() && m_slots[slot].pending) {
+        collect(m_slots[slot]);
+    }
+    if (!supported()) {
+        return;
+    }
+    if (slot >= m_slots.size()) {
+        m_slots.resize(slot + 1, Slot{VK_NULL_HANDLE, {}, {}, {}, false});
+    }
+    auto& frame = m_slots[slot];
+    if (frame.pool == VK_NULL_HANDLE) {
+        VkQueryPoolCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = MAX_SCOPES * 2;
+        if (vkCreateQueryPool(*device, &create_info,
+                              device.allocator(HostObject::QueryPool),
+                              &frame.pool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create profiler query pool");
+        }
+    }
+    frame.names.clear();
+    frame.depths.clear();
+    VK_CALL(vkCmdResetQueryPool)(command, frame.pool, 0,
+                                 m_enabled ? MAX_SCOPES * 2 : 2);
+
+    m_slot = slot;
+    m_open.clear();
+    begin(command, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer command) {
+    if (!m_slot.has_value()) {
+        return;
+    }
+    // Unbalanced scopes would leave queries unavailable forever
+    while (!m_open.empty()) {
+        end(command);
+    }
+    m_slots[m_slot.value()].pending = true;
+}
+
+void GpuProfiler::submitted() {
+    if (!m_slot.has_value()) {
+        return;
+    }
+    m_slots[m_slot.value()].submitted = Clock::now();
+    m_slot.reset();
+}
+
+void GpuProfiler::begin(VkCommandBuffer command, const std::string& name) {
+    if (!m_slot.has_value()) {
+        return;
+    }
+    auto& slot = m_slots[m_slot.value()];
+    if (slot.names.size() >= (m_enabled ? MAX_SCOPES : 1)) {
+        m_open.emplace_back();
+        return;
+    }
+    auto index = static_cast<uint32_t>(slot.names.size());
+    slot.names.push_back(name);
+    slot.depths.push_back(static_cast<uint32_t>(m_open.size()));
+    m_open.push_back(index);
+    // Both ends wait for the work recorded before them, scopes measure
+    // their own work rather than overlapping with the previous one
+    VK_CALL(vkCmdWriteTimestamp)(command, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 slot.pool, index * 2);
+}
+
+void GpuProfiler::end(VkCommandBuffer command) {
+    if (!m_slot.has_value() || m_open.empty()) {
+        return;
+    }
+    auto index = m_open.back();
+    m_open.pop_back();
+    if (index.has_value()) {
+        VK_CALL(vkCmdWriteTimestamp)(command,
+                                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                     m_slots[m_slot.value()].pool,
+                                     index.value() * 2 + 1);
+    }
+}
+
+void GpuProfiler::upload(const std::string& name, Clock::time_point submitted,
+                         Clock::time_point completed) {
+    if (m_trace != nullptr) {
+        m_trace->event(name, TraceWriter::Process::Gpu, TRANSFER_TRACK,
+                       submitted, completed);
+    }
+}
+
+void GpuProfiler::flush() {
+    for (auto& slot : m_slots) {
+        if (slot.pending) {
+            collect(slot);
+        }
+    }
+}
+
+void GpuProfiler::collect(Slot& slot) {
+    slot.pending = false;
+    auto count = static_cast<uint32_t>(slot.names.size());
+    if (count == 0) {
+        return;
+    }
+    std::vector<uint64_t> timestamps(count * 2);
+    if (vkGetQueryPoolResults(*device, slot.pool, 0, count * 2,
+                              timestamps.size() * sizeof(uint64_t),
+                              timestamps.data(), sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    // The clocks are only related through submission: a frame starts no
+    // earlier than it was submitted, nor earlier after the previous frame
+    // collected than the GPU clock has advanced
+    auto start = slot.submitted;
+    if (m_last_timestamp.has_value()) {
+        start = std::max(start,
+                         m_last_start + duration(ticksBetween(
+                                            m_last_timestamp.value(),
+                                            timestamps[0])));
+    }
+    m_last_timestamp = timestamps[0];
+    m_last_start = start;
+
+    auto milliseconds = [&](int64_t ticks) {
+        return std::chrono::duration<float, std::milli>(duration(ticks))
+            .count();
+    };
+    m_frame_ms = milliseconds(ticksBetween(timestamps[0], timestamps[1]));
+    m_scopes.clear();
+    for (uint32_t i{0}; i < count; i++) {
+        auto offset = ticksBetween(timestamps[0], timestamps[i * 2]);
+        auto length = ticksBetween(timestamps[i * 2], timestamps[i * 2 + 1]);
+        m_scopes.push_back({slot.names[i], slot.depths[i],
+                            milliseconds(offset), milliseconds(length)});
+        if (m_trace != nullptr) {
+            m_trace->event(slot.names[i], TraceWriter::Process::Gpu,
+                           GRAPHICS_TRACK, start + duration(offset),
+                           start + duration(offset + length));
+        }
+    }
+}
+
+int64_t GpuProfiler::ticksBetween(uint64_t from, uint64_t to) const {
+    auto forward = (to - from) & m_timestamp_mask;
+    if (forward <= m_timestamp_mask / 2) {
+        return static_cast<int64_t>(forward);
+    }
+    return -static_cast<int64_t>((from - to) & m_timestamp_mask);
+}
+
+GpuProfiler::Clock::duration GpuProfiler::duration(int64_t ticks) const {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::nano>(
+            static_cast<double>(ticks) * m_timestamp_period));
+}
+
+}  // namespace vks
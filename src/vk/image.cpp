@@ -32,7 +32,8 @@ Image2D::Image2D(Device& device, uint32_t width, uint32_t height,
                                  ? VK_SHARING_MODE_CONCURRENT
                                  : VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateImage(*device, &image_info, nullptr, &m_image) != VK_SUCCESS) {
+    if (vkCreateImage(*device, &image_info, device.allocator(HostObject::Image),
+                      &m_image) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create image");
     }
 }
@@ -51,7 +52,7 @@ void Image2D::bindMemory(VkDeviceMemory memory, VkDeviceSize offset) {
 
 Image2D::~Image2D() {
     if (m_image != VK_NULL_HANDLE) {
-        vkDestroyImage(*device, m_image, nullptr);
+        vkDestroyImage(*device, m_image, device.allocator(HostObject::Image));
     }
 }
 
@@ -70,15 +71,17 @@ ImageView2D::ImageView2D(Device& device, Image2D& image,
     view_info.subresourceRange.layerCount = image.m_layers;
     view_info.subresourceRange.levelCount = image.m_levels;
 
-    if (vkCreateImageView(*device, &view_info, nullptr, &m_view) !=
-        VK_SUCCESS) {
+    if (vkCreateImageView(*device, &view_info,
+                          device.allocator(HostObject::ImageView),
+                          &m_view) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create image view");
     }
 }
 
 ImageView2D::~ImageView2D() {
     if (m_view != VK_NULL_HANDLE) {
-        vkDestroyImageView(*device, m_view, nullptr);
+        vkDestroyImageView(*device, m_view,
+                           device.allocator(HostObject::ImageView));
     }
 }
 
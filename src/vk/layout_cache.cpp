@@ -0,0 +1,168 @@
+#include "vk/layout_cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace vks {
+
+LayoutCache::LayoutCache(Device& device) : device{device} {}
+
+LayoutCache::~LayoutCache() {
+    for (auto& [key, layout] : m_pipeline_layouts) {
+        vkDestroyPipelineLayout(*device, layout,
+                                device.allocator(HostObject::PipelineLayout));
+    }
+    for (auto& [key, layout] : m_set_layouts) {
+        vkDestroyDescriptorSetLayout(
+            *device, layout, device.allocator(HostObject::DescriptorSetLayout));
+    }
+}
+
+VkDescriptorSetLayout LayoutCache::setLayout(
+    const ShaderInterface::SetBindings& bindings) {
+    Key key{};
+    key.reserve(bindings.size() * 4);
+    for (const auto& binding : bindings) {
+        key.insert(key.end(),
+                   {binding.binding,
+                    static_cast<uint64_t>(binding.descriptorType),
+                    binding.descriptorCount, binding.stageFlags});
+    }
+    auto item = m_set_layouts.find(key);
+    if (item != m_set_layouts.end()) {
+        return item->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = bindings.size();
+    layout_info.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(
+        *device, &layout_info,
+        device.allocator(HostObject::DescriptorSetLayout),
+        &layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout");
+    }
+    m_set_layouts.emplace(std::move(key), layout);
+    return layout;
+}
+
+VkDescriptorSetLayout LayoutCache::requireSetLayout(
+    uint32_t set, const ShaderInterface::SetBindings& bindings) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto layout = setLayout(bindings);
+    m_required_sets[set] = {bindings, layout};
+    return layout;
+}
+
+VkPipelineLayout LayoutCache::pipelineLayout(const ShaderInterface& interface) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    uint32_t set_count{0};
+    if (!interface.sets.empty()) {
+        set_count = interface.sets.rbegin()->first + 1;
+    }
+    if (!m_required_sets.empty()) {
+        set_count = std::max(set_count, m_required_sets.rbegin()->first + 1);
+    }
+
+    // Sets required by the engine keep their fixed layout so descriptors
+    // allocated for them stay bindable, shaders may only use a subset of them
+    std::vector<VkDescriptorSetLayout> set_layouts(set_count);
+    for (uint32_t set{0}; set < set_count; set++) {
+        auto reflected = interface.sets.find(set);
+        auto required = m_required_sets.find(set);
+        if (required == m_required_sets.end()) {
+            set_layouts[set] = setLayout(reflected != interface.sets.end()
+                                             ? reflected->second
+                                             : ShaderInterface::SetBindings{});
+            continue;
+        }
+        if (reflected != interface.sets.end()) {
+            const auto& required_bindings = required->second.first;
+            for (const auto& binding : reflected->second) {
+                auto match = std::find_if(
+                    required_bindings.begin(), required_bindings.end(),
+                    [&](auto& b) { return b.binding == binding.binding; });
+                if (match == required_bindings.end() ||
+                    match->descriptorType != binding.descriptorType ||
+                    match->descriptorCount != binding.descriptorCount ||
+                    (binding.stageFlags & ~match->stageFlags) != 0) {
+                    throw std::runtime_error(
+                        "Shader resource at set " + std::to_string(set) +
+                        " binding " + std::to_string(binding.binding) +
+                        " does not match engine descriptor set layout");
+                }
+            }
+        }
+        set_layouts[set] = required->second.second;
+    }
+    return cachedLayout(std::move(set_layouts), interface.push_ranges);
+}
+
+VkPipelineLayout LayoutCache::computeLayout(const ShaderInterface& interface) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    uint32_t set_count{0};
+    if (!interface.sets.empty()) {
+        set_count = interface.sets.rbegin()->first + 1;
+    }
+    std::vector<VkDescriptorSetLayout> set_layouts(set_count);
+    for (uint32_t set{0}; set < set_count; set++) {
+        auto reflected = interface.sets.find(set);
+        set_layouts[set] = setLayout(reflected != interface.sets.end()
+                                         ? reflected->second
+                                         : ShaderInterface::SetBindings{});
+    }
+    return cachedLayout(std::move(set_layouts), interface.push_ranges);
+}
+
+VkPipelineLayout LayoutCache::cachedLayout(
+    std::vector<VkDescriptorSetLayout>&& set_layouts,
+    const std::vector<VkPushConstantRange>& push_ranges) {
+    Key key{};
+    for (auto layout : set_layouts) {
+        key.push_back((uint64_t)layout);
+    }
+    key.push_back(UINT64_MAX);
+    for (const auto& range : push_ranges) {
+        key.insert(key.end(), {range.stageFlags, range.offset, range.size});
+    }
+    auto item = m_pipeline_layouts.find(key);
+    if (item != m_pipeline_layouts.end()) {
+        return item->second;
+    }
+
+    VkPipelineLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = set_layouts.size();
+    layout_info.pSetLayouts = set_layouts.data();
+    layout_info.pushConstantRangeCount = push_ranges.size();
+    layout_info.pPushConstantRanges = push_ranges.data();
+
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(*device, &layout_info,
+                               device.allocator(HostObject::PipelineLayout),
+                               &layout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout");
+    }
+    m_pipeline_layouts.emplace(std::move(key), layout);
+    m_pipeline_set_layouts.emplace(layout, std::move(set_layouts));
+    return layout;
+}
+
+VkDescriptorSetLayout LayoutCache::pipelineSetLayout(VkPipelineLayout layout,
+                                                     uint32_t set) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto& set_layouts = m_pipeline_set_layouts.at(layout);
+    if (set >= set_layouts.size()) {
+        throw std::runtime_error("Pipeline layout has no descriptor set " +
+                                 std::to_string(set));
+    }
+    return set_layouts[set];
+}
+
+}  // namespace vks
@@ -0,0 +1,225 @@
+#include "vk/memory_tracker.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace magic_enum;
+
+namespace vks {
+
+namespace {
+const char* SCOPE_NAMES[]{"command", "object", "cache", "device",
+                          "instance"};
+
+void raisePeak(std::atomic<size_t>& peak, size_t bytes) {
+    auto current = peak.load(std::memory_order_relaxed);
+    while (current < bytes &&
+           !peak.compare_exchange_weak(current, bytes,
+                                       std::memory_order_relaxed)) {
+    }
+}
+}  // namespace
+
+std::string MemoryTracker::formatBytes(uint64_t bytes) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (bytes >= (1ull << 20)) {
+        out << bytes / double(1ull << 20) << " MiB";
+    } else if (bytes >= (1ull << 10)) {
+        out << bytes / double(1ull << 10) << " KiB";
+    } else {
+        out << bytes << " B";
+    }
+    return out.str();
+}
+
+MemoryTracker::MemoryTracker() {
+    for (size_t i{0}; i < OBJECT_COUNT; i++) {
+        auto& callbacks = m_callbacks[i];
+        callbacks.pUserData = &m_counters[i];
+        callbacks.pfnAllocation = allocate;
+        callbacks.pfnReallocation = reallocate;
+        callbacks.pfnFree = free;
+        callbacks.pfnInternalAllocation = internalAllocation;
+        callbacks.pfnInternalFree = internalFree;
+    }
+}
+
+void* MemoryTracker::allocate(void* user_data, size_t size, size_t alignment,
+                              VkSystemAllocationScope scope) {
+    if (size == 0) {
+        return nullptr;
+    }
+    // Alignments are powers of two, the header sits right before the result
+    alignment = std::max(alignment, alignof(Header));
+    auto* raw = std::malloc(size + sizeof(Header) + alignment - 1);
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    auto address = reinterpret_cast<uintptr_t>(raw) + sizeof(Header);
+    address = (address + alignment - 1) & ~uintptr_t(alignment - 1);
+    auto* memory = reinterpret_cast<char*>(address);
+    Header header{raw, size, scope};
+    std::memcpy(memory - sizeof(Header), &header, sizeof(Header));
+
+    auto& counters = *static_cast<Counters*>(user_data);
+    auto bytes =
+        counters.bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    raisePeak(counters.peak_bytes, bytes);
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.scope_bytes[scope].fetch_add(size, std::memory_order_relaxed);
+    return memory;
+}
+
+void* MemoryTracker::reallocate(void* user_data, void* original, size_t size,
+                                size_t alignment,
+                                VkSystemAllocationScope scope) {
+    if (original == nullptr) {
+        return allocate(user_data, size, alignment, scope);
+    }
+    if (size == 0) {
+        free(user_data, original);
+        return nullptr;
+    }
+    Header header;
+    std::memcpy(&header, static_cast<char*>(original) - sizeof(Header),
+                sizeof(Header));
+    auto* memory = allocate(user_data, size, alignment, header.scope);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    std::memcpy(memory, original, std::min(size, header.size));
+    free(user_data, original);
+    return memory;
+}
+
+void MemoryTracker::free(void* user_data, void* memory) {
+    if (memory == nullptr) {
+        return;
+    }
+    Header header;
+    std::memcpy(&header, static_cast<char*>(memory) - sizeof(Header),
+                sizeof(Header));
+    auto& counters = *static_cast<Counters*>(user_data);
+    counters.bytes.fetch_sub(header.size, std::memory_order_relaxed);
+    counters.allocations.fetch_sub(1, std::memory_order_relaxed);
+    counters.scope_bytes[header.scope].fetch_sub(header.size,
+                                                 std::memory_order_relaxed);
+    std::free(header.raw);
+}
+
+void MemoryTracker::internalAllocation(void* user_data, size_t size,
+                                       VkInternalAllocationType,
+                                       VkSystemAllocationScope) {
+    auto& counters = *static_cast<Counters*>(user_data);
+    counters.internal_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void MemoryTracker::internalFree(void* user_data, size_t size,
+                                 VkInternalAllocationType,
+                                 VkSystemAllocationScope) {
+    auto& counters = *static_cast<Counters*>(user_data);
+    counters.internal_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+HostMemoryStats MemoryTracker::host(HostObject object) const {
+    const auto& counters = m_counters[static_cast<size_t>(object)];
+    HostMemoryStats stats{};
+    stats.bytes = counters.bytes.load(std::memory_order_relaxed);
+    stats.peak_bytes = counters.peak_bytes.load(std::memory_order_relaxed);
+    stats.allocations = counters.allocations.load(std::memory_order_relaxed);
+    for (size_t i{0}; i < stats.scope_bytes.size(); i++) {
+        stats.scope_bytes[i] =
+            counters.scope_bytes[i].load(std::memory_order_relaxed);
+    }
+    stats.internal_bytes =
+        counters.internal_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void MemoryTracker::allocated(VkDeviceMemory memory, const std::string& owner,
+                              VkDeviceSize size, uint32_t heap) {
+    std::lock_guard lock{m_mutex};
+    m_allocations.emplace(memory, Allocation{owner, size, heap});
+    auto& stats = m_owners[owner];
+    stats.bytes += size;
+    stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes);
+    stats.allocations++;
+    m_heap_bytes[heap] += size;
+}
+
+void MemoryTracker::freed(VkDeviceMemory memory) {
+    std::lock_guard lock{m_mutex};
+    auto it = m_allocations.find(memory);
+    if (it == m_allocations.end()) {
+        return;
+    }
+    auto& stats = m_owners[it->second.owner];
+    stats.bytes -= it->second.size;
+    stats.allocations--;
+    m_heap_bytes[it->second.heap] -= it->second.size;
+    m_allocations.erase(it);
+}
+
+std::unordered_map<std::string, DeviceMemoryStats> MemoryTracker::owners()
+    const {
+    std::lock_guard lock{m_mutex};
+    return m_owners;
+}
+
+VkDeviceSize MemoryTracker::heapBytes(uint32_t heap) const {
+    std::lock_guard lock{m_mutex};
+    return m_heap_bytes[heap];
+}
+
+void MemoryTracker::report(std::ostream& out) const {
+    out << "Host memory per object type:\n";
+    HostMemoryStats total{};
+    for (auto object : enum_values<HostObject>()) {
+        auto stats = host(object);
+        if (stats.peak_bytes == 0 && stats.internal_bytes == 0) {
+            continue;
+        }
+        out << "  " << std::left << std::setw(20) << enum_name(object)
+            << std::right << formatBytes(stats.bytes) << " in "
+            << stats.allocations << " allocations, peak "
+            << formatBytes(stats.peak_bytes);
+        for (size_t i{0}; i < stats.scope_bytes.size(); i++) {
+            if (stats.scope_bytes[i] != 0) {
+                out << ", " << SCOPE_NAMES[i] << ' '
+                    << formatBytes(stats.scope_bytes[i]);
+            }
+        }
+        if (stats.internal_bytes != 0) {
+            out << ", internal " << formatBytes(stats.internal_bytes);
+        }
+        out << '\n';
+        total.bytes += stats.bytes;
+        total.allocations += stats.allocations;
+        total.internal_bytes += stats.internal_bytes;
+    }
+    out << "  total " << formatBytes(total.bytes) << " in "
+        << total.allocations << " allocations, internal "
+        << formatBytes(total.internal_bytes) << '\n';
+
+    auto owners = this->owners();
+    std::vector<std::pair<std::string, DeviceMemoryStats>> sorted{
+        owners.begin(), owners.end()};
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    out << "Device memory per owner:\n";
+    for (const auto& [owner, stats] : sorted) {
+        out << "  " << std::left << std::setw(20) << owner << std::right
+            << formatBytes(stats.bytes) << " in " << stats.allocations
+            << " allocations, peak " << formatBytes(stats.peak_bytes)
+            << '\n';
+    }
+}
+
+}  // namespace vks
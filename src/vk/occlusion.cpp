@@ -0,0 +1,548 @@
+#include "vk/occlusion.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "embedded_shaders.h"
+
+namespace vks {
+
+constexpr uint32_t REDUCE_GROUP_SIZE{8};
+constexpr uint32_t CULL_GROUP_SIZE{64};
+// Boxes reaching behind this clip space w are never culled
+constexpr float NEAR_W{1e-4f};
+
+static std::vector<char> embeddedCompute(ShaderProgram program) {
+    const auto& embedded = embeddedProgram(program);
+    for (size_t i{0}; i < embedded.stage_count; i++) {
+        const auto& stage = embedded.stages[i];
+        if (stage.stage == VK_SHADER_STAGE_COMPUTE_BIT) {
+            auto bytes = reinterpret_cast<const char*>(stage.code);
+            return {bytes, bytes + stage.size * sizeof(uint32_t)};
+        }
+    }
+    throw std::runtime_error("Embedded program has no compute shader: " +
+                             std::string{embedded.name});
+}
+
+OcclusionCuller::OcclusionCuller(Device& device, LayoutCache& layouts)
+    : device{device},
+      m_layouts{layouts},
+      m_pyramid{},
+      m_fresh{true},
+      m_pyramid_camera{1.0f},
+      m_slot{0},
+      m_draw_count{0},
+      m_visibility{VK_NULL_HANDLE},
+      m_visibility_memory{VK_NULL_HANDLE},
+      m_visibility_capacity{0} {}
+
+OcclusionCuller::~OcclusionCuller() {
+    releaseRetired(UINT64_MAX);
+    destroyPyramid(m_pyramid);
+    for (auto& slot : m_slots) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkUnmapMemory(*device, slot.memory);
+            vkDestroyBuffer(*device, slot.buffer,
+                            device.allocator(HostObject::Buffer));
+            device.freeMemory(slot.memory);
+        }
+        vkDestroyDescriptorPool(*device, slot.pool,
+                                device.allocator(HostObject::DescriptorPool));
+    }
+    vkDestroyBuffer(*device, m_visibility,
+                    device.allocator(HostObject::Buffer));
+    device.freeMemory(m_visibility_memory);
+}
+
+bool OcclusionCuller::supported(Device& device) {
+    VkFormatProperties depth{};
+    vkGetPhysicalDeviceFormatProperties(
+        device.m_physical_device, device.info().depth_format, &depth);
+    VkFormatProperties pyramid{};
+    vkGetPhysicalDeviceFormatProperties(device.m_physical_device,
+                                        PYRAMID_FORMAT, &pyramid);
+    return (depth.optimalTilingFeatures &
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
+           (pyramid.optimalTilingFeatures &
+            VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+}
+
+void OcclusionCuller::createPipelines() {
+    if (m_reduce.has_value()) {
+        return;
+    }
+    m_reduce.emplace(ComputePipeline{
+        device, embeddedCompute(ShaderProgram::hiz_reduce), "hiz_reduce",
+        m_layouts, {}});
+    m_cull.emplace(ComputePipeline{device,
+                                   embeddedCompute(ShaderProgram::hiz_cull),
+                                   "hiz_cull", m_layouts, {}});
+}
+
+void OcclusionCuller::createPyramid(VkExtent2D extent) {
+    m_pyramid = {};
+    m_pyramid.extent = extent;
+    // Level zero already halves the depth buffer
+    VkExtent2D level{(extent.width + 1) / 2, (extent.height + 1) / 2};
+    while (m_pyramid.level_extents.size() < MAX_LEVELS) {
+        m_pyramid.level_extents.push_back(level);
+        if (level.width == 1 && level.height == 1) {
+            break;
+        }
+        level = {(level.width + 1) / 2, (level.height + 1) / 2};
+    }
+    uint32_t levels = m_pyramid.level_extents.size();
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.extent = {m_pyramid.level_extents[0].width,
+                         m_pyramid.level_extents[0].height, 1};
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = PYRAMID_FORMAT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.mipLevels = levels;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    if (vkCreateImage(*device, &image_info, device.allocator(HostObject::Image),
+                      &m_pyramid.image) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid");
+    }
+
+    VkMemoryRequirements requirements{};
+    vkGetImageMemoryRequirements(*device, m_pyramid.image, &requirements);
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = device.getMemoryIndex(
+        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (device.allocateMemory(alloc_info, "depth pyramid", &m_pyramid.memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate depth pyramid memory");
+    }
+    vkBindImageMemory(*device, m_pyramid.image, m_pyramid.memory, 0);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.format = PYRAMID_FORMAT;
+    view_info.image = m_pyramid.image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.layerCount = 1;
+    view_info.subresourceRange.levelCount = levels;
+    if (vkCreateImageView(*device, &view_info,
+                          device.allocator(HostObject::ImageView),
+                          &m_pyramid.view) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid view");
+    }
+    // Storage views address a single level
+    view_info.subresourceRange.levelCount = 1;
+    for (uint32_t i{0}; i < levels; i++) {
+        view_info.subresourceRange.baseMipLevel = i;
+        auto& view = m_pyramid.level_views.emplace_back();
+        if (vkCreateImageView(*device, &view_info,
+                              device.allocator(HostObject::ImageView),
+                              &view) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create depth pyramid view");
+        }
+    }
+    m_fresh = true;
+}
+
+void OcclusionCuller::destroyPyramid(Pyramid& pyramid) {
+    for (auto view : pyramid.level_views) {
+        vkDestroyImageView(*device, view,
+                           device.allocator(HostObject::ImageView));
+    }
+    vkDestroyImageView(*device, pyramid.view,
+                       device.allocator(HostObject::ImageView));
+    vkDestroyImage(*device, pyramid.image, device.allocator(HostObject::Image));
+    device.freeMemory(pyramid.memory);
+    pyramid = {};
+}
+
+void OcclusionCuller::createSlot(Slot& slot) {
+    slot = {};
+    std::array<VkDescriptorPoolSize, 3> pool_sizes{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    pool_sizes[0].descriptorCount = MAX_LEVELS + 1;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    pool_sizes[1].descriptorCount = MAX_LEVELS;
+    pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[2].descriptorCount = 3;
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets = MAX_LEVELS + 1;
+    pool_info.poolSizeCount = pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+    if (vkCreateDescriptorPool(*device, &pool_info,
+                               device.allocator(HostObject::DescriptorPool),
+                               &slot.pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create culling descriptor pool");
+    }
+
+    std::array<VkDescriptorSetLayout, MAX_LEVELS + 1> layouts{};
+    std::fill(layouts.begin(), layouts.end() - 1,
+              m_layouts.pipelineSetLayout(m_reduce->m_layout, 0));
+    layouts.back() = m_layouts.pipelineSetLayout(m_cull->m_layout, 0);
+    std::array<VkDescriptorSet, MAX_LEVELS + 1> sets{};
+
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = slot.pool;
+    alloc_info.descriptorSetCount = layouts.size();
+    alloc_info.pSetLayouts = layouts.data();
+    if (vkAllocateDescriptorSets(*device, &alloc_info, sets.data()) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate culling descriptor sets");
+    }
+    std::copy(sets.begin(), sets.end() - 1, slot.reduce_sets.begin());
+    slot.cull_set = sets.back();
+}
+
+void OcclusionCuller::allocateDrawBuffer(Slot& slot, size_t capacity) {
+    if (slot.buffer != VK_NULL_HANDLE) {
+        vkUnmapMemory(*device, slot.memory);
+        vkDestroyBuffer(*device, slot.buffer,
+                        device.allocator(HostObject::Buffer));
+        device.freeMemory(slot.memory);
+    }
+    auto alignment =
+        device.info().properties.limits.minStorageBufferOffsetAlignment;
+    slot.capacity = capacity;
+    slot.command_offset = (capacity * sizeof(Bounds) + alignment - 1) /
+                          alignment * alignment;
+
+    VkBufferCreateInfo buffer_info{};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.queueFamilyIndexCount = 1;
+    buffer_info.pQueueFamilyIndices = &device.info().queue_families.graphics;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.size = slot.command_offset +
+                       capacity * sizeof(VkDrawIndexedIndirectCommand);
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    if (vkCreateBuffer(*device, &buffer_info,
+                       device.allocator(HostObject::Buffer),
+                       &slot.buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create culling draw buffer");
+    }
+    VkMemoryRequirements requirements{};
+    vkGetBufferMemoryRequirements(*device, slot.buffer, &requirements);
+
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = device.getMemoryIndex(
+        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (device.allocateMemory(alloc_info, "culling draws", &slot.memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate culling draw buffer");
+    }
+    vkBindBufferMemory(*device, slot.buffer, slot.memory, 0);
+
+    void* data{};
+    if (vkMapMemory(*device, slot.memory, 0, VK_WHOLE_SIZE, 0, &data) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to map culling draw buffer");
+    }
+    slot.data = static_cast<uint8_t*>(data);
+}
+
+void OcclusionCuller::allocateVisibility(size_t capacity, uint64_t serial) {
+    if (m_visibility != VK_NULL_HANDLE) {
+        m_retired_buffers.push_back(
+            {serial, m_visibility, m_visibility_memory});
+    }
+    m_visibility_capacity = capacity;
+
+    VkBufferCreateInfo buffer_info{};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.queueFamilyIndexCount = 1;
+    buffer_info.pQueueFamilyIndices = &device.info().queue_families.graphics;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.size = capacity * sizeof(uint32_t);
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    if (vkCreateBuffer(*device, &buffer_info,
+                       device.allocator(HostObject::Buffer),
+                       &m_visibility) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create visibility buffer");
+    }
+    VkMemoryRequirements requirements{};
+    vkGetBufferMemoryRequirements(*device, m_visibility, &requirements);
+
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    alloc_info.memoryTypeIndex = device.getMemoryIndex(
+        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (device.allocateMemory(alloc_info, "visibility", &m_visibility_memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate visibility buffer");
+    }
+    vkBindBufferMemory(*device, m_visibility, m_visibility_memory, 0);
+}
+
+void OcclusionCuller::releaseRetired(uint64_t completed_serial) {
+    auto pyramids = std::remove_if(
+        m_retired_pyramids.begin(), m_retired_pyramids.end(),
+        [&](Pyramid& pyramid) {
+            if (pyramid.serial > completed_serial) {
+                return false;
+            }
+            destroyPyramid(pyramid);
+            return true;
+        });
+    m_retired_pyramids.erase(pyramids, m_retired_pyramids.end());
+
+    auto buffers = std::remove_if(
+        m_retired_buffers.begin(), m_retired_buffers.end(),
+        [&](const RetiredBuffer& retired) {
+            if (retired.serial > completed_serial) {
+                return false;
+            }
+            vkDestroyBuffer(*device, retired.buffer,
+                            device.allocator(HostObject::Buffer));
+            device.freeMemory(retired.memory);
+            return true;
+        });
+    m_retired_buffers.erase(buffers, m_retired_buffers.end());
+}
+
+void OcclusionCuller::prepare(uint32_t slot, VkExtent2D extent,
+                              const glm::mat4& camera,
+                              const std::vector<Draw>& draws, uint64_t serial,
+                              uint64_t completed_serial) {
+    createPipelines();
+    releaseRetired(completed_serial);
+
+    if (m_pyramid.image == VK_NULL_HANDLE ||
+        m_pyramid.extent.width != extent.width ||
+        m_pyramid.extent.height != extent.height) {
+        if (m_pyramid.image != VK_NULL_HANDLE) {
+            m_pyramid.serial = serial;
+            m_retired_pyramids.push_back(std::move(m_pyramid));
+        }
+        createPyramid(extent);
+    }
+    if (m_visibility_capacity < draws.size()) {
+        allocateVisibility(std::max<size_t>(draws.size(), 64), serial);
+    }
+
+    if (m_slots.size() <= slot) {
+        auto created = m_slots.size();
+        m_slots.resize(slot + 1);
+        for (auto i = created; i < m_slots.size(); i++) {
+            createSlot(m_slots[i]);
+        }
+    }
+    m_slot = slot;
+    m_draw_count = draws.size();
+    auto& current = m_slots[slot];
+    if (current.capacity < draws.size()) {
+        allocateDrawBuffer(current, std::max<size_t>(draws.size(), 64));
+    }
+
+    // The first phase projects into the pyramid as it was rendered, the
+    // second into the one built from this frame's depth
+    auto bounds = reinterpret_cast<Bounds*>(current.data);
+    auto commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(
+        current.data + current.command_offset);
+    for (size_t i{0}; i < draws.size(); i++) {
+        project(m_pyramid_camera, draws[i], 0, bounds[i]);
+        project(camera, draws[i], 1, bounds[i]);
+        commands[i] = {draws[i].index_count, 1, 0, 0, 0};
+    }
+    m_pyramid_camera = camera;
+
+    VkDescriptorImageInfo pyramid_info{};
+    pyramid_info.imageView = m_pyramid.view;
+    pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    std::array<VkDescriptorBufferInfo, 3> buffer_infos{};
+    buffer_infos[0] = {current.buffer, 0,
+                       std::max<size_t>(draws.size(), 1) * sizeof(Bounds)};
+    buffer_infos[1] = {current.buffer, current.command_offset,
+                       std::max<size_t>(draws.size(), 1) *
+                           sizeof(VkDrawIndexedIndirectCommand)};
+    buffer_infos[2] = {m_visibility, 0, VK_WHOLE_SIZE};
+
+    std::array<VkWriteDescriptorSet, 4> writes{};
+    for (uint32_t i{0}; i < writes.size(); i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = current.cull_set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        if (i == 0) {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+            writes[i].pImageInfo = &pyramid_info;
+        } else {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &buffer_infos[i - 1];
+        }
+    }
+    VK_CALL(vkUpdateDescriptorSets)(*device, writes.size(), writes.data(), 0,
+                                    nullptr);
+}
+
+void OcclusionCuller::project(const glm::mat4& view_projection,
+                              const Draw& draw, uint32_t phase,
+                              Bounds& bounds) const {
+    auto matrix = view_projection * draw.transform;
+    glm::vec2 low{1.0f};
+    glm::vec2 high{0.0f};
+    float depth{1.0f};
+    for (uint32_t corner{0}; corner < 8; corner++) {
+        glm::vec4 position{corner & 1 ? draw.max.x : draw.min.x,
+                           corner & 2 ? draw.max.y : draw.min.y,
+                           corner & 4 ? draw.max.z : draw.min.z, 1.0f};
+        auto clip = matrix * position;
+        if (clip.w <= NEAR_W) {
+            bounds.texels[phase] = glm::ivec4{0};
+            bounds.depth[phase] = 0.0f;
+            bounds.level[phase] = 0;
+            return;
+        }
+        auto ndc = glm::vec3{clip} / clip.w;
+        // The viewport is flipped, NDC y points up
+        glm::vec2 uv{0.5f + 0.5f * ndc.x, 0.5f - 0.5f * ndc.y};
+        low = glm::min(low, uv);
+        high = glm::max(high, uv);
+        depth = std::min(depth, ndc.z);
+    }
+    low = glm::clamp(low, 0.0f, 1.0f);
+    high = glm::clamp(high, 0.0f, 1.0f);
+
+    // Level zero texels cover 2x2 depth texels
+    glm::vec2 scale{m_pyramid.extent.width * 0.5f,
+                    m_pyramid.extent.height * 0.5f};
+    glm::ivec2 first{low * scale};
+    glm::ivec2 last{high * scale};
+    // Lowest level at which the rectangle spans at most 2x2 texels
+    int32_t level{0};
+    int32_t levels = m_pyramid.level_extents.size();
+    while (level + 1 < levels &&
+           ((last.x >> level) - (first.x >> level) > 1 ||
+            (last.y >> level) - (first.y >> level) > 1)) {
+        level++;
+    }
+    const auto& extent = m_pyramid.level_extents[level];
+    glm::ivec2 limit{static_cast<int32_t>(extent.width) - 1,
+                     static_cast<int32_t>(extent.height) - 1};
+    first = glm::min(glm::ivec2{first.x >> level, first.y >> level}, limit);
+    last = glm::min(glm::ivec2{last.x >> level, last.y >> level}, limit);
+    bounds.texels[phase] = {first.x, first.y, last.x, last.y};
+    bounds.depth[phase] = std::max(depth, 0.0f);
+    bounds.level[phase] = level;
+}
+
+void OcclusionCuller::recordClear(VkCommandBuffer command) {
+    VkClearColorValue far{{1.0f, 0.0f, 0.0f, 0.0f}};
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = VK_REMAINING_MIP_LEVELS;
+    range.layerCount = 1;
+    VK_CALL(vkCmdClearColorImage)(command, m_pyramid.image,
+                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &far, 1,
+                                  &range);
+    m_fresh = false;
+}
+
+void OcclusionCuller::recordCull(VkCommandBuffer command, uint32_t phase) {
+    if (m_draw_count == 0) {
+        return;
+    }
+    const auto& cull = m_cull.value();
+    VK_CALL(vkCmdBindPipeline)(command, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               cull.m_pipeline);
+    VK_CALL(vkCmdBindDescriptorSets)(command, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                     cull.m_layout, 0, 1,
+                                     &m_slots[m_slot].cull_set, 0, nullptr);
+    std::array<uint32_t, 2> constants{m_draw_count, phase};
+    VK_CALL(vkCmdPushConstants)(command, cull.m_layout,
+                                VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                sizeof(constants), constants.data());
+    VK_CALL(vkCmdDispatch)(
+        command, (m_draw_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+}
+
+void OcclusionCuller::recordPyramid(VkCommandBuffer command,
+                                    VkImageView depth) {
+    const auto& reduce = m_reduce.value();
+    const auto& slot = m_slots[m_slot];
+    auto levels = m_pyramid.level_views.size();
+
+    // Each level reduces the one below it, level zero the depth buffer
+    std::vector<VkDescriptorImageInfo> image_infos(levels * 2);
+    std::vector<VkWriteDescriptorSet> writes(levels * 2);
+    for (size_t i{0}; i < levels; i++) {
+        auto& source = image_infos[i * 2];
+        source.imageView = i == 0 ? depth : m_pyramid.level_views[i - 1];
+        source.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                    : VK_IMAGE_LAYOUT_GENERAL;
+        auto& target = image_infos[i * 2 + 1];
+        target.imageView = m_pyramid.level_views[i];
+        target.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        for (uint32_t binding{0}; binding < 2; binding++) {
+            auto& write = writes[i * 2 + binding];
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = slot.reduce_sets[i];
+            write.dstBinding = binding;
+            write.descriptorCount = 1;
+            write.descriptorType = binding == 0
+                                       ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+                                       : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            write.pImageInfo = &image_infos[i * 2 + binding];
+        }
+    }
+    VK_CALL(vkUpdateDescriptorSets)(*device, writes.size(), writes.data(), 0,
+                                    nullptr);
+
+    VK_CALL(vkCmdBindPipeline)(command, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               reduce.m_pipeline);
+    for (size_t i{0}; i < levels; i++) {
+        if (i > 0) {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = m_pyramid.image;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel = i - 1;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.layerCount = 1;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            VK_CALL(vkCmdPipelineBarrier)(
+                command, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                nullptr, 1, &barrier);
+        }
+        const auto& target = m_pyramid.level_extents[i];
+        const auto& source =
+            i == 0 ? m_pyramid.extent : m_pyramid.level_extents[i - 1];
+        std::array<int32_t, 4> extents{
+            static_cast<int32_t>(source.width),
+            static_cast<int32_t>(source.height),
+            static_cast<int32_t>(target.width),
+            static_cast<int32_t>(target.height)};
+        VK_CALL(vkCmdBindDescriptorSets)(
+            command, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.m_layout, 0, 1,
+            &slot.reduce_sets[i], 0, nullptr);
+        VK_CALL(vkCmdPushConstants)(command, reduce.m_layout,
+                                    VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                    sizeof(extents), extents.data());
+        VK_CALL(vkCmdDispatch)(
+            command, (target.width + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE,
+            (target.height + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+    }
+}
+
+}  // namespace vks
@@ -1,20 +1,109 @@
 #include "vk/pipeline.h"
 
+#include <array>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 
 #include "resources.h"
+#include "vk/shader_reflection.h"
 
 using namespace std::string_literals;
 
 namespace vks {
 
+namespace {
+
+void fillSpecialization(const std::map<uint32_t, uint32_t>& constants,
+                        std::vector<VkSpecializationMapEntry>& entries,
+                        std::vector<uint32_t>& data,
+                        VkSpecializationInfo& info) {
+    for (const auto& [id, value] : constants) {
+        VkSpecializationMapEntry entry{};
+        entry.constantID = id;
+        entry.offset = data.size() * sizeof(uint32_t);
+        entry.size = sizeof(uint32_t);
+        entries.push_back(entry);
+        data.push_back(value);
+    }
+    info.mapEntryCount = entries.size();
+    info.pMapEntries = entries.data();
+    info.dataSize = data.size() * sizeof(uint32_t);
+    info.pData = data.data();
+}
+
+void validateConstants(const ShaderInterface& interface,
+                       const std::map<uint32_t, uint32_t>& constants) {
+    for (const auto& [id, value] : constants) {
+        if (!interface.spec_constants.count(id)) {
+            throw std::runtime_error("Specialization constant " +
+                                     std::to_string(id) +
+                                     " not declared by shaders");
+        }
+    }
+}
+
+}  // namespace
+
 GraphicsPipeline::GraphicsPipeline(Device& device, RenderPass& renderPass,
                                    const std::filesystem::path& dir,
-                                   VkPipelineLayout layout,
-                                   const VertexAttribs& attribs)
-    : device(device) {
+                                   LayoutCache& layouts,
+                                   const PipelineVariant& variant)
+    : GraphicsPipeline(device, renderPass, loadProgramSource(dir), dir.string(),
+                       layouts, variant) {}
+
+GraphicsPipeline::GraphicsPipeline(Device& device, RenderPass& renderPass,
+                                   const ProgramSource& source,
+                                   const std::string& name,
+                                   LayoutCache& layouts,
+                                   const PipelineVariant& variant)
+    : device(device), m_pipeline{VK_NULL_HANDLE}, m_push_ranges{} {
+    ShaderInterface interface{};
+    try {
+        for (const auto& [stage, code] : source) {
+            interface.merge(ShaderInterface::reflect(
+                code, static_cast<VkShaderStageFlagBits>(stage)));
+        }
+        interface.validateVertexInput(variant.attribs.attributes);
+        validateConstants(interface, variant.constants);
+        m_layout = layouts.pipelineLayout(interface);
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error("Invalid shader interface at: "s + name +
+                                 ": "s + e.what());
+    }
+    if (!source.count(Stage::Fragment) && variant.render_state.color_write) {
+        throw std::runtime_error(
+            "Fragment shader required for colour writes at: "s + name);
+    }
+    m_push_ranges = interface.push_ranges;
+
+    buildPipeline(source, renderPass, m_layout, variant);
+}
+
+std::string PipelineVariant::key(const std::string& program) const {
+    std::ostringstream key{};
+    key << program << '|';
+    for (const auto& binding : attribs.bindings) {
+        key << binding.binding << ',' << binding.stride << ','
+            << binding.inputRate << ';';
+    }
+    key << '|';
+    for (const auto& attribute : attribs.attributes) {
+        key << attribute.location << ',' << attribute.binding << ','
+            << attribute.format << ',' << attribute.offset << ';';
+    }
+    key << '|' << render_state.cull_mode << ',' << render_state.depth_compare
+        << ',' << render_state.depth_write << ',' << render_state.blend << ','
+        << render_state.color_write << '|';
+    for (const auto& [id, value] : constants) {
+        key << id << '=' << value << ';';
+    }
+    return key.str();
+}
+
+GraphicsPipeline::ProgramSource GraphicsPipeline::loadProgramSource(
+    const std::filesystem::path& dir) {
     ProgramSource source{};
     for (auto entry : std::filesystem::directory_iterator(dir)) {
         if (entry.is_regular_file()) {
@@ -42,13 +131,31 @@ GraphicsPipeline::GraphicsPipeline(Device& device, RenderPass& renderPass,
             source.emplace(stage, loadShaderSource(path));
         }
     }
-    if (source.count(Stage::Vertex) && source.count(Stage::Fragment)) {
-        buildPipeline(source, renderPass, layout, attribs);
-    } else {
-        throw std::runtime_error(
-            "Source for vertex and fragment shaders not fount at: "s +
-            dir.string());
+    if (!source.count(Stage::Vertex)) {
+        throw std::runtime_error("Source for vertex shader not fount at: "s +
+                                 dir.string());
     }
+    return source;
+}
+
+GraphicsPipeline::ProgramSource GraphicsPipeline::embeddedProgramSource(
+    const EmbeddedProgram& program) {
+    ProgramSource source{};
+    for (size_t i{0}; i < program.stage_count; i++) {
+        const auto& stage = program.stages[i];
+        if (stage.stage == VK_SHADER_STAGE_COMPUTE_BIT) {
+            continue;
+        }
+        auto bytes = reinterpret_cast<const char*>(stage.code);
+        source.emplace(static_cast<Stage>(stage.stage),
+                       std::vector<char>(
+                           bytes, bytes + stage.size * sizeof(uint32_t)));
+    }
+    if (!source.count(Stage::Vertex)) {
+        throw std::runtime_error("Embedded program has no vertex shader: "s +
+                                 program.name);
+    }
+    return source;
 }
 
 std::vector<char> GraphicsPipeline::loadShaderSource(
@@ -71,7 +178,10 @@ std::vector<char> GraphicsPipeline::loadShaderSource(
 void GraphicsPipeline::buildPipeline(const ProgramSource& source,
                                      RenderPass& renderPass,
                                      VkPipelineLayout layout,
-                                     const VertexAttribs& attribs) {
+                                     const PipelineVariant& variant) {
+    const auto& attribs = variant.attribs;
+    const auto& render_state = variant.render_state;
+
     VkPipelineInputAssemblyStateCreateInfo assembly_info{};
     assembly_info.sType =
         VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -86,30 +196,22 @@ void GraphicsPipeline::buildPipeline(const ProgramSource& source,
     input_state.vertexAttributeDescriptionCount = attribs.attributes.size();
     input_state.pVertexAttributeDescriptions = attribs.attributes.data();
 
-    const auto& capabilities = device.info().surface_capabilities;
-
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = static_cast<float>(capabilities.currentExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    viewport.height = -static_cast<float>(capabilities.currentExtent.height);
-    viewport.width = static_cast<float>(capabilities.currentExtent.width);
-    VkRect2D scissors{};
-    scissors.extent = {capabilities.currentExtent.width,
-                       capabilities.currentExtent.height};
-    scissors.offset = {0, 0};
     VkPipelineViewportStateCreateInfo viewport_info{};
     viewport_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewport_info.viewportCount = 1;
-    viewport_info.pViewports = &viewport;
     viewport_info.scissorCount = 1;
-    viewport_info.pScissors = &scissors;
+
+    std::array<VkDynamicState, 2> dynamic_states{VK_DYNAMIC_STATE_VIEWPORT,
+                                                 VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamic_info{};
+    dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_info.dynamicStateCount = dynamic_states.size();
+    dynamic_info.pDynamicStates = dynamic_states.data();
 
     VkPipelineRasterizationStateCreateInfo rasterization_info{};
     rasterization_info.sType =
         VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterization_info.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterization_info.cullMode = render_state.cull_mode;
     rasterization_info.depthBiasEnable = VK_FALSE;
     rasterization_info.depthClampEnable = VK_FALSE;
     rasterization_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
@@ -120,10 +222,11 @@ void GraphicsPipeline::buildPipeline(const ProgramSource& source,
     VkPipelineMultisampleStateCreateInfo multisample_info{};
     multisample_info.sType =
         VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisample_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisample_info.rasterizationSamples = renderPass.samples();
 
     VkPipelineColorBlendAttachmentState blend_state{};
-    blend_state.blendEnable = VK_TRUE;
+    blend_state.blendEnable =
+        render_state.blend && render_state.color_write ? VK_TRUE : VK_FALSE;
     blend_state.alphaBlendOp = VK_BLEND_OP_ADD;
     blend_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
     blend_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
@@ -132,8 +235,10 @@ void GraphicsPipeline::buildPipeline(const ProgramSource& source,
     blend_state.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
     blend_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
     blend_state.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        render_state.color_write
+            ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                  VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+            : 0;
 
     VkPipelineColorBlendStateCreateInfo blend_info{};
     blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -144,8 +249,8 @@ void GraphicsPipeline::buildPipeline(const ProgramSource& source,
     depth_info.sType =
         VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     depth_info.depthTestEnable = VK_TRUE;
-    depth_info.depthWriteEnable = VK_TRUE;
-    depth_info.depthCompareOp = VK_COMPARE_OP_LESS;
+    depth_info.depthWriteEnable = render_state.depth_write ? VK_TRUE : VK_FALSE;
+    depth_info.depthCompareOp = render_state.depth_compare;
 
     VkGraphicsPipelineCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -154,29 +259,42 @@ void GraphicsPipeline::buildPipeline(const ProgramSource& source,
     create_info.pRasterizationState = &rasterization_info;
     create_info.pVertexInputState = &input_state;
     create_info.pViewportState = &viewport_info;
+    create_info.pDynamicState = &dynamic_info;
     create_info.pDepthStencilState = &depth_info;
     create_info.pColorBlendState = &blend_info;
+    create_info.pNext = renderPass.renderingInfo();
     create_info.renderPass = *renderPass;
     create_info.layout = layout;
     create_info.subpass = 0;
 
-    auto modules = createShaderModules(source);
+    std::vector<VkSpecializationMapEntry> constant_entries{};
+    std::vector<uint32_t> constant_data{};
+    VkSpecializationInfo specialization{};
+    fillSpecialization(variant.constants, constant_entries, constant_data,
+                       specialization);
+
+    auto modules = createShaderModules(
+        source, constant_entries.empty() ? nullptr : &specialization);
 
     create_info.stageCount = modules.size();
     create_info.pStages = modules.data();
 
-    if (vkCreateGraphicsPipelines(*device, VK_NULL_HANDLE, 1, &create_info,
-                                  nullptr, &m_pipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(*device, device.m_pipeline_cache, 1,
+                                  &create_info,
+                                  device.allocator(HostObject::Pipeline),
+                                  &m_pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline");
     }
 
     for (auto& module : modules) {
-        vkDestroyShaderModule(*device, module.module, nullptr);
+        vkDestroyShaderModule(*device, module.module,
+                              device.allocator(HostObject::ShaderModule));
     }
 }
 
 std::vector<VkPipelineShaderStageCreateInfo>
-GraphicsPipeline::createShaderModules(const ProgramSource& source) {
+GraphicsPipeline::createShaderModules(
+    const ProgramSource& source, const VkSpecializationInfo* specialization) {
     std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
     shader_stages.reserve(source.size());
     for (auto& [stage, code] : source) {
@@ -185,8 +303,9 @@ GraphicsPipeline::createShaderModules(const ProgramSource& source) {
         module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         module_info.codeSize = code.size();
         module_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
-        if (vkCreateShaderModule(*device, &module_info, nullptr, &module) !=
-            VK_SUCCESS) {
+        if (vkCreateShaderModule(*device, &module_info,
+                                 device.allocator(HostObject::ShaderModule),
+                                 &module) != VK_SUCCESS) {
             throw std::runtime_error("failed to create vulkan shader module");
         }
 
@@ -195,9 +314,74 @@ GraphicsPipeline::createShaderModules(const ProgramSource& source) {
         stage_info.module = module;
         stage_info.stage = static_cast<VkShaderStageFlagBits>(stage);
         stage_info.pName = "main";
+        stage_info.pSpecializationInfo = specialization;
         shader_stages.push_back(stage_info);
     }
     return shader_stages;
 }
 
+ComputePipeline::ComputePipeline(Device& device,
+                                 const std::filesystem::path& dir,
+                                 LayoutCache& layouts,
+                                 const std::map<uint32_t, uint32_t>& constants)
+    : ComputePipeline(device,
+                      GraphicsPipeline::loadShaderSource(dir / "comp.spv"s),
+                      dir.string(), layouts, constants) {}
+
+ComputePipeline::ComputePipeline(Device& device, const std::vector<char>& code,
+                                 const std::string& name, LayoutCache& layouts,
+                                 const std::map<uint32_t, uint32_t>& constants)
+    : device(device), m_pipeline{VK_NULL_HANDLE}, m_push_stages{0} {
+    try {
+        auto interface =
+            ShaderInterface::reflect(code, VK_SHADER_STAGE_COMPUTE_BIT);
+        validateConstants(interface, constants);
+        m_layout = layouts.computeLayout(interface);
+        for (const auto& range : interface.push_ranges) {
+            m_push_stages |= range.stageFlags;
+        }
+        m_sets = std::move(interface.sets);
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error("Invalid shader interface at: "s + name +
+                                 ": "s + e.what());
+    }
+
+    VkShaderModule module;
+    VkShaderModuleCreateInfo module_info{};
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.codeSize = code.size();
+    module_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    if (vkCreateShaderModule(*device, &module_info,
+                             device.allocator(HostObject::ShaderModule),
+                             &module) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create vulkan shader module");
+    }
+
+    std::vector<VkSpecializationMapEntry> constant_entries{};
+    std::vector<uint32_t> constant_data{};
+    VkSpecializationInfo specialization{};
+    fillSpecialization(constants, constant_entries, constant_data,
+                       specialization);
+
+    VkComputePipelineCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = module;
+    create_info.stage.pName = "main";
+    create_info.stage.pSpecializationInfo =
+        constant_entries.empty() ? nullptr : &specialization;
+    create_info.layout = m_layout;
+
+    auto result = vkCreateComputePipelines(
+        *device, device.m_pipeline_cache, 1, &create_info,
+        device.allocator(HostObject::Pipeline), &m_pipeline);
+    vkDestroyShaderModule(*device, module,
+                          device.allocator(HostObject::ShaderModule));
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline");
+    }
+}
+
 }  // namespace vks
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "vk/pipeline_statistics.h"
+
+#include <stdexcept>
+
+namespace vks {
+
+StatisticsQueries::StatisticsQueries(Device& device)
+    : device{device}, m_enabled{false}, m_results{} {}
+
+StatisticsQueries::~StatisticsQueries() {
+    for (auto& slot : m_slots) {
+        vkDestroyQueryPool(*device, slot.pool,
+                           device.allocator(HostObject::QueryPool));
+    }
+}
+
+void StatisticsQueries::beginFrame(VkCommandBuffer command, uint32_t slot) {
+    if (slot < m_slots.size() && m_slots[slot].pending) {
+        collect(m_slots[slot]);
+    }
+    if (!m_enabled) {
+        return;
+    }
+    if (slot >= m_slots.size()) {
+        m_slots.resize(slot + 1, Slot{VK_NULL_HANDLE, {}, false});
+    }
+    auto& frame = m_slots[slot];
+    if (frame.pool == VK_NULL_HANDLE) {
+        VkQueryPoolCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        create_info.queryCount = MAX_QUERIES;
+        create_info.pipelineStatistics = COUNTERS;
+        if (vkCreateQueryPool(*device, &create_info,
+                              device.allocator(HostObject::QueryPool),
+                              &frame.pool) != VK_SUCCESS) {
+            throw std::runtime_error(
+                "Failed to create pipeline statistics query pool");
+        }
+    }
+    frame.runs.clear();
+    VK_CALL(vkCmdResetQueryPool)(command, frame.pool, 0, MAX_QUERIES);
+    m_slot = slot;
+    m_active.reset();
+}
+
+void StatisticsQueries::endFrame() {
+    if (!m_slot.has_value()) {
+        return;
+    }
+    auto& slot = m_slots[m_slot.value()];
+    slot.pending = !slot.runs.empty();
+    m_slot.reset();
+}
+
+void StatisticsQueries::begin(VkCommandBuffer command, const std::string& pass,
+                              size_t pipeline) {
+    end(command);
+    if (!m_slot.has_value()) {
+        return;
+    }
+    auto& slot = m_slots[m_slot.value()];
+    if (slot.runs.size() >= MAX_QUERIES) {
+        return;
+    }
+    m_active = static_cast<uint32_t>(slot.runs.size());
+    slot.runs.push_back({pass, pipeline});
+    VK_CALL(vkCmdBeginQuery)(command, slot.pool, m_active.value(), 0);
+}
+
+void StatisticsQueries::end(VkCommandBuffer command) {
+    if (!m_active.has_value()) {
+        return;
+    }
+    VK_CALL(vkCmdEndQuery)(command, m_slots[m_slot.value()].pool,
+                           m_active.value());
+    m_active.reset();
+}
+
+void StatisticsQueries::collect(Slot& slot) {
+    slot.pending = false;
+    auto count = static_cast<uint32_t>(slot.runs.size());
+    std::vector<uint64_t> values(count * COUNTER_COUNT);
+    if (vkGetQueryPoolResults(*device, slot.pool, 0, count,
+                              values.size() * sizeof(uint64_t), values.data(),
+                              COUNTER_COUNT * sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    m_results = {};
+    for (uint32_t i{0}; i < count; i++) {
+        const auto* run = &values[i * COUNTER_COUNT];
+        PipelineCounters counters{run[0], run[1], run[2], run[3]};
+        m_results.frame += counters;
+        m_results.pipelines[slot.runs[i].pipeline] += counters;
+        auto& passes = m_results.passes;
+        if (passes.empty() || passes.back().first != slot.runs[i].pass) {
+            passes.emplace_back(slot.runs[i].pass, PipelineCounters{});
+        }
+        passes.back().second += counters;
+    }
+}
+
+}  // namespace vks
@@ -0,0 +1,170 @@
+#include "vk/readback.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "vk/image.h"
+
+namespace vks {
+
+ReadbackRing::ReadbackRing(Device& device) : device{device}, m_dropped{0} {}
+
+ReadbackRing::~ReadbackRing() {
+    for (auto& slot : m_slots) {
+        release(slot);
+    }
+    if (m_dropped) {
+        std::cout << "Readback dropped " << m_dropped << " frames"
+                  << std::endl;
+    }
+}
+
+void ReadbackRing::start(Consumer&& consumer, size_t slot_count) {
+    m_consumer = std::move(consumer);
+    if (m_slots.size() < slot_count) {
+        m_slots.resize(slot_count, Slot{});
+    }
+}
+
+void ReadbackRing::allocate(Slot& slot, VkDeviceSize size) {
+    VkBufferCreateInfo buffer_info{};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.queueFamilyIndexCount = 1;
+    buffer_info.pQueueFamilyIndices = &device.info().queue_families.graphics;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (vkCreateBuffer(*device, &buffer_info,
+                       device.allocator(HostObject::Buffer),
+                       &slot.buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create readback buffer");
+    }
+    VkMemoryRequirements requirements{};
+    vkGetBufferMemoryRequirements(*device, slot.buffer, &requirements);
+
+    // Cached memory keeps CPU reads fast, it is rarely coherent though
+    VkMemoryAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = requirements.size;
+    try {
+        alloc_info.memoryTypeIndex = device.getMemoryIndex(
+            requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    } catch (const std::runtime_error&) {
+        alloc_info.memoryTypeIndex = device.getMemoryIndex(
+            requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    if (device.allocateMemory(alloc_info, "readback", &slot.memory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate readback buffer memory");
+    }
+    vkBindBufferMemory(*device, slot.buffer, slot.memory, 0);
+
+    void* data{};
+    if (vkMapMemory(*device, slot.memory, 0, VK_WHOLE_SIZE, 0, &data) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Failed to map readback buffer memory");
+    }
+    slot.data = static_cast<uint8_t*>(data);
+    slot.size = size;
+    slot.coherent = device.info()
+                        .memory_properties
+                        .memoryTypes[alloc_info.memoryTypeIndex]
+                        .propertyFlags &
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+void ReadbackRing::release(Slot& slot) {
+    if (slot.buffer == VK_NULL_HANDLE) {
+        return;
+    }
+    vkUnmapMemory(*device, slot.memory);
+    vkDestroyBuffer(*device, slot.buffer, device.allocator(HostObject::Buffer));
+    device.freeMemory(slot.memory);
+    slot = {};
+}
+
+ReadbackRing::Slot* ReadbackRing::acquire(uint64_t serial, VkExtent2D extent,
+                                          VkFormat format) {
+    auto slot = std::find_if(m_slots.begin(), m_slots.end(),
+                             [](const Slot& slot) {
+                                 return !slot.serial.has_value();
+                             });
+    if (slot == m_slots.end()) {
+        m_dropped++;
+        return nullptr;
+    }
+
+    auto texel_size = Image2D::TexelSize(format);
+    if (texel_size == 0) {
+        throw std::runtime_error("Unsupported readback format");
+    }
+    VkDeviceSize size = texel_size * extent.width * extent.height;
+    if (slot->size != size) {
+        release(*slot);
+        allocate(*slot, size);
+    }
+    slot->serial = serial;
+    slot->extent = extent;
+    slot->format = format;
+    return &*slot;
+}
+
+void ReadbackRing::record(VkCommandBuffer command, VkImage image,
+                          const Slot& slot) {
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {slot.extent.width, slot.extent.height, 1};
+    VK_CALL(vkCmdCopyImageToBuffer)(command, image,
+                                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                    slot.buffer, 1, &region);
+
+    // The fence alone does not make transfer writes visible to the host
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = slot.buffer;
+    barrier.size = VK_WHOLE_SIZE;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    VK_CALL(vkCmdPipelineBarrier)(command, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                                  &barrier, 0, nullptr);
+}
+
+void ReadbackRing::consume(uint64_t completed_serial) {
+    std::vector<Slot*> ready{};
+    for (auto& slot : m_slots) {
+        if (slot.serial.has_value() &&
+            slot.serial.value() <= completed_serial) {
+            ready.push_back(&slot);
+        }
+    }
+    std::sort(ready.begin(), ready.end(), [](const Slot* a, const Slot* b) {
+        return a->serial.value() < b->serial.value();
+    });
+
+    for (auto slot : ready) {
+        if (!slot->coherent) {
+            VkMappedMemoryRange range{};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = slot->memory;
+            range.size = VK_WHOLE_SIZE;
+            vkInvalidateMappedMemoryRanges(*device, 1, &range);
+        }
+        if (m_consumer) {
+            m_consumer({slot->serial.value(), slot->extent.width,
+                        slot->extent.height, slot->format, slot->data,
+                        slot->size});
+        }
+        slot->serial.reset();
+    }
+}
+
+}  // namespace vks
@@ -0,0 +1,949 @@
+#include "vk/render_graph.h"
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include "vk/gpu_profiler.h"
+
+namespace vks {
+
+RenderGraph::RenderGraph(Device& device)
+    : device{device}, m_extent{}, m_transients{} {}
+
+RenderGraph::~RenderGraph() {
+    for (auto& transients : m_retired) {
+        destroyTransients(transients);
+    }
+    destroyTransients(m_transients);
+    releaseFramebuffers();
+    for (auto& framebuffer : m_framebuffers) {
+        vkDestroyFramebuffer(*device, framebuffer.framebuffer,
+                             device.allocator(HostObject::Framebuffer));
+    }
+    for (auto& [key, render_pass] : m_render_passes) {
+        vkDestroyRenderPass(*device, render_pass,
+                            device.allocator(HostObject::RenderPass));
+    }
+}
+
+RenderGraph::State RenderGraph::accessState(Access access) {
+    switch (access) {
+        case Access::ColorAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        case Access::DepthAttachment:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+        case Access::ResolveAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        case Access::Sampled:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        case Access::ComputeSampled:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        case Access::ComputeRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL};
+        case Access::StorageRead:
+            return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                        VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case Access::StorageReadWrite:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case Access::TransferSrc:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+        case Access::TransferDst:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+        case Access::Present:
+            return {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+    }
+    throw std::runtime_error("Unknown render graph access");
+}
+
+bool RenderGraph::isWrite(Access access) {
+    return access == Access::ColorAttachment ||
+           access == Access::DepthAttachment ||
+           access == Access::ResolveAttachment ||
+           access == Access::StorageReadWrite ||
+           access == Access::TransferDst;
+}
+
+VkImageUsageFlags RenderGraph::accessUsage(Access access) {
+    switch (access) {
+        case Access::ColorAttachment:
+        case Access::ResolveAttachment:
+            return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        case Access::DepthAttachment:
+            return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        case Access::Sampled:
+        case Access::ComputeSampled:
+        case Access::ComputeRead:
+            return VK_IMAGE_USAGE_SAMPLED_BIT;
+        case Access::StorageRead:
+        case Access::StorageReadWrite:
+            return VK_IMAGE_USAGE_STORAGE_BIT;
+        case Access::TransferSrc:
+            return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        case Access::TransferDst:
+            return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        case Access::Present:
+            return 0;
+    }
+    return 0;
+}
+
+void RenderGraph::reset(VkExtent2D extent) {
+    m_extent = extent;
+    m_passes.clear();
+    m_resources.clear();
+    m_tracking.clear();
+    m_transient_slots.clear();
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name,
+                                               const ImageDesc& desc) {
+    m_resources.push_back({name, desc, VK_NULL_HANDLE, VK_NULL_HANDLE,
+                           VK_NULL_HANDLE, false, 0, std::nullopt,
+                           std::nullopt, SIZE_MAX, 0});
+    return m_resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importImage(
+    const std::string& name, VkImage image, VkImageView view,
+    const ImageDesc& desc, std::optional<State> initial,
+    std::optional<Access> final_access) {
+    m_resources.push_back({name, desc, image, view, VK_NULL_HANDLE, true, 0,
+                           initial, final_access, SIZE_MAX, 0});
+    return m_resources.size() - 1;
+}
+
+void RenderGraph::releaseFramebuffers() {
+    for (auto& [key, framebuffer] : m_framebuffer_cache) {
+        m_framebuffers.push_back(framebuffer);
+    }
+    m_framebuffer_cache.clear();
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name,
+                                                VkBuffer buffer,
+                                                std::optional<State> initial) {
+    m_resources.push_back({name, std::nullopt, VK_NULL_HANDLE, VK_NULL_HANDLE,
+                           buffer, true, 0, initial, std::nullopt, SIZE_MAX,
+                           0});
+    return m_resources.size() - 1;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string& name,
+                                              Execute&& execute) {
+    m_passes.push_back({name, std::move(execute), {}, {}, false, false});
+    return PassBuilder{*this, m_passes.size() - 1};
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(Resource resource,
+                                                         Access access) {
+    graph.m_passes[pass].uses.push_back({resource, access, true, false});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(Resource resource,
+                                                          Access access) {
+    graph.m_passes[pass].uses.push_back(
+        {resource, access, access == Access::StorageReadWrite, true});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::color(
+    Resource resource, std::optional<VkClearColorValue> clear) {
+    auto& attachments = graph.m_passes[pass].attachments;
+    std::optional<VkClearValue> value{};
+    if (clear.has_value()) {
+        value.emplace().color = clear.value();
+    }
+    auto resolves = std::find_if(
+        attachments.begin(), attachments.end(), [](const auto& attachment) {
+            return attachment.access == Access::ResolveAttachment;
+        });
+    attachments.insert(resolves, {resource, Access::ColorAttachment, value});
+    graph.m_passes[pass].uses.push_back(
+        {resource, Access::ColorAttachment, !clear.has_value(), true});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::depth(
+    Resource resource, std::optional<VkClearDepthStencilValue> clear) {
+    auto& attachments = graph.m_passes[pass].attachments;
+    std::optional<VkClearValue> value{};
+    if (clear.has_value()) {
+        value.emplace().depthStencil = clear.value();
+    }
+    attachments.insert(attachments.begin(),
+                       {resource, Access::DepthAttachment, value});
+    graph.m_passes[pass].uses.push_back(
+        {resource, Access::DepthAttachment, !clear.has_value(), true});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::resolve(
+    Resource resource) {
+    graph.m_passes[pass].attachments.push_back(
+        {resource, Access::ResolveAttachment, std::nullopt});
+    graph.m_passes[pass].uses.push_back(
+        {resource, Access::ResolveAttachment, false, true});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffects() {
+    graph.m_passes[pass].side_effects = true;
+    return *this;
+}
+
+void RenderGraph::cullPasses() {
+    // Walking backwards, a pass survives when it has side effects or
+    // writes a resource that is imported or consumed by a surviving pass
+    std::vector<bool> live(m_resources.size(), false);
+    for (size_t i{0}; i < m_resources.size(); i++) {
+        live[i] = m_resources[i].imported;
+    }
+    for (size_t i = m_passes.size(); i-- > 0;) {
+        auto& pass = m_passes[i];
+        pass.culled = !pass.side_effects &&
+                      std::none_of(pass.uses.begin(), pass.uses.end(),
+                                   [&](const Use& use) {
+                                       return use.writes && live[use.resource];
+                                   });
+        if (pass.culled) {
+            continue;
+        }
+        for (const auto& use : pass.uses) {
+            if (use.writes && !m_resources[use.resource].imported) {
+                live[use.resource] = false;
+            }
+        }
+        for (const auto& use : pass.uses) {
+            if (use.reads) {
+                live[use.resource] = true;
+            }
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes() {
+    for (size_t i{0}; i < m_passes.size(); i++) {
+        if (m_passes[i].culled) {
+            continue;
+        }
+        for (const auto& use : m_passes[i].uses) {
+            auto& resource = m_resources[use.resource];
+            resource.first = std::min(resource.first, i);
+            resource.last = std::max(resource.last, i);
+            resource.usage |= accessUsage(use.access);
+        }
+    }
+}
+
+bool RenderGraph::usedAfter(Resource resource, size_t pass) const {
+    return m_resources[resource].last > pass;
+}
+
+uint64_t RenderGraph::handleKey(const ResourceInfo& resource) {
+    return resource.image != VK_NULL_HANDLE ? (uint64_t)resource.image
+                                            : (uint64_t)resource.buffer;
+}
+
+void RenderGraph::realizeTransients(uint64_t serial,
+                                    uint64_t completed_serial) {
+    auto released = std::remove_if(
+        m_retired.begin(), m_retired.end(), [&](Transients& transients) {
+            if (transients.serial > completed_serial) {
+                return false;
+            }
+            destroyTransients(transients);
+            return true;
+        });
+    m_retired.erase(released, m_retired.end());
+
+    std::vector<size_t> transients{};
+    std::ostringstream signature{};
+    signature << m_extent.width << 'x' << m_extent.height << ';';
+    for (size_t i{0}; i < m_resources.size(); i++) {
+        const auto& resource = m_resources[i];
+        if (resource.imported || resource.first == SIZE_MAX) {
+            continue;
+        }
+        const auto& desc = resource.image_desc.value();
+        signature << desc.format << ',' << desc.aspect << ','
+                  << desc.samples << ',' << resource.usage << ','
+                  << resource.first << ',' << resource.last << ';';
+        m_transient_slots.emplace(i, transients.size());
+        transients.push_back(i);
+    }
+
+    if (signature.str() != m_transients.signature) {
+        if (!m_transients.images.empty()) {
+            m_retired.push_back(std::move(m_transients));
+        }
+        releaseFramebuffers();
+        m_transients = {};
+        m_transients.signature = signature.str();
+
+        // Images used only as attachments never leave tile memory on
+        // devices with lazily allocated memory, the rest share one block
+        std::vector<size_t> shared{};
+        std::vector<size_t> shared_resources{};
+        std::vector<VkMemoryRequirements> shared_requirements{};
+        for (size_t slot{0}; slot < transients.size(); slot++) {
+            const auto& resource = m_resources[transients[slot]];
+            const auto& desc = resource.image_desc.value();
+            auto usage = resource.usage;
+            bool attachment_only =
+                !(usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT));
+            if (attachment_only) {
+                usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            }
+
+            auto& image = m_transients.images.emplace_back();
+            image.aliases = {slot};
+
+            VkImageCreateInfo image_info{};
+            image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            image_info.usage = usage;
+            image_info.extent = {m_extent.width, m_extent.height, 1};
+            image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            image_info.imageType = VK_IMAGE_TYPE_2D;
+            image_info.format = desc.format;
+            image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            image_info.mipLevels = 1;
+            image_info.arrayLayers = 1;
+            image_info.samples = desc.samples;
+            if (vkCreateImage(*device, &image_info,
+                              device.allocator(HostObject::Image),
+                              &image.image) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create transient image " +
+                                         resource.name);
+            }
+            VkMemoryRequirements requirements{};
+            vkGetImageMemoryRequirements(*device, image.image, &requirements);
+
+            std::optional<uint32_t> lazy_index{};
+            if (attachment_only) {
+                try {
+                    lazy_index = device.getMemoryIndex(
+                        requirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+                } catch (const std::runtime_error&) {
+                }
+            }
+            if (!lazy_index.has_value()) {
+                shared.push_back(slot);
+                shared_resources.push_back(transients[slot]);
+                shared_requirements.push_back(requirements);
+                continue;
+            }
+            VkMemoryAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            alloc_info.allocationSize = requirements.size;
+            alloc_info.memoryTypeIndex = lazy_index.value();
+            if (device.allocateMemory(alloc_info, "transient images",
+                                      &image.memory) != VK_SUCCESS) {
+                throw std::runtime_error(
+                    "Failed to allocate transient image memory");
+            }
+            vkBindImageMemory(*device, image.image, image.memory, 0);
+        }
+
+        uint32_t type_bits{UINT32_MAX};
+        for (const auto& requirements : shared_requirements) {
+            type_bits &= requirements.memoryTypeBits;
+        }
+        if (type_bits == 0) {
+            // No memory type fits all of them, give up on aliasing
+            for (size_t i{0}; i < shared.size(); i++) {
+                auto& image = m_transients.images[shared[i]];
+                VkMemoryAllocateInfo alloc_info{};
+                alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                alloc_info.allocationSize = shared_requirements[i].size;
+                alloc_info.memoryTypeIndex = device.getMemoryIndex(
+                    shared_requirements[i].memoryTypeBits,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                if (device.allocateMemory(alloc_info, "transient images",
+                                          &image.memory) != VK_SUCCESS) {
+                    throw std::runtime_error(
+                        "Failed to allocate transient image memory");
+                }
+                vkBindImageMemory(*device, image.image, image.memory, 0);
+            }
+            shared.clear();
+        }
+
+        if (!shared.empty()) {
+            std::vector<VkDeviceSize> offsets(shared.size());
+            placeTransients(shared_resources, shared_requirements, offsets);
+
+            VkDeviceSize size{0};
+            for (size_t i{0}; i < shared.size(); i++) {
+                size = std::max(size, offsets[i] + shared_requirements[i].size);
+            }
+            VkMemoryAllocateInfo alloc_info{};
+            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            alloc_info.allocationSize = size;
+            alloc_info.memoryTypeIndex = device.getMemoryIndex(
+                type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            if (device.allocateMemory(alloc_info, "transient images",
+                                      &m_transients.shared_memory) !=
+                VK_SUCCESS) {
+                throw std::runtime_error(
+                    "Failed to allocate transient image memory");
+            }
+
+            for (size_t i{0}; i < shared.size(); i++) {
+                auto& image = m_transients.images[shared[i]];
+                vkBindImageMemory(*device, image.image,
+                                  m_transients.shared_memory, offsets[i]);
+                for (size_t j{0}; j < shared.size(); j++) {
+                    if (i != j &&
+                        offsets[i] < offsets[j] + shared_requirements[j].size &&
+                        offsets[j] < offsets[i] + shared_requirements[i].size) {
+                        image.aliases.push_back(shared[j]);
+                    }
+                }
+            }
+        }
+
+        for (size_t slot{0}; slot < transients.size(); slot++) {
+            const auto& desc = m_resources[transients[slot]].image_desc.value();
+            auto& image = m_transients.images[slot];
+            VkImageViewCreateInfo view_info{};
+            view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            view_info.format = desc.format;
+            view_info.image = image.image;
+            view_info.subresourceRange.aspectMask = desc.aspect;
+            view_info.subresourceRange.layerCount = 1;
+            view_info.subresourceRange.levelCount = 1;
+            view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            if (vkCreateImageView(*device, &view_info,
+                                  device.allocator(HostObject::ImageView),
+                                  &image.view) != VK_SUCCESS) {
+                throw std::runtime_error(
+                    "Failed to create transient image view");
+            }
+        }
+        m_transients.final_states.assign(transients.size(), Tracking{});
+    }
+    m_transients.serial = serial;
+
+    for (size_t slot{0}; slot < transients.size(); slot++) {
+        auto& resource = m_resources[transients[slot]];
+        resource.image = m_transients.images[slot].image;
+        resource.view = m_transients.images[slot].view;
+    }
+}
+
+void RenderGraph::placeTransients(
+    const std::vector<size_t>& transients,
+    const std::vector<VkMemoryRequirements>& reqs,
+    std::vector<VkDeviceSize>& offsets) {
+    struct Placement {
+        VkDeviceSize offset;
+        VkDeviceSize end;
+        size_t first;
+        size_t last;
+    };
+
+    // Largest first, each image goes to the lowest offset where it does
+    // not overlap an image placed earlier whose lifetime overlaps its own
+    std::vector<size_t> order(transients.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return reqs[a].size > reqs[b].size; });
+
+    std::vector<Placement> placed{};
+    for (auto index : order) {
+        const auto& resource = m_resources[transients[index]];
+        const auto& requirements = reqs[index];
+
+        std::vector<VkDeviceSize> candidates{0};
+        for (const auto& placement : placed) {
+            candidates.push_back(placement.end);
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (auto candidate : candidates) {
+            VkDeviceSize offset = (candidate + requirements.alignment - 1) /
+                                  requirements.alignment *
+                                  requirements.alignment;
+            bool overlaps = std::any_of(
+                placed.begin(), placed.end(), [&](const Placement& other) {
+                    return offset < other.end &&
+                           other.offset < offset + requirements.size &&
+                           other.first <= resource.last &&
+                           resource.first <= other.last;
+                });
+            if (!overlaps) {
+                offsets[index] = offset;
+                placed.push_back({offset, offset + requirements.size,
+                                  resource.first, resource.last});
+                break;
+            }
+        }
+    }
+}
+
+void RenderGraph::destroyTransients(Transients& transients) {
+    for (auto& image : transients.images) {
+        vkDestroyImageView(*device, image.view,
+                           device.allocator(HostObject::ImageView));
+        vkDestroyImage(*device, image.image,
+                       device.allocator(HostObject::Image));
+        device.freeMemory(image.memory);
+    }
+    device.freeMemory(transients.shared_memory);
+    transients.images.clear();
+    transients.shared_memory = VK_NULL_HANDLE;
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer command, size_t pass,
+                                 const std::vector<Use>& uses) {
+    VkPipelineStageFlags src_stages{0};
+    VkPipelineStageFlags dst_stages{0};
+    std::vector<VkImageMemoryBarrier> image_barriers{};
+    std::vector<VkBufferMemoryBarrier> buffer_barriers{};
+
+    for (const auto& use : uses) {
+        const auto& resource = m_resources[use.resource];
+        auto& tracking = m_tracking[use.resource];
+
+        // Memory shared with transients used earlier in the frame has to
+        // wait for them as well
+        if (!resource.imported && resource.first == pass) {
+            const auto& image =
+                m_transients.images[m_transient_slots.at(use.resource)];
+            for (auto alias : image.aliases) {
+                for (const auto& [index, slot] : m_transient_slots) {
+                    if (slot != alias || index == use.resource ||
+                        m_resources[index].last >= pass) {
+                        continue;
+                    }
+                    const auto& other = m_tracking[index];
+                    tracking.write_stages |=
+                        other.write_stages | other.read_stages;
+                    tracking.write_access |= other.write_access;
+                }
+            }
+        }
+
+        auto state = accessState(use.access);
+        bool write = isWrite(use.access);
+        bool transition = resource.image != VK_NULL_HANDLE &&
+                          tracking.layout != state.layout;
+        bool hazard =
+            write ? (tracking.write_stages | tracking.read_stages) != 0
+                  : tracking.write_stages != 0 &&
+                        ((state.stages & ~tracking.visible_stages) ||
+                         (state.access & ~tracking.visible_access));
+
+        if (transition || hazard) {
+            src_stages |= tracking.write_stages;
+            if (write || transition) {
+                src_stages |= tracking.read_stages;
+            }
+            dst_stages |= state.stages;
+            if (resource.image != VK_NULL_HANDLE) {
+                VkImageMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = resource.image;
+                barrier.subresourceRange.aspectMask =
+                    resource.image_desc.value().aspect;
+                barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+                barrier.subresourceRange.layerCount =
+                    VK_REMAINING_ARRAY_LAYERS;
+                barrier.oldLayout = tracking.layout;
+                barrier.newLayout = state.layout;
+                barrier.srcAccessMask = tracking.write_access;
+                barrier.dstAccessMask = state.access;
+                image_barriers.push_back(barrier);
+            } else {
+                VkBufferMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.buffer = resource.buffer;
+                barrier.offset = 0;
+                barrier.size = VK_WHOLE_SIZE;
+                barrier.srcAccessMask = tracking.write_access;
+                barrier.dstAccessMask = state.access;
+                buffer_barriers.push_back(barrier);
+            }
+        }
+
+        if (write || transition) {
+            // A layout transition is a write made visible to its
+            // destination scope only
+            if (resource.image != VK_NULL_HANDLE) {
+                tracking.layout = state.layout;
+            }
+            tracking.write_stages = state.stages;
+            tracking.write_access = write ? state.access : 0;
+            tracking.read_stages = write ? 0 : state.stages;
+            tracking.visible_stages = write ? 0 : state.stages;
+            tracking.visible_access = write ? 0 : state.access;
+        } else {
+            if (hazard) {
+                tracking.visible_stages |= state.stages;
+                tracking.visible_access |= state.access;
+            }
+            tracking.read_stages |= state.stages;
+        }
+    }
+
+    if (image_barriers.empty() && buffer_barriers.empty()) {
+        return;
+    }
+    VK_CALL(vkCmdPipelineBarrier)(
+        command, src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        dst_stages, 0, 0, nullptr, buffer_barriers.size(),
+        buffer_barriers.data(), image_barriers.size(), image_barriers.data());
+}
+
+VkAttachmentLoadOp RenderGraph::loadOp(const Attachment& attachment,
+                                       bool load) {
+    return attachment.clear.has_value() ? VK_ATTACHMENT_LOAD_OP_CLEAR
+           : load                       ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                        : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+}
+
+VkAttachmentStoreOp RenderGraph::storeOp(const Attachment& attachment,
+                                         size_t pass) const {
+    return m_resources[attachment.resource].imported ||
+                   usedAfter(attachment.resource, pass)
+               ? VK_ATTACHMENT_STORE_OP_STORE
+               : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+}
+
+VkRenderPass RenderGraph::renderPass(size_t pass,
+                                     const std::vector<bool>& load) {
+    const auto& attachments = m_passes[pass].attachments;
+
+    std::vector<VkAttachmentDescription> descriptions{};
+    std::ostringstream key{};
+    for (size_t i{0}; i < attachments.size(); i++) {
+        const auto& attachment = attachments[i];
+        const auto& resource = m_resources[attachment.resource];
+        const auto& desc = resource.image_desc.value();
+
+        VkAttachmentDescription description{};
+        description.format = desc.format;
+        description.samples = desc.samples;
+        description.loadOp = loadOp(attachment, load[i]);
+        description.storeOp = storeOp(attachment, pass);
+        description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        // Transitions happen in barriers recorded ahead of the pass
+        description.initialLayout = accessState(attachment.access).layout;
+        description.finalLayout = description.initialLayout;
+        descriptions.push_back(description);
+
+        key << static_cast<int>(attachment.access) << ',' << desc.format
+            << ',' << desc.samples << ',' << description.loadOp << ','
+            << description.storeOp << ';';
+    }
+
+    auto cached = m_render_passes.find(key.str());
+    if (cached != m_render_passes.end()) {
+        return cached->second;
+    }
+
+    std::optional<VkAttachmentReference> depth_reference{};
+    std::vector<VkAttachmentReference> color_references{};
+    std::vector<VkAttachmentReference> resolve_references{};
+    for (uint32_t i{0}; i < attachments.size(); i++) {
+        VkAttachmentReference reference{i, descriptions[i].initialLayout};
+        switch (attachments[i].access) {
+            case Access::DepthAttachment:
+                depth_reference = reference;
+                break;
+            case Access::ResolveAttachment:
+                resolve_references.push_back(reference);
+                break;
+            default:
+                color_references.push_back(reference);
+        }
+    }
+    if (!resolve_references.empty() &&
+        resolve_references.size() != color_references.size()) {
+        throw std::runtime_error("Render graph pass " + m_passes[pass].name +
+                                 " must resolve every colour attachment");
+    }
+
+    VkSubpassDescription subpass_desc{};
+    subpass_desc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass_desc.colorAttachmentCount = color_references.size();
+    subpass_desc.pColorAttachments = color_references.data();
+    subpass_desc.pResolveAttachments =
+        resolve_references.empty() ? nullptr : resolve_references.data();
+    subpass_desc.pDepthStencilAttachment =
+        depth_reference.has_value() ? &depth_reference.value() : nullptr;
+
+    VkRenderPassCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    create_info.subpassCount = 1;
+    create_info.pSubpasses = &subpass_desc;
+    create_info.attachmentCount = descriptions.size();
+    create_info.pAttachments = descriptions.data();
+
+    VkRenderPass render_pass{};
+    if (vkCreateRenderPass(*device, &create_info,
+                           device.allocator(HostObject::RenderPass),
+                           &render_pass) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render graph pass " +
+                                 m_passes[pass].name);
+    }
+    m_render_passes.emplace(key.str(), render_pass);
+    return render_pass;
+}
+
+void RenderGraph::beginRendering(VkCommandBuffer command, size_t pass,
+                                 const std::vector<bool>& load) {
+    const auto& attachments = m_passes[pass].attachments;
+
+    std::optional<VkRenderingAttachmentInfoKHR> depth{};
+    std::vector<VkRenderingAttachmentInfoKHR> colors{};
+    std::vector<const Attachment*> resolves{};
+    for (size_t i{0}; i < attachments.size(); i++) {
+        const auto& attachment = attachments[i];
+        if (attachment.access == Access::ResolveAttachment) {
+            resolves.push_back(&attachment);
+            continue;
+        }
+        VkRenderingAttachmentInfoKHR info{};
+        info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        info.imageView = m_resources[attachment.resource].view;
+        info.imageLayout = accessState(attachment.access).layout;
+        info.loadOp = loadOp(attachment, load[i]);
+        info.storeOp = storeOp(attachment, pass);
+        info.clearValue = attachment.clear.value_or(VkClearValue{});
+        if (attachment.access == Access::DepthAttachment) {
+            depth = info;
+        } else {
+            colors.push_back(info);
+        }
+    }
+    if (!resolves.empty() && resolves.size() != colors.size()) {
+        throw std::runtime_error("Render graph pass " + m_passes[pass].name +
+                                 " must resolve every colour attachment");
+    }
+    for (size_t i{0}; i < resolves.size(); i++) {
+        colors[i].resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+        colors[i].resolveImageView = m_resources[resolves[i]->resource].view;
+        colors[i].resolveImageLayout =
+            accessState(Access::ResolveAttachment).layout;
+    }
+
+    VkRenderingInfoKHR rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    rendering_info.renderArea.extent = m_extent;
+    rendering_info.renderArea.offset = {0, 0};
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = colors.size();
+    rendering_info.pColorAttachments = colors.data();
+    rendering_info.pDepthAttachment =
+        depth.has_value() ? &depth.value() : nullptr;
+    VK_COUNT_CALL(vkCmdBeginRenderingKHR);
+    device.m_begin_rendering(command, &rendering_info);
+}
+
+void RenderGraph::recordPass(VkCommandBuffer command, size_t index,
+                             uint64_t serial) {
+    auto& pass = m_passes[index];
+    if (pass.attachments.empty()) {
+        recordBarriers(command, index, pass.uses);
+        pass.execute(command);
+        return;
+    }
+
+    // Contents are only loaded when an earlier use left any
+    std::vector<bool> load{};
+    for (const auto& attachment : pass.attachments) {
+        load.push_back(attachment.access != Access::ResolveAttachment &&
+                       m_tracking[attachment.resource].layout !=
+                           VK_IMAGE_LAYOUT_UNDEFINED);
+    }
+    if (device.info().dynamic_rendering) {
+        recordBarriers(command, index, pass.uses);
+        beginRendering(command, index, load);
+        pass.execute(command);
+        VK_COUNT_CALL(vkCmdEndRenderingKHR);
+        device.m_end_rendering(command);
+        return;
+    }
+
+    auto render_pass = renderPass(index, load);
+    recordBarriers(command, index, pass.uses);
+
+    std::vector<VkImageView> views{};
+    std::vector<VkClearValue> clear_values{};
+    std::ostringstream key{};
+    key << render_pass << ';' << m_extent.width << 'x' << m_extent.height;
+    for (const auto& attachment : pass.attachments) {
+        views.push_back(m_resources[attachment.resource].view);
+        clear_values.push_back(attachment.clear.value_or(VkClearValue{}));
+        key << ';' << views.back();
+    }
+
+    auto [cached, inserted] = m_framebuffer_cache.try_emplace(
+        key.str(), Framebuffer{serial, VK_NULL_HANDLE});
+    if (inserted) {
+        VkFramebufferCreateInfo framebuffer_info{};
+        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_info.attachmentCount = views.size();
+        framebuffer_info.pAttachments = views.data();
+        framebuffer_info.width = m_extent.width;
+        framebuffer_info.height = m_extent.height;
+        framebuffer_info.layers = 1;
+        framebuffer_info.renderPass = render_pass;
+        if (vkCreateFramebuffer(*device, &framebuffer_info,
+                                device.allocator(HostObject::Framebuffer),
+                                &cached->second.framebuffer) != VK_SUCCESS) {
+            m_framebuffer_cache.erase(cached);
+            throw std::runtime_error(
+                "Failed to create render graph framebuffer");
+        }
+    }
+    cached->second.serial = serial;
+
+    VkRenderPassBeginInfo pass_info{};
+    pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_info.renderPass = render_pass;
+    pass_info.framebuffer = cached->second.framebuffer;
+    pass_info.clearValueCount = clear_values.size();
+    pass_info.pClearValues = clear_values.data();
+    pass_info.renderArea.extent = m_extent;
+    pass_info.renderArea.offset = {0, 0};
+
+    VK_CALL(vkCmdBeginRenderPass)(command, &pass_info,
+                                  VK_SUBPASS_CONTENTS_INLINE);
+    pass.execute(command);
+    VK_CALL(vkCmdEndRenderPass)(command);
+}
+
+void RenderGraph::execute(VkCommandBuffer command, uint64_t serial,
+                          uint64_t completed_serial, GpuProfiler* profiler) {
+    auto released = std::remove_if(
+        m_framebuffers.begin(), m_framebuffers.end(),
+        [&](Framebuffer& framebuffer) {
+            if (framebuffer.serial > completed_serial) {
+                return false;
+            }
+            vkDestroyFramebuffer(*device, framebuffer.framebuffer,
+                                 device.allocator(HostObject::Framebuffer));
+            return true;
+        });
+    m_framebuffers.erase(released, m_framebuffers.end());
+
+    cullPasses();
+    computeLifetimes();
+    realizeTransients(serial, completed_serial);
+
+    m_tracking.assign(m_resources.size(), Tracking{});
+    for (size_t i{0}; i < m_resources.size(); i++) {
+        const auto& resource = m_resources[i];
+        auto& tracking = m_tracking[i];
+        if (!resource.imported) {
+            // Whatever last used this memory in the previous frame
+            auto slot = m_transient_slots.find(i);
+            if (slot == m_transient_slots.end()) {
+                continue;
+            }
+            for (auto alias : m_transients.images[slot->second].aliases) {
+                const auto& last = m_transients.final_states[alias];
+                tracking.write_stages |= last.write_stages | last.read_stages;
+                tracking.write_access |= last.write_access;
+            }
+        } else if (resource.initial.has_value()) {
+            const auto& initial = resource.initial.value();
+            tracking.layout = initial.layout;
+            tracking.write_stages = initial.stages;
+            tracking.write_access = initial.access;
+        } else {
+            auto last = m_import_states.find(handleKey(resource));
+            if (last != m_import_states.end()) {
+                tracking = last->second;
+            } else {
+                // First use ever, assume arbitrary earlier writes in the
+                // general layout
+                tracking.layout = VK_IMAGE_LAYOUT_GENERAL;
+                tracking.write_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                tracking.write_access = VK_ACCESS_MEMORY_WRITE_BIT;
+            }
+        }
+    }
+
+    for (size_t i{0}; i < m_passes.size(); i++) {
+        if (m_passes[i].culled) {
+            continue;
+        }
+        if (profiler != nullptr) {
+            profiler->begin(command, m_passes[i].name);
+        }
+        recordPass(command, i, serial);
+        if (profiler != nullptr) {
+            profiler->end(command);
+        }
+    }
+
+    std::vector<Use> final_uses{};
+    for (size_t i{0}; i < m_resources.size(); i++) {
+        const auto& resource = m_resources[i];
+        if (resource.final_access.has_value()) {
+            final_uses.push_back(
+                {i, resource.final_access.value(), false, false});
+        }
+    }
+    recordBarriers(command, m_passes.size(), final_uses);
+
+    // Only imports of this frame are kept, a handle missing from it may have
+    // been destroyed and its value reused for an unrelated resource
+    std::unordered_map<uint64_t, Tracking> import_states{};
+    for (size_t i{0}; i < m_resources.size(); i++) {
+        const auto& resource = m_resources[i];
+        if (!resource.imported) {
+            auto slot = m_transient_slots.find(i);
+            if (slot != m_transient_slots.end()) {
+                m_transients.final_states[slot->second] = m_tracking[i];
+            }
+        } else if (!resource.initial.has_value()) {
+            import_states[handleKey(resource)] = m_tracking[i];
+        }
+    }
+    m_import_states.swap(import_states);
+}
+
+}  // namespace vks
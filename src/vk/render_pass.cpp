@@ -2,27 +2,60 @@
 
 namespace vks {
 
-RenderPass::RenderPass(Device& device) : device{device} {
-    std::array<VkAttachmentDescription, 2> attachments{};
+RenderPass::RenderPass(Device& device, VkSampleCountFlagBits samples)
+    : device{device} {
+    create(samples);
+}
+
+void RenderPass::create(VkSampleCountFlagBits samples) {
+    m_samples = samples;
+    bool multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+
+    m_render_pass = VK_NULL_HANDLE;
+    if (device.info().dynamic_rendering) {
+        // Resolve targets do not take part in pipeline compatibility
+        m_color_format = device.info().surface_format.format;
+        m_rendering_info = {};
+        m_rendering_info.sType =
+            VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        m_rendering_info.colorAttachmentCount = 1;
+        m_rendering_info.pColorAttachmentFormats = &m_color_format;
+        m_rendering_info.depthAttachmentFormat = device.info().depth_format;
+        return;
+    }
+
+    std::array<VkAttachmentDescription, 3> attachments{};
     attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     attachments[0].finalLayout =
         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     attachments[0].format = device.info().depth_format;
-    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].samples = samples;
     attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
     attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[1].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[1].finalLayout =
+        multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                     : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     attachments[1].format = device.info().surface_format.format;
-    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].samples = samples;
     attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                                          : VK_ATTACHMENT_STORE_OP_STORE;
     attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
+    attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[2].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[2].format = device.info().surface_format.format;
+    attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
     VkAttachmentReference depth_attachment{};
     depth_attachment.attachment = 0;
     depth_attachment.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -31,6 +64,10 @@ RenderPass::RenderPass(Device& device) : device{device} {
     color_attachments[0].attachment = 1;
     color_attachments[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    std::array<VkAttachmentReference, 1> resolve_attachments{};
+    resolve_attachments[0].attachment = 2;
+    resolve_attachments[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
     std::array<VkSubpassDependency, 2> dependencies{};
     dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
     dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
@@ -59,24 +96,35 @@ RenderPass::RenderPass(Device& device) : device{device} {
     subpass_desc.colorAttachmentCount = color_attachments.size();
     subpass_desc.pColorAttachments = color_attachments.data();
     subpass_desc.pDepthStencilAttachment = &depth_attachment;
+    if (multisampled) {
+        subpass_desc.pResolveAttachments = resolve_attachments.data();
+    }
 
     VkRenderPassCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     create_info.subpassCount = 1;
     create_info.pSubpasses = &subpass_desc;
-    create_info.attachmentCount = attachments.size();
+    create_info.attachmentCount = multisampled ? 3 : 2;
     create_info.pAttachments = attachments.data();
     create_info.dependencyCount = dependencies.size();
     create_info.pDependencies = dependencies.data();
 
-    if (vkCreateRenderPass(*device, &create_info, nullptr, &m_render_pass) !=
-        VK_SUCCESS) {
+    if (vkCreateRenderPass(*device, &create_info,
+                           device.allocator(HostObject::RenderPass),
+                           &m_render_pass) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create render pass");
     }
 }
 
+void RenderPass::recreate(VkSampleCountFlagBits samples) {
+    vkDestroyRenderPass(*device, m_render_pass,
+                        device.allocator(HostObject::RenderPass));
+    create(samples);
+}
+
 RenderPass::~RenderPass() {
-    vkDestroyRenderPass(*device, m_render_pass, nullptr);
+    vkDestroyRenderPass(*device, m_render_pass,
+                        device.allocator(HostObject::RenderPass));
 }
 
 }  // namespace vks
\ No newline at end of file
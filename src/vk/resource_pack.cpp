@@ -1,9 +1,12 @@
 #include "vk/resource_pack.h"
 
 #include <iterator>
+#include <limits>
 #include <magic_enum.hpp>
 #include <unordered_set>
 
+#include "profiler.h"
+#include "startup.h"
 #include "vk/context.h"
 
 using namespace std::string_literals;
@@ -13,18 +16,21 @@ namespace vks {
 
 ResourcePack::~ResourcePack() {
     if (m_memory != VK_NULL_HANDLE) {
-        vkDestroyDescriptorPool(*device, m_materials.pool, nullptr);
-        vkFreeMemory(*device, m_memory, nullptr);
+        vkDestroyDescriptorPool(*device, m_materials.pool,
+                                device.allocator(HostObject::DescriptorPool));
+        device.freeMemory(m_memory);
     }
 }
 
 ResourcePack ResourcePack::build(Context& context,
                                  const std::vector<std::string>& model_names,
                                  const Resources& resources) {
+    SCOPE("ResourcePack::build");
     auto queue_indices = context.device.getQueueIndices(VK_QUEUE_GRAPHICS_BIT |
                                                         VK_QUEUE_TRANSFER_BIT);
 
     VkDeviceSize vertex_buffer_size{};
+    VkDeviceSize position_buffer_size{};
     VkDeviceSize index_buffer_size{};
     VkDeviceSize staging_buffer_size{};
 
@@ -33,32 +39,41 @@ ResourcePack ResourcePack::build(Context& context,
     std::vector<std::string> texture_names{};
 
     getResourceNames(model_names, resources, model_offsets, material_names,
-                     texture_names, vertex_buffer_size, index_buffer_size,
-                     staging_buffer_size);
+                     texture_names, vertex_buffer_size, position_buffer_size,
+                     index_buffer_size, staging_buffer_size);
 
     VkMemoryRequirements vertex_requirements{};
     vertex_requirements.size = vertex_buffer_size;
+    VkMemoryRequirements position_requirements{};
+    position_requirements.size = position_buffer_size;
     VkMemoryRequirements index_requirements{};
     index_requirements.size = index_buffer_size;
     VkMemoryRequirements uniform_requirements{};
     uniform_requirements.size = material_names.size() * sizeof(MaterialUniform);
 
-    auto buffers =
-        createBuffers(context.device, vertex_requirements, index_requirements,
-                      uniform_requirements, queue_indices);
+    auto buffers = createBuffers(context.device, vertex_requirements,
+                                 position_requirements, index_requirements,
+                                 uniform_requirements, queue_indices);
 
     std::vector<TextureRequirements> texture_requirements{};
     auto texture_images = createTextureImages(
         context.device, texture_names, resources, queue_indices,
         texture_requirements, staging_buffer_size);
 
-    auto memory = allocateMemory(context.device, vertex_requirements,
-                                 index_requirements, uniform_requirements,
-                                 texture_requirements, buffers, texture_images);
+    PackMemory usage{};
+    auto memory = timePhase("allocation", [&]() {
+        return allocateMemory(context.device, vertex_requirements,
+                              position_requirements, index_requirements,
+                              uniform_requirements, texture_requirements,
+                              buffers, texture_images, usage);
+    });
 
-    copyResources(context, staging_buffer_size, model_names, model_offsets,
-                  material_names, texture_names, resources, buffers,
-                  texture_images);
+    {
+        StartupPhase phase{"uploads"};
+        copyResources(context, staging_buffer_size, model_names,
+                      model_offsets, material_names, texture_names, resources,
+                      buffers, texture_images);
+    }
 
     auto texture_views =
         createTextureImageViews(context.device, texture_images);
@@ -76,7 +91,8 @@ ResourcePack ResourcePack::build(Context& context,
     return {context.device,           std::move(buffers),
             std::move(materials),     std::move(model_indices),
             std::move(model_offsets), std::move(texture_images),
-            std::move(texture_views), memory};
+            std::move(texture_views), memory,
+            usage};
 };
 
 void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
@@ -85,6 +101,7 @@ void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
                                     std::vector<std::string>& material_names,
                                     std::vector<std::string>& texture_names,
                                     VkDeviceSize& vertex_buffer_size,
+                                    VkDeviceSize& position_buffer_size,
                                     VkDeviceSize& index_buffer_size,
                                     VkDeviceSize& staging_buffer_size) {
     VkDeviceSize vertex_offset{0};
@@ -92,6 +109,7 @@ void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
 
     staging_buffer_size = 0;
     vertex_buffer_size = 0;
+    position_buffer_size = 0;
     index_buffer_size = 0;
     model_offsets.reserve(model_names.size());
 
@@ -99,14 +117,23 @@ void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
 
     for (const auto& name : model_names) {
         const auto& model = resources.models.at(name);
+        glm::vec3 bounds_min{std::numeric_limits<float>::max()};
+        glm::vec3 bounds_max{std::numeric_limits<float>::lowest()};
+        for (const auto& vertex : model.vertices()) {
+            bounds_min = glm::min(bounds_min, vertex.pos);
+            bounds_max = glm::max(bounds_max, vertex.pos);
+        }
         model_offsets.push_back(ModelOffset{vertex_offset, index_offset,
-                                            model.indices().size(), SIZE_MAX});
+                                            model.indices().size(), SIZE_MAX,
+                                            bounds_min, bounds_max});
 
         vertex_offset += model.vertices().size();
         index_offset += model.indices().size();
 
         VkDeviceSize vertex_bytes =
             model.vertices().size() * sizeof(Model::Vertex);
+        VkDeviceSize position_bytes =
+            model.vertices().size() * sizeof(glm::vec3);
         VkDeviceSize index_bytes = model.indices().size() * sizeof(uint32_t);
 
         staging_buffer_size =
@@ -115,6 +142,7 @@ void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
         unique_materials.insert(model.material());
 
         vertex_buffer_size += vertex_bytes;
+        position_buffer_size += position_bytes;
         index_buffer_size += index_bytes;
     }
 
@@ -156,6 +184,7 @@ void ResourcePack::getResourceNames(const std::vector<std::string>& model_names,
 
 ResourcePack::Buffers ResourcePack::createBuffers(
     Device& device, VkMemoryRequirements& vertex_requirements,
+    VkMemoryRequirements& position_requirements,
     VkMemoryRequirements& index_requirements,
     VkMemoryRequirements& uniform_requirements,
     const std::vector<uint32_t>& queue_indices) {
@@ -164,6 +193,11 @@ ResourcePack::Buffers ResourcePack::createBuffers(
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         queue_indices);
 
+    Buffer position(
+        device, position_requirements.size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        queue_indices);
+
     Buffer index(
         device, index_requirements.size,
         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
@@ -175,10 +209,12 @@ ResourcePack::Buffers ResourcePack::createBuffers(
         queue_indices);
 
     vertex_requirements = vertex.memoryRequirements();
+    position_requirements = position.memoryRequirements();
     index_requirements = index.memoryRequirements();
     uniform_requirements = uniform.memoryRequirements();
 
-    return {std::move(vertex), std::move(index), std::move(uniform)};
+    return {std::move(vertex), std::move(position), std::move(index),
+            std::move(uniform)};
 }
 
 std::vector<Image2D> ResourcePack::createTextureImages(
@@ -222,28 +258,37 @@ std::vector<Image2D> ResourcePack::createTextureImages(
 
 VkDeviceMemory ResourcePack::allocateMemory(
     Device& device, const VkMemoryRequirements& vertex_requirements,
+    const VkMemoryRequirements& position_requirements,
     const VkMemoryRequirements& index_requirements,
     const VkMemoryRequirements& uniform_requirements,
     const std::vector<TextureRequirements>& texture_requirements,
-    Buffers& buffers, std::vector<Image2D>& images) {
+    Buffers& buffers, std::vector<Image2D>& images, PackMemory& usage) {
     VkDeviceSize alloc_size{};
     uint32_t type_bits{UINT32_MAX};
 
-    auto memoryOffset = [&](const VkMemoryRequirements& req) mutable {
+    auto memoryOffset = [&](const VkMemoryRequirements& req,
+                            VkDeviceSize& bytes) mutable {
         VkDeviceSize offset =
             (alloc_size + (req.alignment - 1)) / req.alignment * req.alignment;
+        usage.padding += offset - alloc_size;
+        bytes += req.size;
         alloc_size = offset + req.size;
         type_bits &= req.memoryTypeBits;
         return offset;
     };
 
-    VkDeviceSize vertex_offset = memoryOffset(vertex_requirements);
-    VkDeviceSize index_offset = memoryOffset(index_requirements);
-    VkDeviceSize uniform_offset = memoryOffset(uniform_requirements);
+    VkDeviceSize vertex_offset =
+        memoryOffset(vertex_requirements, usage.vertex);
+    VkDeviceSize position_offset =
+        memoryOffset(position_requirements, usage.vertex);
+    VkDeviceSize index_offset = memoryOffset(index_requirements, usage.index);
+    VkDeviceSize uniform_offset =
+        memoryOffset(uniform_requirements, usage.uniform);
 
     std::vector<VkDeviceSize> texture_offsets(texture_requirements.size(), 0);
     for (size_t i{0}; i < texture_requirements.size(); i++) {
-        texture_offsets[i] = memoryOffset(texture_requirements[i].second);
+        texture_offsets[i] =
+            memoryOffset(texture_requirements[i].second, usage.texture);
     }
 
     VkDeviceMemory memory{};
@@ -252,13 +297,14 @@ VkDeviceMemory ResourcePack::allocateMemory(
     alloc_info.allocationSize = alloc_size;
     alloc_info.memoryTypeIndex =
         device.getMemoryIndex(type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    if (vkAllocateMemory(*device, &alloc_info, nullptr, &memory) !=
+    if (device.allocateMemory(alloc_info, "resource pack", &memory) !=
         VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to allocate resource pack device memory");
     }
 
     buffers.vertex.bindMemory(memory, vertex_offset);
+    buffers.position.bindMemory(memory, position_offset);
     buffers.index.bindMemory(memory, index_offset);
     buffers.uniform.bindMemory(memory, uniform_offset);
 
@@ -278,7 +324,8 @@ void ResourcePack::copyResources(Context& context,
                                  const std::vector<std::string>& texture_names,
                                  const Resources& resources, Buffers& buffers,
                                  std::vector<Image2D>& images) {
-    StagingBuffer staging_buffer{context.device, staging_buffer_size};
+    StagingBuffer staging_buffer{context.device, staging_buffer_size,
+                                 &context.m_profiler};
 
     for (size_t i{0}; i < model_names.size(); i++) {
         const auto& name = model_names[i];
@@ -291,6 +338,15 @@ void ResourcePack::copyResources(Context& context,
             buffers.vertex, offsets.vertex_offset * sizeof(Model::Vertex),
             model.vertices().data(),
             model.vertices().size() * sizeof(Model::Vertex));
+
+        std::vector<glm::vec3> positions{};
+        positions.reserve(model.vertices().size());
+        for (const auto& vertex : model.vertices()) {
+            positions.push_back(vertex.pos);
+        }
+        staging_buffer.copyBuffer(
+            buffers.position, offsets.vertex_offset * sizeof(glm::vec3),
+            positions.data(), positions.size() * sizeof(glm::vec3));
     }
 
     std::vector<MaterialUniform> material_uniforms{material_names.size()};
@@ -344,8 +400,9 @@ ResourcePack::Materials ResourcePack::createMaterialDescriptors(
     pool_info.maxSets = material_count;
 
     VkDescriptorPool pool{};
-    if (vkCreateDescriptorPool(*context.device, &pool_info, nullptr, &pool) !=
-        VK_SUCCESS) {
+    if (vkCreateDescriptorPool(*context.device, &pool_info,
+                               device.allocator(HostObject::DescriptorPool),
+                               &pool) != VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to create resource pack materials descriptor pool");
     }
@@ -410,8 +467,8 @@ ResourcePack::Materials ResourcePack::createMaterialDescriptors(
         write_info[0].dstSet = descriptor_sets[i];
         write_info[1].dstSet = descriptor_sets[i];
 
-        vkUpdateDescriptorSets(*context.device, write_info.size(),
-                               write_info.data(), 0, nullptr);
+        VK_CALL(vkUpdateDescriptorSets)(*context.device, write_info.size(),
+                                        write_info.data(), 0, nullptr);
     };
 
     return {pool, std::move(descriptor_sets)};
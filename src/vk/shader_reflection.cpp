@@ -0,0 +1,497 @@
+#include "vk/shader_reflection.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace vks {
+
+namespace spirv {
+constexpr uint32_t MAGIC = 0x07230203;
+constexpr uint32_t HEADER_WORDS = 5;
+
+enum Op : uint32_t {
+    OpName = 5,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+};
+
+enum Decoration : uint32_t {
+    SpecId = 1,
+    Block = 2,
+    BufferBlock = 3,
+    ArrayStride = 6,
+    MatrixStride = 7,
+    BuiltIn = 11,
+    Location = 30,
+    Binding = 33,
+    DescriptorSet = 34,
+    Offset = 35,
+};
+
+enum StorageClass : uint32_t {
+    UniformConstant = 0,
+    Input = 1,
+    Uniform = 2,
+    PushConstant = 9,
+    StorageBuffer = 12,
+};
+
+enum Dim : uint32_t {
+    DimBuffer = 5,
+    DimSubpassData = 6,
+};
+}  // namespace spirv
+
+class SpirvModule {
+   public:
+    SpirvModule(const std::vector<char>& code) {
+        if (code.size() % sizeof(uint32_t) != 0 ||
+            code.size() < spirv::HEADER_WORDS * sizeof(uint32_t)) {
+            throw std::runtime_error("Invalid SPIR-V module size");
+        }
+        std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+        std::memcpy(words.data(), code.data(), code.size());
+        if (words[0] != spirv::MAGIC) {
+            throw std::runtime_error("Invalid SPIR-V module magic number");
+        }
+
+        size_t offset{spirv::HEADER_WORDS};
+        while (offset < words.size()) {
+            uint32_t count = words[offset] >> 16;
+            uint32_t opcode = words[offset] & 0xFFFF;
+            if (count == 0 || offset + count > words.size()) {
+                throw std::runtime_error("Malformed SPIR-V instruction");
+            }
+            parseInstruction(opcode, &words[offset + 1], count - 1);
+            offset += count;
+        }
+    }
+
+    struct Type {
+        uint32_t opcode;
+        std::vector<uint32_t> operands;
+    };
+
+    struct Decorations {
+        std::optional<uint32_t> set;
+        std::optional<uint32_t> binding;
+        std::optional<uint32_t> location;
+        std::optional<uint32_t> array_stride;
+        std::optional<uint32_t> spec_id;
+        bool built_in;
+        bool block;
+        bool buffer_block;
+    };
+
+    struct MemberDecorations {
+        uint32_t offset;
+        uint32_t matrix_stride;
+        bool built_in;
+    };
+
+    struct Variable {
+        uint32_t id;
+        uint32_t type;
+        uint32_t storage;
+    };
+
+    const Type& type(uint32_t id) const {
+        auto item = m_types.find(id);
+        if (item == m_types.end()) {
+            throw std::runtime_error("SPIR-V type " + std::to_string(id) +
+                                     " not declared");
+        }
+        return item->second;
+    }
+
+    Decorations decorations(uint32_t id) const {
+        auto item = m_decorations.find(id);
+        return item != m_decorations.end() ? item->second : Decorations{};
+    }
+
+    MemberDecorations memberDecorations(uint32_t id, uint32_t member) const {
+        auto item = m_member_decorations.find(memberKey(id, member));
+        return item != m_member_decorations.end() ? item->second
+                                                  : MemberDecorations{};
+    }
+
+    uint32_t constant(uint32_t id) const { return m_constants.at(id); }
+
+    std::string name(uint32_t id) const {
+        auto item = m_names.find(id);
+        return item != m_names.end() && !item->second.empty()
+                   ? item->second
+                   : "%" + std::to_string(id);
+    }
+
+    const std::vector<Variable>& variables() const { return m_variables; }
+    const std::set<uint32_t>& specIds() const { return m_spec_ids; }
+
+    uint32_t pointee(const Variable& variable) const {
+        const auto& pointer = type(variable.type);
+        if (pointer.opcode != spirv::OpTypePointer) {
+            throw std::runtime_error("SPIR-V variable " + name(variable.id) +
+                                     " is not a pointer");
+        }
+        return pointer.operands[1];
+    }
+
+    uint32_t size(uint32_t id, uint32_t matrix_stride) const {
+        const auto& t = type(id);
+        switch (t.opcode) {
+            case spirv::OpTypeInt:
+            case spirv::OpTypeFloat:
+                return t.operands[0] / 8;
+            case spirv::OpTypeVector:
+                return t.operands[1] * size(t.operands[0], 0);
+            case spirv::OpTypeMatrix: {
+                uint32_t column = matrix_stride != 0
+                                      ? matrix_stride
+                                      : size(t.operands[0], 0);
+                return t.operands[1] * column;
+            }
+            case spirv::OpTypeArray: {
+                uint32_t stride = decorations(id).array_stride.value_or(
+                    size(t.operands[0], matrix_stride));
+                return constant(t.operands[1]) * stride;
+            }
+            case spirv::OpTypeRuntimeArray:
+                return 0;
+            case spirv::OpTypeStruct: {
+                uint32_t struct_size{0};
+                for (uint32_t i{0}; i < t.operands.size(); i++) {
+                    auto member = memberDecorations(id, i);
+                    struct_size =
+                        std::max(struct_size,
+                                 member.offset + size(t.operands[i],
+                                                      member.matrix_stride));
+                }
+                return struct_size;
+            }
+            default:
+                throw std::runtime_error(
+                    "Unsupported SPIR-V type in block layout");
+        }
+    }
+
+   private:
+    static uint64_t memberKey(uint32_t id, uint32_t member) {
+        return (static_cast<uint64_t>(id) << 32) | member;
+    }
+
+    void parseInstruction(uint32_t opcode, const uint32_t* operands,
+                          uint32_t count) {
+        switch (opcode) {
+            case spirv::OpName:
+                if (count > 1) {
+                    auto* name = reinterpret_cast<const char*>(operands + 1);
+                    m_names[operands[0]] = std::string{
+                        name, strnlen(name, (count - 1) * sizeof(uint32_t))};
+                }
+                break;
+            case spirv::OpTypeInt:
+            case spirv::OpTypeFloat:
+            case spirv::OpTypeVector:
+            case spirv::OpTypeMatrix:
+            case spirv::OpTypeImage:
+            case spirv::OpTypeSampler:
+            case spirv::OpTypeSampledImage:
+            case spirv::OpTypeArray:
+            case spirv::OpTypeRuntimeArray:
+            case spirv::OpTypeStruct:
+            case spirv::OpTypePointer:
+                m_types[operands[0]] =
+                    Type{opcode, {operands + 1, operands + count}};
+                break;
+            case spirv::OpConstant:
+                m_constants[operands[1]] = operands[2];
+                break;
+            case spirv::OpVariable:
+                m_variables.push_back(
+                    Variable{operands[1], operands[0], operands[2]});
+                break;
+            case spirv::OpDecorate:
+                decorate(m_decorations[operands[0]], operands[1],
+                         count > 2 ? operands[2] : 0);
+                break;
+            case spirv::OpMemberDecorate: {
+                auto& member =
+                    m_member_decorations[memberKey(operands[0], operands[1])];
+                if (operands[2] == spirv::Offset) {
+                    member.offset = operands[3];
+                } else if (operands[2] == spirv::MatrixStride) {
+                    member.matrix_stride = operands[3];
+                } else if (operands[2] == spirv::BuiltIn) {
+                    member.built_in = true;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void decorate(Decorations& decorations, uint32_t decoration,
+                  uint32_t value) {
+        switch (decoration) {
+            case spirv::DescriptorSet:
+                decorations.set = value;
+                break;
+            case spirv::Binding:
+                decorations.binding = value;
+                break;
+            case spirv::Location:
+                decorations.location = value;
+                break;
+            case spirv::ArrayStride:
+                decorations.array_stride = value;
+                break;
+            case spirv::SpecId:
+                decorations.spec_id = value;
+                m_spec_ids.insert(value);
+                break;
+            case spirv::BuiltIn:
+                decorations.built_in = true;
+                break;
+            case spirv::Block:
+                decorations.block = true;
+                break;
+            case spirv::BufferBlock:
+                decorations.buffer_block = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::unordered_map<uint32_t, Type> m_types;
+    std::unordered_map<uint32_t, uint32_t> m_constants;
+    std::unordered_map<uint32_t, std::string> m_names;
+    std::unordered_map<uint32_t, Decorations> m_decorations;
+    std::unordered_map<uint64_t, MemberDecorations> m_member_decorations;
+    std::vector<Variable> m_variables;
+    std::set<uint32_t> m_spec_ids;
+};
+
+static VkDescriptorType descriptorType(const SpirvModule& module,
+                                       const SpirvModule::Variable& variable,
+                                       uint32_t type_id) {
+    const auto& type = module.type(type_id);
+    switch (variable.storage) {
+        case spirv::UniformConstant:
+            if (type.opcode == spirv::OpTypeSampledImage) {
+                return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            } else if (type.opcode == spirv::OpTypeSampler) {
+                return VK_DESCRIPTOR_TYPE_SAMPLER;
+            } else if (type.opcode == spirv::OpTypeImage) {
+                auto dim = type.operands[1];
+                auto sampled = type.operands[5];
+                if (dim == spirv::DimSubpassData) {
+                    return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                } else if (dim == spirv::DimBuffer) {
+                    return sampled == 2
+                               ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                               : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                }
+                return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                    : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+            }
+            break;
+        case spirv::Uniform:
+            if (module.decorations(type_id).buffer_block) {
+                return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            } else if (module.decorations(type_id).block) {
+                return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+            break;
+        case spirv::StorageBuffer:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        default:
+            break;
+    }
+    throw std::runtime_error("Unsupported descriptor type of shader resource " +
+                             module.name(variable.id));
+}
+
+static VkFormat vertexInputFormat(const SpirvModule& module,
+                                  const SpirvModule::Variable& variable,
+                                  uint32_t type_id) {
+    const auto& type = module.type(type_id);
+    uint32_t components{1};
+    auto component_type = &type;
+    if (type.opcode == spirv::OpTypeVector) {
+        components = type.operands[1];
+        component_type = &module.type(type.operands[0]);
+    }
+    if (component_type->operands[0] == 32) {
+        std::array<VkFormat, 4> formats{};
+        if (component_type->opcode == spirv::OpTypeFloat) {
+            formats = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+                       VK_FORMAT_R32G32B32_SFLOAT,
+                       VK_FORMAT_R32G32B32A32_SFLOAT};
+        } else if (component_type->opcode == spirv::OpTypeInt &&
+                   component_type->operands[1] == 1) {
+            formats = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT,
+                       VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+        } else if (component_type->opcode == spirv::OpTypeInt) {
+            formats = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT,
+                       VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+        }
+        if (formats[0] != VK_FORMAT_UNDEFINED && components <= 4) {
+            return formats[components - 1];
+        }
+    }
+    throw std::runtime_error("Unsupported vertex input type of " +
+                             module.name(variable.id));
+}
+
+ShaderInterface ShaderInterface::reflect(const std::vector<char>& code,
+                                         VkShaderStageFlagBits stage) {
+    SpirvModule module{code};
+    ShaderInterface interface{};
+
+    for (const auto& variable : module.variables()) {
+        auto decorations = module.decorations(variable.id);
+        auto type_id = module.pointee(variable);
+
+        if (variable.storage == spirv::UniformConstant ||
+            variable.storage == spirv::Uniform ||
+            variable.storage == spirv::StorageBuffer) {
+            VkDescriptorSetLayoutBinding binding{};
+            binding.binding = decorations.binding.value_or(0);
+            binding.descriptorCount = 1;
+            binding.stageFlags = stage;
+            if (module.type(type_id).opcode == spirv::OpTypeArray) {
+                const auto& array = module.type(type_id);
+                binding.descriptorCount = module.constant(array.operands[1]);
+                type_id = array.operands[0];
+            }
+            binding.descriptorType = descriptorType(module, variable, type_id);
+
+            auto& bindings = interface.sets[decorations.set.value_or(0)];
+            if (std::any_of(bindings.begin(), bindings.end(), [&](auto& b) {
+                    return b.binding == binding.binding;
+                })) {
+                throw std::runtime_error(
+                    "Shader resource " + module.name(variable.id) +
+                    " reuses set " +
+                    std::to_string(decorations.set.value_or(0)) + " binding " +
+                    std::to_string(binding.binding));
+            }
+            bindings.push_back(binding);
+        } else if (variable.storage == spirv::PushConstant) {
+            const auto& block = module.type(type_id);
+            uint32_t offset{UINT32_MAX};
+            for (uint32_t i{0}; i < block.operands.size(); i++) {
+                offset = std::min(offset,
+                                  module.memberDecorations(type_id, i).offset);
+            }
+            VkPushConstantRange range{};
+            range.stageFlags = stage;
+            range.offset = block.operands.empty() ? 0 : offset;
+            range.size = module.size(type_id, 0) - range.offset;
+            interface.push_ranges.push_back(range);
+        } else if (variable.storage == spirv::Input &&
+                   stage == VK_SHADER_STAGE_VERTEX_BIT &&
+                   !decorations.built_in) {
+            if (!decorations.location.has_value()) {
+                throw std::runtime_error("Vertex input " +
+                                         module.name(variable.id) +
+                                         " has no location");
+            }
+            interface.vertex_inputs.emplace(
+                decorations.location.value(),
+                vertexInputFormat(module, variable, type_id));
+        }
+    }
+
+    interface.spec_constants = module.specIds();
+
+    for (auto& [set, bindings] : interface.sets) {
+        std::sort(bindings.begin(), bindings.end(),
+                  [](auto& a, auto& b) { return a.binding < b.binding; });
+    }
+    return interface;
+}
+
+void ShaderInterface::merge(const ShaderInterface& other) {
+    for (const auto& [set, other_bindings] : other.sets) {
+        auto& bindings = sets[set];
+        for (const auto& other_binding : other_bindings) {
+            auto binding = std::find_if(
+                bindings.begin(), bindings.end(),
+                [&](auto& b) { return b.binding == other_binding.binding; });
+            if (binding == bindings.end()) {
+                bindings.push_back(other_binding);
+            } else if (binding->descriptorType ==
+                           other_binding.descriptorType &&
+                       binding->descriptorCount ==
+                           other_binding.descriptorCount) {
+                binding->stageFlags |= other_binding.stageFlags;
+            } else {
+                throw std::runtime_error(
+                    "Shader stages declare conflicting resources at set " +
+                    std::to_string(set) + " binding " +
+                    std::to_string(other_binding.binding));
+            }
+        }
+        std::sort(bindings.begin(), bindings.end(),
+                  [](auto& a, auto& b) { return a.binding < b.binding; });
+    }
+
+    for (const auto& other_range : other.push_ranges) {
+        auto range = std::find_if(
+            push_ranges.begin(), push_ranges.end(), [&](auto& r) {
+                return r.offset == other_range.offset &&
+                       r.size == other_range.size;
+            });
+        if (range != push_ranges.end()) {
+            range->stageFlags |= other_range.stageFlags;
+        } else {
+            push_ranges.push_back(other_range);
+        }
+    }
+
+    vertex_inputs.insert(other.vertex_inputs.begin(),
+                         other.vertex_inputs.end());
+    spec_constants.insert(other.spec_constants.begin(),
+                          other.spec_constants.end());
+}
+
+void ShaderInterface::validateVertexInput(
+    const std::vector<VkVertexInputAttributeDescription>& attributes) const {
+    for (const auto& [location, format] : vertex_inputs) {
+        auto attribute = std::find_if(
+            attributes.begin(), attributes.end(),
+            [&](auto& attribute) { return attribute.location == location; });
+        if (attribute == attributes.end()) {
+            throw std::runtime_error("Vertex input at location " +
+                                     std::to_string(location) +
+                                     " not provided by vertex attributes");
+        }
+        if (attribute->format != format) {
+            throw std::runtime_error("Vertex input at location " +
+                                     std::to_string(location) +
+                                     " does not match vertex attribute format");
+        }
+    }
+}
+
+}  // namespace vks
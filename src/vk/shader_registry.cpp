@@ -0,0 +1,18 @@
+#include "vk/shader_registry.h"
+
+#include <iterator>
+#include <stdexcept>
+
+#include "embedded_shaders.h"
+
+namespace vks {
+
+const EmbeddedProgram& embeddedProgram(ShaderProgram program) {
+    auto index = static_cast<size_t>(program);
+    if (index >= std::size(embedded::PROGRAMS)) {
+        throw std::runtime_error("Unknown embedded shader program");
+    }
+    return embedded::PROGRAMS[index];
+}
+
+}  // namespace vks
@@ -0,0 +1,384 @@
+#include "vk/shader_watcher.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+using namespace std::string_literals;
+
+namespace vks {
+
+std::array<std::string, 6> SHADER_SOURCE_EXTENSIONS{
+    ".vert"s, ".frag"s, ".tesc"s, ".tese"s, ".geom"s, ".comp"s};
+
+ShaderWatcher::ShaderWatcher(const std::filesystem::path& source_root,
+                             const std::filesystem::path& cache_root,
+                             ReloadCallback&& callback)
+    : m_source_root{source_root},
+      m_cache_root{cache_root},
+      m_callback{std::move(callback)},
+      m_running{true} {
+    if (!std::filesystem::is_directory(m_source_root)) {
+        throw std::runtime_error("Shader source directory not found at: "s +
+                                 m_source_root.string());
+    }
+    m_source_root = std::filesystem::canonical(m_source_root);
+    std::filesystem::create_directories(m_cache_root / "spv");
+    std::filesystem::create_directories(m_cache_root / "pipelines");
+    m_thread = std::thread{&ShaderWatcher::watch, this};
+}
+
+ShaderWatcher::~ShaderWatcher() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ShaderWatcher::watch() {
+#ifdef __linux__
+    watchInotify();
+#else
+    watchPolling();
+#endif
+}
+
+void ShaderWatcher::watchInotify() {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to initialize inotify, polling shader sources"
+                  << std::endl;
+        watchPolling();
+        return;
+    }
+
+    // Every directory under the root is watched, including ones created
+    // later, so new programs and shared include files are picked up too
+    std::unordered_map<int, std::filesystem::path> watched{};
+    auto add_watches = [&](const std::filesystem::path& root) {
+        std::vector<std::filesystem::path> dirs{root};
+        std::error_code error{};
+        for (std::filesystem::recursive_directory_iterator it{root, error};
+             !error && it != std::filesystem::recursive_directory_iterator{};
+             it.increment(error)) {
+            if (it->is_directory(error)) {
+                dirs.push_back(it->path());
+            }
+        }
+        for (const auto& dir : dirs) {
+            int wd = inotify_add_watch(fd, dir.string().c_str(),
+                                       IN_CLOSE_WRITE | IN_MOVED_TO |
+                                           IN_CREATE);
+            if (wd >= 0) {
+                watched[wd] = dir;
+            }
+        }
+    };
+    add_watches(m_source_root);
+
+    alignas(inotify_event) std::array<char, 4096> buffer{};
+    std::unordered_set<std::string> changed{};
+    std::set<std::filesystem::path> changed_files{};
+    pollfd poll_fd{fd, POLLIN, 0};
+    while (m_running) {
+        // Editors usually touch a file several times per save, so changes
+        // are collected until the directory stays quiet for a short while
+        bool pending = !changed.empty() || !changed_files.empty();
+        int ready = poll(&poll_fd, 1, pending ? 50 : 100);
+        if (ready > 0) {
+            ssize_t length{};
+            while ((length = read(fd, buffer.data(), buffer.size())) > 0) {
+                for (ssize_t offset{0}; offset < length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(
+                        buffer.data() + offset);
+                    offset += sizeof(inotify_event) + event->len;
+                    auto dir = watched.find(event->wd);
+                    if (dir == watched.end()) {
+                        continue;
+                    }
+                    if (event->mask & IN_IGNORED) {
+                        watched.erase(dir);
+                        continue;
+                    }
+                    if (event->len == 0) {
+                        continue;
+                    }
+                    auto path = dir->second / event->name;
+                    if (event->mask & IN_ISDIR) {
+                        add_watches(path);
+                        // Stages written before the watch was added are
+                        // only seen by compiling the whole program
+                        if (path.parent_path() == m_source_root) {
+                            changed.insert(path.filename().string());
+                        }
+                    } else if (event->mask & IN_CREATE) {
+                        continue;
+                    } else if (auto name = programName(path)) {
+                        changed.insert(name.value());
+                    } else {
+                        changed_files.insert(path);
+                    }
+                }
+            }
+        } else if (ready == 0 && pending) {
+            auto dependents = dependentPrograms(changed_files);
+            changed.insert(dependents.begin(), dependents.end());
+            reload(changed);
+            changed.clear();
+            changed_files.clear();
+        }
+    }
+    close(fd);
+#endif
+}
+
+void ShaderWatcher::watchPolling() {
+    using FileTime = std::filesystem::file_time_type;
+    std::unordered_map<std::string, FileTime> timestamps{};
+    bool first_scan{true};
+    auto scan = [&](std::unordered_set<std::string>& changed,
+                    std::set<std::filesystem::path>& changed_files) {
+        for (auto entry :
+             std::filesystem::recursive_directory_iterator(m_source_root)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            auto time = entry.last_write_time();
+            auto [item, inserted] =
+                timestamps.try_emplace(entry.path().string(), time);
+            // Files seen for the first time after startup are new ones
+            if (inserted ? first_scan : item->second == time) {
+                continue;
+            }
+            item->second = time;
+            if (auto name = programName(entry.path())) {
+                changed.insert(name.value());
+            } else {
+                changed_files.insert(entry.path());
+            }
+        }
+        first_scan = false;
+    };
+
+    std::unordered_set<std::string> changed{};
+    std::set<std::filesystem::path> changed_files{};
+    scan(changed, changed_files);
+    while (m_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        changed.clear();
+        changed_files.clear();
+        scan(changed, changed_files);
+        auto dependents = dependentPrograms(changed_files);
+        changed.insert(dependents.begin(), dependents.end());
+        if (!changed.empty()) {
+            reload(changed);
+        }
+    }
+}
+
+void ShaderWatcher::reload(const std::unordered_set<std::string>& names) {
+    for (const auto& name : names) {
+        try {
+            auto dir = compileProgram(name);
+            if (dir.has_value()) {
+                std::cout << "Shader reload: " << name << std::endl;
+                m_callback(name, dir.value());
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Shader reload failed for " << name << ": "
+                      << e.what() << std::endl;
+        }
+    }
+}
+
+std::unordered_set<std::string> ShaderWatcher::dependentPrograms(
+    const std::set<std::filesystem::path>& files) const {
+    std::unordered_set<std::string> names{};
+    if (files.empty()) {
+        return names;
+    }
+    for (auto program : std::filesystem::directory_iterator(m_source_root)) {
+        if (!program.is_directory()) {
+            continue;
+        }
+        for (auto entry :
+             std::filesystem::directory_iterator(program.path())) {
+            if (!entry.is_regular_file() || !isShaderSource(entry.path())) {
+                continue;
+            }
+            auto includes = includedFiles(entry.path());
+            if (std::any_of(includes.begin(), includes.end(),
+                            [&](const auto& include) {
+                                return files.count(include) > 0;
+                            })) {
+                names.insert(program.path().filename().string());
+                break;
+            }
+        }
+    }
+    return names;
+}
+
+std::set<std::filesystem::path> ShaderWatcher::includedFiles(
+    const std::filesystem::path& filepath) const {
+    static const std::regex INCLUDE{R"(^\s*#\s*include\s*([<"])([^>"]+)[>"])"};
+    std::set<std::filesystem::path> included{};
+    std::vector<std::filesystem::path> pending{filepath};
+    while (!pending.empty()) {
+        auto current = std::move(pending.back());
+        pending.pop_back();
+        std::ifstream fs(current);
+        std::string line{};
+        while (std::getline(fs, line)) {
+            std::smatch match{};
+            if (!std::regex_search(line, match, INCLUDE)) {
+                continue;
+            }
+            // Same lookup as glslc with the root as include directory,
+            // quoted names are tried next to the including file first
+            std::vector<std::filesystem::path> candidates{};
+            if (match[1] == "\"") {
+                candidates.push_back(current.parent_path() / match[2].str());
+            }
+            candidates.push_back(m_source_root / match[2].str());
+            for (const auto& candidate : candidates) {
+                auto resolved = candidate.lexically_normal();
+                if (std::filesystem::is_regular_file(resolved)) {
+                    if (included.insert(resolved).second) {
+                        pending.push_back(resolved);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    return included;
+}
+
+std::optional<std::string> ShaderWatcher::programName(
+    const std::filesystem::path& filepath) const {
+    auto dir = filepath.parent_path();
+    if (!isShaderSource(filepath) || dir.parent_path() != m_source_root) {
+        return std::nullopt;
+    }
+    return dir.filename().string();
+}
+
+std::optional<std::filesystem::path> ShaderWatcher::compileProgram(
+    const std::string& name) {
+    std::vector<std::pair<std::string, std::filesystem::path>> stages{};
+    for (auto entry :
+         std::filesystem::directory_iterator(m_source_root / name)) {
+        if (!entry.is_regular_file() || !isShaderSource(entry.path())) {
+            continue;
+        }
+        auto spv = compileStage(entry.path());
+        if (!spv.has_value()) {
+            return std::nullopt;
+        }
+        stages.emplace_back(entry.path().extension().string().substr(1),
+                            spv.value());
+    }
+    if (stages.empty()) {
+        return std::nullopt;
+    }
+
+    auto program_dir = m_cache_root / "pipelines" / name;
+    std::filesystem::remove_all(program_dir);
+    std::filesystem::create_directories(program_dir);
+    for (const auto& [stage, spv] : stages) {
+        std::filesystem::copy_file(spv, program_dir / (stage + ".spv"s));
+    }
+    return program_dir;
+}
+
+std::optional<std::filesystem::path> ShaderWatcher::compileStage(
+    const std::filesystem::path& filepath) {
+    std::ifstream fs(filepath, std::ios::binary);
+    if (!fs.is_open()) {
+        throw std::runtime_error("Failed to open file at: "s +
+                                 filepath.string());
+    }
+    std::vector<char> source{std::istreambuf_iterator<char>(fs),
+                             std::istreambuf_iterator<char>()};
+    auto extension = filepath.extension().string();
+    source.insert(source.end(), extension.begin(), extension.end());
+    // Included sources are part of the key, so editing one of them
+    // compiles the stage again
+    for (const auto& include : includedFiles(filepath)) {
+        std::ifstream include_fs(include, std::ios::binary);
+        auto name = include.string();
+        source.insert(source.end(), name.begin(), name.end());
+        source.insert(source.end(),
+                      std::istreambuf_iterator<char>(include_fs),
+                      std::istreambuf_iterator<char>());
+    }
+
+    std::stringstream hash{};
+    hash << std::hex << std::setw(16) << std::setfill('0')
+         << sourceHash(source);
+    auto spv_path = m_cache_root / "spv" / (hash.str() + ".spv"s);
+    if (std::filesystem::exists(spv_path)) {
+        return spv_path;
+    }
+
+    auto temp_path = spv_path;
+    temp_path += ".tmp"s;
+    auto command = "glslc \""s + filepath.string() + "\" -I \""s +
+                   m_source_root.string() + "\" -o \""s +
+                   temp_path.string() + "\" 2>&1"s;
+    auto* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        throw std::runtime_error("Failed to run glslc");
+    }
+    std::string output{};
+    std::array<char, 256> line{};
+    while (std::fgets(line.data(), line.size(), pipe)) {
+        output += line.data();
+    }
+    if (pclose(pipe) != 0) {
+        std::cerr << output;
+        std::filesystem::remove(temp_path);
+        return std::nullopt;
+    }
+    std::filesystem::rename(temp_path, spv_path);
+    return spv_path;
+}
+
+bool ShaderWatcher::isShaderSource(const std::filesystem::path& filepath) {
+    auto extension = filepath.extension().string();
+    return std::find(SHADER_SOURCE_EXTENSIONS.begin(),
+                     SHADER_SOURCE_EXTENSIONS.end(),
+                     extension) != SHADER_SOURCE_EXTENSIONS.end();
+}
+
+uint64_t ShaderWatcher::sourceHash(const std::vector<char>& source) {
+    uint64_t hash{14695981039346656037ULL};
+    for (char byte : source) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+}  // namespace vks
@@ -3,35 +3,127 @@
 #include <algorithm>
 
 namespace vks {
-Swapchain::Swapchain(Device& device, RenderPass& renderPass) : device{device} {
-    createSwapchain();
-    createDepthBuffer();
-    createFramebuffers(renderPass);
+
+constexpr uint32_t OFFSCREEN_IMAGE_COUNT{3};
+
+Swapchain::Swapchain(Device& device)
+    : device{device},
+      m_latency_mode{LatencyMode::Balanced},
+      m_tearing{false} {
+    m_swapchain = VK_NULL_HANDLE;
+    if (device.headless()) {
+        createOffscreenImages();
+    } else {
+        createSwapchain(VK_NULL_HANDLE);
+    }
+    createImageViews();
     createSynchronizationPrimitives();
     createCommandBuffers();
     m_current_frame = 0;
+    m_submit_serial = 0;
+    m_completed_serial = 0;
+    m_outdated = false;
 }
 
 Swapchain::~Swapchain() {
-    for (size_t i{0}; i < m_images.size(); i++) {
-        vkDestroySemaphore(*device, m_image_draw_finished[i], nullptr);
-        vkDestroySemaphore(*device, m_image_draw_ready[i], nullptr);
-        vkDestroyFence(*device, m_image_available[i], nullptr);
-        vkDestroyFramebuffer(*device, m_framebuffers[i], nullptr);
-        vkDestroyImageView(*device, m_image_views[i], nullptr);
+    for (auto& targets : m_retired) {
+        destroyTargets(targets);
+    }
+    auto targets = retireTargets();
+    destroyTargets(targets);
+    m_offscreen_images.clear();
+    for (auto memory : m_offscreen_memory) {
+        device.freeMemory(memory);
+    }
+    destroySynchronizationPrimitives();
+    vkDestroyCommandPool(*device, m_pool,
+                         device.allocator(HostObject::CommandPool));
+}
+
+void Swapchain::destroySynchronizationPrimitives() {
+    for (size_t i{0}; i < m_image_available.size(); i++) {
+        vkDestroySemaphore(*device, m_image_draw_finished[i],
+                           device.allocator(HostObject::Semaphore));
+        vkDestroySemaphore(*device, m_image_draw_ready[i],
+                           device.allocator(HostObject::Semaphore));
+        vkDestroyFence(*device, m_image_available[i],
+                       device.allocator(HostObject::Fence));
     }
-    vkDestroyImageView(*device, m_depth_buffer.view, nullptr);
-    vkDestroyImage(*device, m_depth_buffer.image, nullptr);
-    vkFreeMemory(*device, m_depth_buffer.memory, nullptr);
-    vkDestroySwapchainKHR(*device, m_swapchain, nullptr);
-    vkDestroyCommandPool(*device, m_pool, nullptr);
 }
 
-void Swapchain::createSwapchain() {
+Swapchain::RetiredTargets Swapchain::retireTargets() {
+    RetiredTargets targets{m_submit_serial, m_swapchain,
+                           std::move(m_image_views)};
+    m_swapchain = VK_NULL_HANDLE;
+    m_image_views.clear();
+    m_images.clear();
+    return targets;
+}
+
+void Swapchain::destroyTargets(RetiredTargets& targets) {
+    for (auto view : targets.image_views) {
+        vkDestroyImageView(*device, view,
+                           device.allocator(HostObject::ImageView));
+    }
+    if (targets.swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(*device, targets.swapchain,
+                              device.allocator(HostObject::Swapchain));
+    }
+}
+
+void Swapchain::releaseRetiredTargets(uint64_t presented_serial) {
+    auto released = std::remove_if(
+        m_retired.begin(), m_retired.end(), [&](RetiredTargets& targets) {
+            if (targets.serial >= presented_serial) {
+                return false;
+            }
+            destroyTargets(targets);
+            return true;
+        });
+    m_retired.erase(released, m_retired.end());
+}
+
+bool Swapchain::recreate() {
+    if (device.headless()) {
+        m_outdated = false;
+        return true;
+    }
+    device.updateSurfaceCapabilities();
+    const auto& extent = device.info().surface_capabilities.currentExtent;
+    if (extent.width == 0 || extent.height == 0) {
+        return false;
+    }
+
+    // A signalled fence does not mean the presentation engine is done with
+    // the old swapchain, so old targets stay alive until an image presented
+    // after them is acquired again, and resizing needs no device wait
+    auto image_count = m_images.size();
+    auto retired = retireTargets();
+    createSwapchain(retired.swapchain);
+    createImageViews();
+    m_retired.emplace_back(std::move(retired));
+
+    if (m_images.size() != image_count) {
+        VK_CALL(vkQueueWaitIdle)(device.queues.graphics);
+        VK_CALL(vkQueueWaitIdle)(device.queues.present);
+        m_completed_serial = m_submit_serial;
+
+        destroySynchronizationPrimitives();
+        vkDestroyCommandPool(*device, m_pool,
+                             device.allocator(HostObject::CommandPool));
+        createSynchronizationPrimitives();
+        createCommandBuffers();
+        m_current_frame = 0;
+    }
+    m_outdated = false;
+    return true;
+}
+
+void Swapchain::createSwapchain(VkSwapchainKHR old_swapchain) {
     const auto& capabilities = device.info().surface_capabilities;
     auto surface_format = device.info().surface_format;
     auto depth_format = device.info().depth_format;
-    auto present_mode = device.info().present_mode;
+    auto present_mode = presentMode();
 
     m_extent = capabilities.currentExtent;
     m_extent.height =
@@ -48,10 +140,7 @@ void Swapchain::createSwapchain() {
                                      ? std::pair{VK_SHARING_MODE_CONCURRENT, 2U}
                                      : std::pair{VK_SHARING_MODE_EXCLUSIVE, 1U};
 
-    auto min_images = capabilities.maxImageCount != 0
-                          ? std::min(capabilities.minImageCount + 1,
-                                     capabilities.maxImageCount)
-                          : capabilities.minImageCount + 1;
+    auto min_images = imageCount(capabilities);
 
     VkSwapchainCreateInfoKHR create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -67,72 +156,109 @@ void Swapchain::createSwapchain() {
     create_info.clipped = VK_TRUE;
     create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     create_info.imageArrayLayers = 1;
-    create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // Lets frames be read back for capture where the surface allows it
+    create_info.imageUsage =
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+        (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
     create_info.minImageCount = min_images;
-    create_info.oldSwapchain = VK_NULL_HANDLE;
+    create_info.oldSwapchain = old_swapchain;
 
-    if (vkCreateSwapchainKHR(*device, &create_info, nullptr, &m_swapchain) !=
-        VK_SUCCESS) {
+    if (vkCreateSwapchainKHR(*device, &create_info,
+                             device.allocator(HostObject::Swapchain),
+                             &m_swapchain) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create swapchain");
     }
 }
 
-void Swapchain::createDepthBuffer() {
-    VkImageCreateInfo image_info{};
-    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    image_info.extent = {m_extent.width, m_extent.height, 1};
-    image_info.queueFamilyIndexCount = 1;
-    image_info.pQueueFamilyIndices = &device.info().queue_families.graphics;
-    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    image_info.imageType = VK_IMAGE_TYPE_2D;
-    image_info.format = device.info().depth_format;
-    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    image_info.mipLevels = 1;
-    image_info.arrayLayers = 1;
-    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    if (vkCreateImage(*device, &image_info, nullptr, &m_depth_buffer.image) !=
-        VK_SUCCESS) {
-        throw std::runtime_error("Failed to create depth buffer image");
+VkPresentModeKHR Swapchain::presentMode() const {
+    std::vector<VkPresentModeKHR> preferred{};
+    switch (m_latency_mode) {
+        case LatencyMode::LowLatency:
+            if (m_tearing) {
+                preferred.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+            }
+            preferred.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+            break;
+        case LatencyMode::Smooth:
+            break;
+        case LatencyMode::Balanced:
+        case LatencyMode::Throughput:
+            preferred.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+            break;
     }
-    VkMemoryRequirements requirements{};
-    vkGetImageMemoryRequirements(*device, m_depth_buffer.image, &requirements);
-
-    VkMemoryAllocateInfo alloc_info{};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = requirements.size;
-    alloc_info.memoryTypeIndex = device.getMemoryIndex(
-        requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    if (vkAllocateMemory(*device, &alloc_info, nullptr,
-                         &m_depth_buffer.memory) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate depth buffer memory");
-    }
-    vkBindImageMemory(*device, m_depth_buffer.image, m_depth_buffer.memory, 0);
-
-    VkImageViewCreateInfo view_info{};
-    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    view_info.format = device.info().depth_format;
-    view_info.image = m_depth_buffer.image;
-    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-    view_info.subresourceRange.baseArrayLayer = 0;
-    view_info.subresourceRange.baseMipLevel = 0;
-    view_info.subresourceRange.layerCount = 1;
-    view_info.subresourceRange.levelCount = 1;
-    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    if (vkCreateImageView(*device, &view_info, nullptr, &m_depth_buffer.view) !=
-        VK_SUCCESS) {
-        throw std::runtime_error("Failed to create depth buffer image view");
+    const auto& modes = device.info().present_modes;
+    for (auto mode : preferred) {
+        if (std::find(modes.begin(), modes.end(), mode) != modes.end()) {
+            return mode;
+        }
     }
+    // The only mode every surface supports
+    return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-void Swapchain::createFramebuffers(RenderPass& renderPass) {
+uint32_t Swapchain::imageCount(
+    const VkSurfaceCapabilitiesKHR& capabilities) const {
     uint32_t count{};
-    vkGetSwapchainImagesKHR(*device, m_swapchain, &count, nullptr);
-    m_images.resize(count);
-    vkGetSwapchainImagesKHR(*device, m_swapchain, &count, m_images.data());
+    switch (m_latency_mode) {
+        case LatencyMode::LowLatency:
+            count = std::max(capabilities.minImageCount, 2U);
+            break;
+        case LatencyMode::Balanced:
+        case LatencyMode::Smooth:
+            count = capabilities.minImageCount + 1;
+            break;
+        case LatencyMode::Throughput:
+            count = capabilities.minImageCount + 2;
+            break;
+    }
+    return capabilities.maxImageCount != 0
+               ? std::min(count, capabilities.maxImageCount)
+               : count;
+}
+
+void Swapchain::setLatencyMode(LatencyMode mode, bool tearing) {
+    m_latency_mode = mode;
+    m_tearing = tearing;
+    m_outdated = true;
+}
+
+void Swapchain::createOffscreenImages() {
+    m_extent = device.info().surface_capabilities.currentExtent;
+    auto format = device.info().surface_format.format;
+    for (uint32_t i{0}; i < OFFSCREEN_IMAGE_COUNT; i++) {
+        auto& image = m_offscreen_images.emplace_back(
+            device, m_extent.width, m_extent.height, format,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            device.getQueueIndices(VK_QUEUE_GRAPHICS_BIT));
+
+        auto requirements = image.memoryRequirements();
+        VkMemoryAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = requirements.size;
+        alloc_info.memoryTypeIndex = device.getMemoryIndex(
+            requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        auto& memory = m_offscreen_memory.emplace_back();
+        if (device.allocateMemory(alloc_info, "offscreen images", &memory) !=
+            VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate offscreen image");
+        }
+        image.bindMemory(memory, 0);
+        m_images.push_back(*image);
+    }
+}
+
+void Swapchain::createImageViews() {
+    if (!device.headless()) {
+        uint32_t count{};
+        vkGetSwapchainImagesKHR(*device, m_swapchain, &count, nullptr);
+        m_images.resize(count);
+        vkGetSwapchainImagesKHR(*device, m_swapchain, &count,
+                                m_images.data());
+    }
 
-    m_image_views.resize(count);
+    m_image_views.resize(m_images.size());
     for (size_t i{0}; i < m_images.size(); i++) {
         VkImageViewCreateInfo view_info{};
         view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -144,38 +270,19 @@ void Swapchain::createFramebuffers(RenderPass& renderPass) {
         view_info.subresourceRange.layerCount = 1;
         view_info.subresourceRange.levelCount = 1;
         view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        if (vkCreateImageView(*device, &view_info, nullptr,
+        if (vkCreateImageView(*device, &view_info,
+                              device.allocator(HostObject::ImageView),
                               &m_image_views[i]) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create swapchain image view");
         }
     }
-
-    std::array<VkImageView, 2> attachments{};
-    attachments[0] = m_depth_buffer.view;
-
-    m_framebuffers.resize(count);
-    for (size_t i{0}; i < m_images.size(); i++) {
-        attachments[1] = m_image_views[i];
-
-        VkFramebufferCreateInfo framebuffer_info{};
-        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebuffer_info.attachmentCount = 2;
-        framebuffer_info.pAttachments = attachments.data();
-        framebuffer_info.width = m_extent.width;
-        framebuffer_info.height = m_extent.height;
-        framebuffer_info.layers = 1;
-        framebuffer_info.renderPass = *renderPass;
-        if (vkCreateFramebuffer(*device, &framebuffer_info, nullptr,
-                                &m_framebuffers[i]) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create swapchain framebuffers");
-        }
-    }
 }
 
 void Swapchain::createSynchronizationPrimitives() {
     m_image_available.resize(m_images.size());
     m_image_draw_finished.resize(m_images.size());
     m_image_draw_ready.resize(m_images.size());
+    m_fence_serials.assign(m_images.size(), 0);
 
     VkSemaphoreCreateInfo semaphore_info{};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -185,12 +292,15 @@ void Swapchain::createSynchronizationPrimitives() {
     fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     for (size_t i{0}; i < m_images.size(); i++) {
-        auto rcreated = vkCreateSemaphore(*device, &semaphore_info, nullptr,
-                                          &m_image_draw_ready[i]);
-        auto fcreated = vkCreateSemaphore(*device, &semaphore_info, nullptr,
-                                          &m_image_draw_finished[i]);
-        auto acreated =
-            vkCreateFence(*device, &fence_info, nullptr, &m_image_available[i]);
+        auto rcreated = vkCreateSemaphore(
+            *device, &semaphore_info, device.allocator(HostObject::Semaphore),
+            &m_image_draw_ready[i]);
+        auto fcreated = vkCreateSemaphore(
+            *device, &semaphore_info, device.allocator(HostObject::Semaphore),
+            &m_image_draw_finished[i]);
+        auto acreated = vkCreateFence(*device, &fence_info,
+                                      device.allocator(HostObject::Fence),
+                                      &m_image_available[i]);
         if (rcreated != VK_SUCCESS || fcreated != VK_SUCCESS ||
             acreated != VK_SUCCESS) {
             throw std::runtime_error(
@@ -204,8 +314,9 @@ void Swapchain::createCommandBuffers() {
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = device.info().queue_families.graphics;
     pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    if (vkCreateCommandPool(*device, &pool_info, nullptr, &m_pool) !=
-        VK_SUCCESS) {
+    if (vkCreateCommandPool(*device, &pool_info,
+                            device.allocator(HostObject::CommandPool),
+                            &m_pool) != VK_SUCCESS) {
         throw std::runtime_error(
             "Failed to create swapchian graphics commands pool");
     }
@@ -225,27 +336,70 @@ void Swapchain::createCommandBuffers() {
     }
 }
 
-Swapchain::FrameState Swapchain::acquireImage() {
+std::optional<Swapchain::FrameState> Swapchain::acquireImage() {
+    if (m_outdated && !recreate()) {
+        return std::nullopt;
+    }
     FrameState state{};
-    state._draw_finished = m_image_draw_finished[m_current_frame];
-    state._draw_ready = m_image_draw_ready[m_current_frame];
-    if (vkAcquireNextImageKHR(*device, m_swapchain, UINT64_MAX,
-                              state._draw_ready, VK_NULL_HANDLE,
-                              &state._index) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to acquire next swapchain image");
-    };
+    if (device.headless()) {
+        // Offscreen images are cycled in order, with nothing to wait on
+        // before drawing or to signal for presentation
+        state._index = m_current_frame;
+    } else {
+        state._draw_finished = m_image_draw_finished[m_current_frame];
+        state._draw_ready = m_image_draw_ready[m_current_frame];
+        auto result = VK_CALL(vkAcquireNextImageKHR)(
+            *device, m_swapchain, UINT64_MAX, state._draw_ready,
+            VK_NULL_HANDLE, &state._index);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            m_outdated = true;
+            return std::nullopt;
+        } else if (result == VK_SUBOPTIMAL_KHR) {
+            m_outdated = true;
+        } else if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to acquire next swapchain image");
+        };
+    }
     state._submit_fence = m_image_available[state._index];
-    if (vkWaitForFences(*device, 1, &state._submit_fence, VK_TRUE,
-                        UINT64_MAX) != VK_SUCCESS) {
+    if (VK_CALL(vkWaitForFences)(*device, 1, &state._submit_fence, VK_TRUE,
+                                 UINT64_MAX) != VK_SUCCESS) {
         throw std::runtime_error("Swapchain image available fence timeout");
     }
     vkResetFences(*device, 1, &state._submit_fence);
-    state._framebuffer = m_framebuffers[state._index];
+
+    // Presents complete in order, the image submitted with this serial
+    // being available again means every earlier present has finished
+    auto presented_serial = m_fence_serials[state._index];
+    m_completed_serial = std::max(m_completed_serial, presented_serial);
+    m_fence_serials[state._index] = ++m_submit_serial;
+    releaseRetiredTargets(presented_serial);
+
+    state._image = m_images[state._index];
+    state._view = m_image_views[state._index];
     state._command = m_commands[state._index];
     return state;
 }
 
+void Swapchain::waitSerial(uint64_t serial) {
+    // A serial no longer held by any fence was waited on by acquire
+    auto submitted = std::find(m_fence_serials.begin(), m_fence_serials.end(),
+                               serial);
+    if (serial <= m_completed_serial || submitted == m_fence_serials.end()) {
+        return;
+    }
+    auto fence = m_image_available[submitted - m_fence_serials.begin()];
+    if (VK_CALL(vkWaitForFences)(*device, 1, &fence, VK_TRUE, UINT64_MAX) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("Swapchain submit fence timeout");
+    }
+    m_completed_serial = std::max(m_completed_serial, serial);
+}
+
 void Swapchain::presentImage(FrameState& state) {
+    if (device.headless()) {
+        m_current_frame = (m_current_frame + 1) % m_images.size();
+        return;
+    }
     VkPresentInfoKHR present_info{};
     present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     present_info.swapchainCount = 1;
@@ -254,10 +408,14 @@ void Swapchain::presentImage(FrameState& state) {
     present_info.waitSemaphoreCount = 1;
     present_info.pWaitSemaphores = &state._draw_finished;
 
-    if (vkQueuePresentKHR(device.queues.present, &present_info) != VK_SUCCESS) {
+    auto result = VK_CALL(vkQueuePresentKHR)(device.queues.present,
+                                             &present_info);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        m_outdated = true;
+    } else if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to present swapchain image");
     };
     m_current_frame = (m_current_frame + 1) % m_images.size();
 }
 
-}  // namespace  vks
+}  // namespace  vks
\ No newline at end of file